@@ -115,7 +115,6 @@ tdllist * tdll_remove(tdllist * list, void * data)
 	if (list == NULL) return NULL;
 	tdllist *l;
 	for (l = list; l != NULL; l=l->next) {
-		printf("%p\n", l);
 		if (l->data == data) {
 			// Suppression de cet element
 			if (l->prev == NULL) {
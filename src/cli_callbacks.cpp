@@ -180,6 +180,123 @@ char *cli_input(char *line, int len) {
 	#endif	
 }
 
+/** \brief Affiche les résultats d'un try dont les calculs sont terminés (voir t_database::try_finish() ) */
+static void cli_try_affiche(t_try_pending *tp) {
+	for (int k=0; k<tp->n; k++) {
+		switch (tp->resultats[k]) {
+			case MPM_TRY_OK:
+					MPM_COLOR_OUTPUT
+					printf(/*"Ok. %s a apporte des parts %d/%d\n*/ msg_get_string(MSG_TRY_OK), tp->nicknames[k], tp->apporte_common[k], tp->apporte_secret[k]); 
+					break;
+
+			case MPM_TRY_NOT_FOUND:
+					MPM_COLOR_ERROR printf(msg_get_string(MSG_ERROR_SCOLON)/*"Erreur :"*/); MPM_COLOR_OUTPUT
+					printf(" %s :", tp->nicknames[k]);
+					printf(msg_get_string(MSG_TRY_NOK1) /*" Nickname inconnu ou mot de passe erroné.\n"*/);
+					break;
+
+			case MPM_TRY_ALREADY_OPENED:
+					MPM_COLOR_ERROR printf(msg_get_string(MSG_ERROR_SCOLON)/*"Erreur :"*/); MPM_COLOR_OUTPUT
+					printf(msg_get_string(MSG_TRY_NOK_ALREADY)/*" les parts de %s étaient déjà ouvertes.\n"*/, tp->nicknames[k]);
+					break;
+
+			case MPM_TRY_INCONSISTENT:
+					MPM_COLOR_ERROR printf(msg_get_string(MSG_ERROR_SCOLON)/*"Erreur : "*/); MPM_COLOR_OUTPUT
+					printf(msg_get_string(MSG_TRY_NOK_INCONSISTENT)/*" incohérence dans la base.\n"*/);
+					break;
+
+			case MPM_TRY_MEMORY:
+					MPM_COLOR_ERROR printf(msg_get_string(MSG_ERROR_SCOLON)/*"Erreur : "*/); MPM_COLOR_OUTPUT
+					printf(msg_get_string(MSG_TRY_NOK_MEMORY)/*" mémoire insuffisante pour le calcul de %s, essai à refaire.\n"*/, tp->nicknames[k]);
+					break;
+
+			case MPM_TRY_CANCELLED:
+					MPM_COLOR_ERROR printf(msg_get_string(MSG_ERROR_SCOLON)/*"Erreur : "*/); MPM_COLOR_OUTPUT
+					printf(msg_get_string(MSG_TRY_NOK_CANCELLED)/*" calcul de %s interrompu par la réécriture du fichier, essai à refaire.\n"*/, tp->nicknames[k]);
+					break;
+		
+			default:
+					abort();
+		}
+	}
+}
+
+
+/** \brief Intègre et affiche les résultats des try lancés en arrière-plan
+ *  \param[in] attendre  Si true, attend la fin de tous les calculs en cours. Sinon ne traite que ceux déjà terminés
+ *  \note
+ *  - invoqué sans attendre au début de chaque commande par cli_db_ptr(), et en attendant par save et wait
+ */
+static void cli_try_collect(cparser_context_t *context, t_database *db, bool attendre) {
+	t_try_pending *tp;
+	bool fait = false;
+
+	while ((tp = db->try_collect(attendre)) != NULL) {
+		cli_try_affiche(tp);
+		db->try_pending_free(tp);
+		fait = true;
+	}
+	if (fait) {
+		MPM_COLOR_INPUT
+		cparser_change_current_prompt(context, db->prompt()); 
+	}
+}
+
+/** \brief Accès à la base pour une commande, après intégration des try terminés en arrière-plan
+ *  \note
+ *  - remplace la lecture directe du cookie au début de chaque commande : les résultats d'un try s'affichent à la commande 
+ *    qui suit la fin de son calcul, quelle qu'elle soit, et le prompt est mis à jour
+ */
+static t_database **cli_db_ptr(cparser_context_t *context) {
+	t_database **db_ptr = (t_database**)context->cookie[0];
+
+	if ((db_ptr != NULL) && (*db_ptr != NULL)) cli_try_collect(context, *db_ptr, false);
+	return db_ptr;
+}
+
+
+/** \brief Paramètres de KDF d'après l'argument <LIST:sha256,argon2id:kdf> de init et calibrate
+ *  \param[in]  kdf_ptr  L'argument, ou NULL : sha256 itérés
+ *  \param[out] kdf      Algorithme et lanes, le coût n'est pas touché. Pour Argon2id, une lane par coeur
+ *  \return false, avec un message, si la KDF n'est pas disponible dans cet exécutable
+ */
+static bool cli_kdf_algo(char **kdf_ptr, t_cw_kdf *kdf) {
+	kdf->algo = MPM_KDF_SHA256;
+	kdf->lanes = 1;
+	if ((kdf_ptr != NULL) && (strcmp(*kdf_ptr, "argon2id") == 0)) {
+		kdf->algo = MPM_KDF_ARGON2ID;
+		kdf->lanes = (tw_nb_cpu() < MPM_KDF_LANES_MAX) ? tw_nb_cpu() : MPM_KDF_LANES_MAX;
+	}
+	if (!cw_kdf_disponible(kdf->algo)) {
+		MPM_COLOR_ERROR
+		printf(msg_get_string(MSG_KDF_INDISPONIBLE)/*"Erreur : la KDF '%s' n'est pas disponible dans cet exécutable\n"*/, *kdf_ptr);
+		MPM_COLOR_INPUT
+		printf("\n");
+		return false;
+	}
+	return true;
+}
+
+/** \brief Affiche les paramètres d'une KDF de holders */
+static void cli_kdf_affiche(t_cw_kdf *kdf) {
+	if (kdf->algo == MPM_KDF_ARGON2ID) {
+		printf(msg_get_string(MSG_KDF_ARGON2ID)/*"%d (Argon2id, %d Ko par calcul, %d lanes)\n"*/, kdf->cout, 1 << kdf->cout, kdf->lanes);
+	} else {
+		printf(msg_get_string(MSG_CALIBRATE_ITER)/*"%d (%d sha itérés, %d Ko par calcul)\n"*/, kdf->cout, MPM_KDF_ITERATIONS(kdf->cout), MPM_KDF_ITERATIONS(kdf->cout)*32/1024);
+	}
+}
+
+/** \brief Affiche le coût d'une calibration de la KDF et les durées de try projetées (voir kdf_projection() ) */
+static void cli_calibrate_affiche(t_kdf_calibration *cal) {
+	MPM_COLOR_OUTPUT printf(msg_get_string(MSG_CALIBRATE_COUT)/*"- Coût de la KDF : "*/); 
+	MPM_COLOR_VALUE  cli_kdf_affiche(&cal->kdf);
+	MPM_COLOR_OUTPUT printf(msg_get_string(MSG_CALIBRATE_TRY)/*"- Try avec le bon mot de passe : "*/); 
+	MPM_COLOR_VALUE  printf("%.0f ms\n", cal->duree_try*1000);
+	MPM_COLOR_OUTPUT printf(msg_get_string(MSG_CALIBRATE_PIRE)/*"- Pire cas, mauvais mot de passe (%d blocs, %d threads x %d lanes) : "*/, cal->nb_blocs, cal->nb_threads, cal->lanes); 
+	MPM_COLOR_VALUE  printf("%.0f ms\n", cal->duree_pire*1000);
+}
+
+
 /********************************************************
  * Les callbacks tels que définis automatiquement depuis
  * le fichier .cli
@@ -187,19 +304,23 @@ char *cli_input(char *line, int len) {
  ********************************************************/
 
 
-/** \brief Callback pour la commande : init { file <STRING:filename> { common parts <INT:common_parts> { secret parts <INT:secret_parts> } } }
+/** \brief Callback pour la commande : init { file <STRING:filename> { common parts <INT:common_parts> { secret parts <INT:secret_parts> { kdf cost <INT:kdf_cost> { <LIST:sha256,argon2id:kdf> } } } } }
  *
  * Avec les paramètres éventuellement donnés, sinon paramètres par défaut
  * Possibilité de ne pas renseigner le nom de fichier, dans ce cas il sera demandé à la sauvegarde (et à NULL en attendant)
+ * Le coût de la KDF est le log2 du nombre de sha itérés, ou de la mémoire d'Argon2id en Ko, pour chaque essai de MdP : +1 double le temps d'ouverture et la mémoire
  */
-cparser_result_t cparser_cmd_init_file_filename_common_parts_common_parts_secret_parts_secret_parts(cparser_context_t *context,
+cparser_result_t cparser_cmd_init_file_filename_common_parts_common_parts_secret_parts_secret_parts_kdf_cost_kdf_cost_kdf(cparser_context_t *context,
     char **filename_ptr,
     int32_t *common_parts_ptr,
-    int32_t *secret_parts_ptr) {
+    int32_t *secret_parts_ptr,
+    int32_t *kdf_cost_ptr,
+    char **kdf_ptr) {
 
 	int tresh_common=2, tresh_secret=3; // valeurs par défaut
+	t_cw_kdf kdf;
 	
-	t_database **db_ptr = (t_database**)context->cookie[0]; 
+	t_database **db_ptr = cli_db_ptr(context); 
 
 	assert(db_ptr != NULL);
 
@@ -215,6 +336,15 @@ cparser_result_t cparser_cmd_init_file_filename_common_parts_common_parts_secret
 
 	if (common_parts_ptr) tresh_common=*common_parts_ptr;
 	if (secret_parts_ptr) tresh_secret=*secret_parts_ptr;
+	kdf.cout = (kdf_cost_ptr) ? *kdf_cost_ptr : MPM_KDF_COST_DEFAULT;
+	if (!cli_kdf_algo(kdf_ptr, &kdf)) return CPARSER_NOT_OK;
+	if ((kdf.cout < MPM_KDF_COST_MIN) || (kdf.cout > MPM_KDF_COST_MAX)) {
+		MPM_COLOR_ERROR
+		printf(msg_get_string(MSG_INIT_KDF_COST)/*"Erreur : le coût de la KDF doit être compris entre %d et %d\n"*/, MPM_KDF_COST_MIN, MPM_KDF_COST_MAX);
+		MPM_COLOR_INPUT
+		printf("\n");
+		return CPARSER_NOT_OK;
+	}
 
 	MPM_COLOR_OUTPUT
 	printf(msg_get_string(MSG_INIT_FILE3)/*"Initialisation d'une nouvelle base\n"*/);
@@ -228,11 +358,12 @@ cparser_result_t cparser_cmd_init_file_filename_common_parts_common_parts_secret
 
 	MPM_COLOR_OUTPUT printf(msg_get_string(MSG_INIT_FILE6)/*"- Seuil pour ouverture 'common' : "*/); MPM_COLOR_VALUE printf("%d\n", tresh_common);
 	MPM_COLOR_OUTPUT printf(msg_get_string(MSG_INIT_FILE7)/*"- Seuil pour ouverture 'secret' : "*/); MPM_COLOR_VALUE printf("%d\n", tresh_secret);
+	MPM_COLOR_OUTPUT printf(msg_get_string(MSG_INIT_FILE8)/*"- Coût de la KDF des porteurs : "*/); MPM_COLOR_VALUE cli_kdf_affiche(&kdf);
 	
 	if (filename_ptr == NULL) {
-		*db_ptr = new t_database(tresh_common, tresh_secret, NULL);
+		*db_ptr = new t_database(tresh_common, tresh_secret, NULL, kdf.cout, kdf.algo);
 	} else {
-		*db_ptr = new t_database(tresh_common, tresh_secret, *filename_ptr);
+		*db_ptr = new t_database(tresh_common, tresh_secret, *filename_ptr, kdf.cout, kdf.algo);
 	}
 	cparser_change_current_prompt(context, (*db_ptr)->prompt());
 	
@@ -247,7 +378,7 @@ cparser_result_t cparser_cmd_init_file_filename_common_parts_common_parts_secret
  * Nom de fichier éventuellement donné sur la cli, sinon déjà connu dans la base (sinon, erreur)
  */
 cparser_result_t cparser_cmd_save_filename(cparser_context_t *context, char **filename_ptr) {
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 
 	// Vérifie qu'un base existe en mémoire
@@ -260,6 +391,7 @@ cparser_result_t cparser_cmd_save_filename(cparser_context_t *context, char **fi
 		printf("\n");		
 		return CPARSER_NOT_OK;	
 	}
+	cli_try_collect(context, db, true);
 
 	// Si le nom de fichier n'a pas été fourni, vérifier que la base en a déjà un
 	if (filename_ptr == NULL) { // Si le nom de fichier n'a pas été fourni, vérifier que la base en a déjà un
@@ -317,7 +449,7 @@ cparser_result_t cparser_cmd_save_filename(cparser_context_t *context, char **fi
 /** \brief Callback pour la commande : load <STRING:filename>
  */
 cparser_result_t cparser_cmd_load_filename(cparser_context_t *context, char **filename_ptr) {
-	t_database *db = *(t_database**)context->cookie[0];
+	t_database *db = *cli_db_ptr(context);
 
 	// Vérifie qu'un base existe en mémoire
 	if (db != NULL) {
@@ -372,10 +504,20 @@ cparser_result_t cparser_cmd_load_filename(cparser_context_t *context, char **fi
 }
 
 
-/** \brief Callback pour la commande : try <STRING:nickname>
+/** \brief Callback pour la commande : try <STRING:nickname> { <STRING:nickname2> ... }
+ *  \note 
+ *  - tous les MdP sont saisis d'abord, puis toutes les holders sont essayées ensemble par t_database::try_async()
+ *  - les calculs se déroulent en arrière-plan : la commande rend la main tout de suite, le porteur suivant peut
+ *    saisir son propre try pendant ce temps. Les résultats sont affichés au début de la commande suivante, ou par 'wait'
  */
-cparser_result_t cparser_cmd_try_nickname(cparser_context_t *context,    char **nickname_ptr) { 
-	t_database **db_ptr = (t_database**)context->cookie[0];
+cparser_result_t cparser_cmd_try_nickname_nickname2_nickname3_nickname4_nickname5(cparser_context_t *context, 
+	char **nickname_ptr,
+	char **nickname2_ptr,
+	char **nickname3_ptr,
+	char **nickname4_ptr,
+	char **nickname5_ptr) { 
+
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 
 	// Vérifie qu'un base existe en mémoire
@@ -389,41 +531,42 @@ cparser_result_t cparser_cmd_try_nickname(cparser_context_t *context,    char **
 		return CPARSER_NOT_OK;	
 	}
 	
-	char mdp[256];
+	char **nickname_ptrs[MPM_TRY_MAX_BATCH] = { nickname_ptr, nickname2_ptr, nickname3_ptr, nickname4_ptr, nickname5_ptr };
+	char *nicknames[MPM_TRY_MAX_BATCH];
+	char *mdps[MPM_TRY_MAX_BATCH];
+	char mdp[MPM_TRY_MAX_BATCH][256];
+	int n=0;
 	
 	MPM_COLOR_INPUT
-	printf(msg_get_string(MSG_GIVE_PWD)/*"\tEntrez le mot de passe de '%s' : "*/, *nickname_ptr);
-	cli_input_no_echo(mdp, 255);
-	
-	int apporte_common, apporte_secret;
-	int r = db->try_nickname(*nickname_ptr, mdp, &apporte_common, &apporte_secret);
-	
-	
- 
-    switch (r) {
-		case MPM_TRY_OK:
-				MPM_COLOR_OUTPUT
-				printf(/*"Ok. %s a apporte des parts %d/%d\n*/ msg_get_string(MSG_TRY_OK), *nickname_ptr, apporte_common, apporte_secret); 
-				break;
-
-		case MPM_TRY_NOT_FOUND:
-				MPM_COLOR_ERROR printf(msg_get_string(MSG_ERROR_SCOLON)/*"Erreur :"*/); MPM_COLOR_OUTPUT
-				printf(msg_get_string(MSG_TRY_NOK1) /*" Nickname inconnu ou mot de passe erroné.\n"*/);
-				break;
-
-		case MPM_TRY_ALREADY_OPENED:
-				MPM_COLOR_ERROR printf(msg_get_string(MSG_ERROR_SCOLON)/*"Erreur :"*/); MPM_COLOR_OUTPUT
-				printf(msg_get_string(MSG_TRY_NOK_ALREADY)/*" les parts de %s étaient déjà ouvertes.\n"*/, *nickname_ptr);
-				break;
-
-		case MPM_TRY_INCONSISTENT:
-				MPM_COLOR_ERROR printf(msg_get_string(MSG_ERROR_SCOLON)/*"Erreur : "*/); MPM_COLOR_OUTPUT
-				printf(msg_get_string(MSG_TRY_NOK_INCONSISTENT)/*" incohérence dans la base.\n"*/);
-				break;
+	for (int k=0; k<MPM_TRY_MAX_BATCH; k++) {
+		if (nickname_ptrs[k] == NULL) break;
+		nicknames[n] = *nickname_ptrs[k];
+		mdps[n] = mdp[n];
+		printf(msg_get_string(MSG_GIVE_PWD)/*"\tEntrez le mot de passe de '%s' : "*/, nicknames[n]);
+		cli_input_no_echo(mdp[n], 255);
+		n++;
+	}
+	if (n == MPM_TRY_MAX_BATCH) {
+		MPM_COLOR_OUTPUT
+		printf(msg_get_string(MSG_TRY_MAX)/*"\tAu plus %d holders par 'try' : les suivants sont à donner dans un autre 'try'.\n"*/, MPM_TRY_MAX_BATCH);
+		MPM_COLOR_INPUT
+	}
 	
-		default:
-				abort();
-    }
+	t_try_pending *tp = db->try_async(n, nicknames, mdps);
+	memset(mdp, 0, sizeof(mdp));
+
+	if (tp->nb_scans == 0) {
+		// Aucun calcul à faire, résultat connu tout de suite
+		db->try_finish(tp, true);
+		cli_try_affiche(tp);
+		db->try_pending_free(tp);
+	} else {
+		MPM_COLOR_OUTPUT
+		for (int k=0; k<n; k++) {
+			if (tp->scan_index[k] < 0) continue;
+			printf(msg_get_string(MSG_TRY_PENDING)/*"\tCalcul en cours pour '%s', tapez 'wait' pour attendre le résultat.\n"*/, nicknames[k]);
+		}
+	}
 
 	MPM_COLOR_INPUT
 	cparser_change_current_prompt(context, db->prompt()); 
@@ -431,6 +574,63 @@ cparser_result_t cparser_cmd_try_nickname(cparser_context_t *context,    char **
 }
 
 
+/** \brief Callback pour la commande : wait
+ *  \note Attend la fin des calculs des try lancés en arrière-plan, et affiche leurs résultats
+ */
+cparser_result_t cparser_cmd_wait(cparser_context_t *context) {
+	t_database **db_ptr = cli_db_ptr(context);
+	t_database *db= *db_ptr;
+
+	if ((db == NULL) || (db->pending_tries == NULL)) {
+		MPM_COLOR_OUTPUT
+		printf(msg_get_string(MSG_WAIT_NONE)/*"Aucun essai en attente.\n"*/);
+		MPM_COLOR_INPUT
+		return CPARSER_OK;
+	}
+	cli_try_collect(context, db, true);
+	MPM_COLOR_INPUT
+	return CPARSER_OK;
+}
+
+
+
+/** \brief Callback pour la commande : compact
+ *  \note réécrit dans les pages du fichier les modifications du journal, qui repart vide. Voir t_database::journalise()
+ */
+cparser_result_t cparser_cmd_compact(cparser_context_t *context) {
+	t_database **db_ptr = cli_db_ptr(context);
+	t_database *db= *db_ptr;
+
+	// Vérifie qu'un base existe en mémoire
+	if (db == NULL) {
+		MPM_COLOR_ERROR
+		printf(msg_get_string(MSG_INIT_SAVE1)/*"Pas de base de secret chargée\n"*/);
+		MPM_COLOR_OUTPUT
+		puts(msg_get_string(MSG_INIT_SAVE2)/*"Vous devriez en charger une avec 'load' ou en créer une avec 'init'\n"*/);
+		MPM_COLOR_INPUT
+		printf("\n");
+		return CPARSER_NOT_OK;
+	}
+
+	// Les modifications hors journal passent par 'save', qui vérifie les parts distribuées
+	db->journalise();
+	if ((db->get_journal() < 0) || (db->is_changed() != 0)) {
+		MPM_COLOR_ERROR
+		printf(msg_get_string(MSG_COMPACT_SAVE)/*"Le fichier n'a pas de journal, ou des modifications n'y sont pas : utilisez 'save'\n"*/);
+		MPM_COLOR_INPUT
+		printf("\n");
+		return CPARSER_NOT_OK;
+	}
+
+	MPM_COLOR_OUTPUT
+	printf(msg_get_string(MSG_COMPACT_JOURNAL)/*"Compactage du journal (%ld octets)\n"*/, db->get_journal());
+	db->save();
+	MPM_COLOR_INPUT
+	cparser_change_current_prompt(context, db->prompt());
+	return CPARSER_OK;
+}
+
+
 
 /** \brief Callback pour la commande : quit
  */
@@ -446,7 +646,7 @@ cparser_result_t cparser_cmd_quit(cparser_context_t *context) {
  * \todo vérifier les secrets en tire-lire  
  */
 cparser_result_t cparser_cmd_check(cparser_context_t *context) {	
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 
 	// Vérifie qu'un base existe en mémoire
@@ -518,6 +718,66 @@ cparser_result_t cparser_cmd_check(cparser_context_t *context) {
 }
 
 
+/** \brief Callback pour la commande : calibrate <INT:milliseconds> { <LIST:sha256,argon2id:kdf> }
+ *  \note 
+ *  - choisit le coût de KDF pour qu'un try avec le bon mot de passe dure au plus la durée donnée sur cette machine,
+ *    et projette le pire cas pour le nombre de holders de la base en mémoire
+ *  - sans KDF précisée, celle de la base en mémoire, sinon sha256 itérés
+ *  - la KDF n'est appliquée qu'à une base tout juste créée par init, sans porteur : les hash des chunks holders en dépendent
+ */
+cparser_result_t cparser_cmd_calibrate_milliseconds_kdf(cparser_context_t *context, int32_t *milliseconds_ptr, char **kdf_ptr) {
+	t_database **db_ptr = cli_db_ptr(context);
+	t_database *db= *db_ptr;
+	t_kdf_calibration cal;
+	t_cw_kdf modele;
+	int nb_blocs;
+
+	if (*milliseconds_ptr <= 0) {
+		MPM_COLOR_ERROR
+		printf(msg_get_string(MSG_CALIBRATE_CIBLE)/*"Erreur : la durée cible doit être positive, en millisecondes\n"*/);
+		MPM_COLOR_INPUT
+		printf("\n");
+		return CPARSER_NOT_OK;
+	}
+
+	if ((kdf_ptr == NULL) && (db != NULL)) {
+		modele = db->kdf;
+	} else if (!cli_kdf_algo(kdf_ptr, &modele)) {
+		return CPARSER_NOT_OK;
+	}
+
+	// Sans base en mémoire, la projection est faite pour une seule holder
+	nb_blocs = (db != NULL) ? db->nb_blocs_recherche() : 3;
+
+	MPM_COLOR_OUTPUT
+	printf(msg_get_string(MSG_CALIBRATE_MESURE)/*"Mesure de la KDF des porteurs sur cette machine...\n"*/);
+	kdf_calibrer(*milliseconds_ptr, nb_blocs, &modele, &cal);
+	cli_calibrate_affiche(&cal);
+	if (cal.duree_try*1000 > *milliseconds_ptr) {
+		MPM_COLOR_ERROR
+		printf(msg_get_string(MSG_CALIBRATE_MIN)/*"Attention : la cible n'est pas atteignable, même au coût minimum\n"*/);
+	}
+
+	MPM_COLOR_OUTPUT
+	if ((db != NULL) && (db->is_changed() & MPM_CHANGED_NEW) && (db->holders == NULL)) {
+		db->kdf = cal.kdf;
+		printf(msg_get_string(MSG_CALIBRATE_APPLIQUE)/*"Ce coût est appliqué à la nouvelle base.\n"*/);
+	} else {
+		printf(msg_get_string(MSG_CALIBRATE_INIT)/*"Pour créer une base avec ce coût : init file <fichier> common parts <n> secret parts <n> kdf cost %d %s\n"*/, 
+			cal.kdf.cout, (cal.kdf.algo == MPM_KDF_ARGON2ID) ? "argon2id" : "sha256");
+		if ((db != NULL) && ((db->kdf.cout != cal.kdf.cout) || (db->kdf.algo != cal.kdf.algo))) {
+			printf(msg_get_string(MSG_CALIBRATE_ACTUEL)/*"\nAvec le coût actuel de la base, qui ne change pas après l'ajout des porteurs :\n"*/);
+			kdf_projection(&db->kdf, nb_blocs, &cal);
+			cli_calibrate_affiche(&cal);
+		}
+	}
+
+	MPM_COLOR_INPUT
+	printf("\n");
+	return CPARSER_OK;
+}
+
+
 
 /*************************************************************************************
  * Gestion des porteurs 
@@ -526,7 +786,7 @@ cparser_result_t cparser_cmd_check(cparser_context_t *context) {
 /** \brief Callback pour la commande : new holder <STRING:nickname>
  */
 cparser_result_t cparser_cmd_new_holder_nickname(cparser_context_t *context, char **nickname_ptr) { 
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 
 	// Vérifie qu'un base existe en mémoire
@@ -604,7 +864,7 @@ cparser_result_t cparser_cmd_new_holder_nickname(cparser_context_t *context, cha
 /** \brief Callback pour la commande : edit holder <STRING:nickname> password
  */
 cparser_result_t cparser_cmd_edit_holder_nickname_password(cparser_context_t *context, char **nickname_ptr) {
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	if (db == NULL) {
 		MPM_COLOR_ERROR
@@ -661,6 +921,7 @@ cparser_result_t cparser_cmd_edit_holder_nickname_password(cparser_context_t *co
 		return CPARSER_NOT_OK;	
 	}
 	p->set_password(mdp1);
+	db->journalise();
 	cparser_change_current_prompt(context, db->prompt());
 	MPM_COLOR_INPUT
 	return CPARSER_OK;	
@@ -673,7 +934,7 @@ cparser_result_t cparser_cmd_edit_holder_nickname_password(cparser_context_t *co
 /** \brief Callback pour la commande : edit holder <STRING:nickname> common parts <INT:common_parts>
  */
 cparser_result_t cparser_cmd_edit_holder_nickname_common_parts_common_parts(cparser_context_t *context, char **nickname_ptr, int32_t *common_parts_ptr) {
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	if (db == NULL) {
 		MPM_COLOR_ERROR
@@ -719,6 +980,7 @@ cparser_result_t cparser_cmd_edit_holder_nickname_common_parts_common_parts(cpar
 		return CPARSER_NOT_OK;
 	
 	}
+	db->journalise();
 	cparser_change_current_prompt(context, db->prompt());
 	MPM_COLOR_INPUT
 	printf("\n");
@@ -731,7 +993,7 @@ cparser_result_t cparser_cmd_edit_holder_nickname_common_parts_common_parts(cpar
 /** \brief Callback pour la commande : edit holder <STRING:nickname> secret parts <INT:secret_parts>
  */
 cparser_result_t cparser_cmd_edit_holder_nickname_secret_parts_secret_parts(cparser_context_t *context, char **nickname_ptr, int32_t *secret_parts_ptr) {
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	if (db == NULL) {
 		MPM_COLOR_ERROR
@@ -777,6 +1039,7 @@ cparser_result_t cparser_cmd_edit_holder_nickname_secret_parts_secret_parts(cpar
 		return CPARSER_NOT_OK;
 	}	
 
+	db->journalise();
 	cparser_change_current_prompt(context, db->prompt());
 	MPM_COLOR_INPUT
 	printf("\n");
@@ -787,7 +1050,7 @@ cparser_result_t cparser_cmd_edit_holder_nickname_secret_parts_secret_parts(cpar
 /** \brief Callback pour la commande : edit holder <STRING:nickname> email <STRING:email>
  */
 cparser_result_t cparser_cmd_edit_holder_nickname_email_email(cparser_context_t *context, char **nickname_ptr, char **email_ptr) { 
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	if (db == NULL) {
 		MPM_COLOR_ERROR
@@ -833,6 +1096,7 @@ cparser_result_t cparser_cmd_edit_holder_nickname_email_email(cparser_context_t
 		return CPARSER_NOT_OK;
 	}
 	p->set_email(*email_ptr);
+	db->journalise();
 	cparser_change_current_prompt(context, db->prompt());
 	MPM_COLOR_INPUT
 	printf("\n");	
@@ -843,7 +1107,7 @@ cparser_result_t cparser_cmd_edit_holder_nickname_email_email(cparser_context_t
 /** \brief Callback pour la commande : show holders
  */
 cparser_result_t cparser_cmd_show_holders(cparser_context_t *context) {
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 
 	// Vérifie qu'un base existe en mémoire
@@ -910,7 +1174,7 @@ cparser_result_t cparser_cmd_show_holders(cparser_context_t *context) {
             }
             printf("\n");
     }
-    if ((db->status == MPM_LEVEL_FIRST) || (db->status == MPM_LEVEL_COMMON) || (db->status == MPM_LEVEL_SECRET)) {
+    if ((db->status == MPM_LEVEL_COMMON) || (db->status == MPM_LEVEL_SECRET)) { // avant la base common, les emplacements libres cachent le nombre de holders
             MPM_COLOR_OUTPUT printf(msg_get_string(MSG_SHOW_HOLD5)/*"Nombre total de holders détecté : "*/);
             MPM_COLOR_VALUE printf("%d\n", db->nb_holders);
     }
@@ -921,7 +1185,7 @@ cparser_result_t cparser_cmd_show_holders(cparser_context_t *context) {
 /** \brief Callback pour la commande : delete holder <STRING:nickname>
  */
 cparser_result_t cparser_cmd_delete_holder_nickname(cparser_context_t *context, char **nickname_ptr) {
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	t_holder *p;
 
@@ -996,7 +1260,7 @@ cparser_result_t cparser_cmd_delete_holder_nickname(cparser_context_t *context,
 /** \brief Callback pour la commande : pwd
  */
 cparser_result_t cparser_cmd_pwd(cparser_context_t *context) {
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	t_secret_folder* f = db->get_current_folder();
 	MPM_COLOR_OUTPUT printf(msg_get_string(MSG_CWD)/*"chemin actuel :"*/);
@@ -1010,7 +1274,7 @@ cparser_result_t cparser_cmd_pwd(cparser_context_t *context) {
  * \note le paramètre est une chaine pour prendre en compte le '..'
  */
 cparser_result_t cparser_cmd_cd_id(cparser_context_t *context, char **id_ptr) {
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	t_secret_folder* cf = db->get_current_folder();
 	t_secret_folder *nf;
@@ -1045,7 +1309,7 @@ cparser_result_t cparser_cmd_cd_id(cparser_context_t *context, char **id_ptr) {
 /** \brief Callback pour la commande : ls
  */
 cparser_result_t cparser_cmd_ls(cparser_context_t *context) {
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	//t_secret_folder *cf = (t_secret_folder*)context->cookie[1];	
 	t_secret_folder* cf = db->get_current_folder();
@@ -1079,7 +1343,7 @@ cparser_result_t cparser_cmd_ls(cparser_context_t *context) {
 /** \brief Callback pour la commande : new folder
  */
 cparser_result_t cparser_cmd_new_folder(cparser_context_t *context){
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	char nom_dossier[256];
 	t_secret_folder* cf = db->get_current_folder();
@@ -1095,6 +1359,7 @@ cparser_result_t cparser_cmd_new_folder(cparser_context_t *context){
 	printf(msg_get_string(MSG_NEWFOLD2)/*"ID du nouveau dossier = %d\n"*/, nf->get_id());
 
 	MPM_COLOR_INPUT
+	db->journalise();
 	cparser_change_current_prompt(context, db->prompt());
 	return CPARSER_OK;
 }
@@ -1103,7 +1368,7 @@ cparser_result_t cparser_cmd_new_folder(cparser_context_t *context){
 /** \brief Callback pour la commande : new secret
  */
 cparser_result_t cparser_cmd_new_secret(cparser_context_t *context){
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	//t_secret_folder* cf = (t_secret_folder*)context->cookie[1]; // dossier courant
 	t_secret_folder* cf = db->get_current_folder();
@@ -1124,6 +1389,7 @@ cparser_result_t cparser_cmd_new_secret(cparser_context_t *context){
 	printf("%d\n", id);
 
 	MPM_COLOR_INPUT
+	db->journalise();
 	cparser_change_current_prompt(context, db->prompt());
 	printf("\n");
 	return CPARSER_OK;
@@ -1133,7 +1399,7 @@ cparser_result_t cparser_cmd_new_secret(cparser_context_t *context){
 /** \brief Callback pour la commande : edit secret <INT:id> update { field <STRING:field_name> }
  */
 cparser_result_t cparser_cmd_edit_secret_id_update_field_field_name(cparser_context_t *context, int32_t *id_ptr, char **field_name_ptr) {
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	t_secret_folder* cf = db->get_current_folder();
 	if (id_ptr == NULL) {
@@ -1187,6 +1453,7 @@ cparser_result_t cparser_cmd_edit_secret_id_update_field_field_name(cparser_cont
 	cli_input(v, 255);
 
 	s->update_field(*field_name_ptr, v);
+	db->journalise();
 	cparser_change_current_prompt(context, db->prompt());
 	MPM_COLOR_INPUT
 	return CPARSER_OK;	
@@ -1197,7 +1464,7 @@ cparser_result_t cparser_cmd_edit_secret_id_update_field_field_name(cparser_cont
  */
 cparser_result_t cparser_cmd_edit_secret_id_delete_field_field_name(cparser_context_t *context, int32_t *id_ptr, char **field_name_ptr) {
 
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	t_secret_folder* cf = db->get_current_folder();	
 	if (id_ptr == NULL) {
@@ -1225,6 +1492,7 @@ cparser_result_t cparser_cmd_edit_secret_id_delete_field_field_name(cparser_cont
 	}
 
 	s->delete_field(*field_name_ptr);
+	db->journalise();
 	cparser_change_current_prompt(context, db->prompt());
 	MPM_COLOR_INPUT
 	return CPARSER_OK;
@@ -1234,7 +1502,7 @@ cparser_result_t cparser_cmd_edit_secret_id_delete_field_field_name(cparser_cont
 /** \brief Callback pour la commande : edit secret <INT:id> title
  */
 cparser_result_t cparser_cmd_edit_secret_id_title(cparser_context_t *context, int32_t *id_ptr){
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	t_secret_folder* cf = db->get_current_folder();
 	if (id_ptr == NULL) {
@@ -1263,6 +1531,7 @@ cparser_result_t cparser_cmd_edit_secret_id_title(cparser_context_t *context, in
 	printf(msg_get_string(MSG_ED_SEC_TITLE2)/*"Entrez un nouveau titre : "*/);
 	MPM_COLOR_VALUE cli_input(v, 255);
 	s->set_title(v);
+	db->journalise();
 	cparser_change_current_prompt(context, db->prompt());
 	MPM_COLOR_INPUT
 	return CPARSER_OK;
@@ -1274,7 +1543,7 @@ cparser_result_t cparser_cmd_edit_secret_id_title(cparser_context_t *context, in
  */
 cparser_result_t cparser_cmd_delete_id_force(cparser_context_t *context, int32_t *id_ptr, char **force_ptr)
 {
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	//t_secret_folder* cf = (t_secret_folder*)context->cookie[1]; // dossier courant
 	t_secret_folder* cf = db->get_current_folder();	
@@ -1319,6 +1588,7 @@ cparser_result_t cparser_cmd_delete_id_force(cparser_context_t *context, int32_t
 		printf("\n");		
 		return CPARSER_NOT_OK;	
 	}
+	db->journalise();
 	cparser_change_current_prompt(context, db->prompt());
 	MPM_COLOR_INPUT
 	return CPARSER_OK;
@@ -1328,7 +1598,7 @@ cparser_result_t cparser_cmd_delete_id_force(cparser_context_t *context, int32_t
 /** \brief Callback pour la commande : show secret <INT:id>
  */
 cparser_result_t cparser_cmd_show_secret_id(cparser_context_t *context, int *id_ptr) {
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	//t_secret_folder* cf = (t_secret_folder*)context->cookie[1];
 	t_secret_folder* cf = db->get_current_folder();	
@@ -1343,6 +1613,7 @@ cparser_result_t cparser_cmd_show_secret_id(cparser_context_t *context, int *id_
 	}
 	
 	char *v;
+	if (db->get_status()==MPM_LEVEL_SECRET) s->decrypt_secrets(); // tous les champs secrets en une passe, get_value() les trouve ensuite en clair
 	MPM_COLOR_OUTPUT  
 	printf(msg_get_string(MSG_SHSEC1)/*"Secret ["*/); MPM_COLOR_VALUE printf("%d", *id_ptr); MPM_COLOR_OUTPUT printf("] : "); MPM_COLOR_VALUE printf("%s\n",s->get_title());
 	MPM_COLOR_OUTPUT printf(msg_get_string(MSG_SHSEC2)/*"Contenu :\n"*/);
@@ -1384,7 +1655,7 @@ cparser_result_t cparser_cmd_show_secret_id(cparser_context_t *context, int *id_
  */
 cparser_result_t cparser_cmd_edit_secret_id_generate_field_field_name_length_length(cparser_context_t *context, int32_t *id_ptr, char **field_name_ptr, int32_t *length_ptr) {
 
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	
 	if (db == NULL) {
@@ -1436,6 +1707,7 @@ cparser_result_t cparser_cmd_edit_secret_id_generate_field_field_name_length_len
 	char* pwd = (char*) alloca(length+4);
 	generate_password(pwd, length);
 	s->update_field(*field_name_ptr, pwd);
+	db->journalise();
 	cparser_change_current_prompt(context, db->prompt());
 	MPM_COLOR_INPUT
 	return CPARSER_OK;
@@ -1445,7 +1717,7 @@ cparser_result_t cparser_cmd_edit_secret_id_generate_field_field_name_length_len
  * Rend secret un champ actuellement disponible en niveau 'common'
  */
 cparser_result_t cparser_cmd_edit_secret_id_secret_field_name(cparser_context_t *context, int32_t *id_ptr, char **field_name_ptr) {
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	t_secret_folder* cf = db->get_current_folder();
 	t_secret_item* s = cf->get_secret_by_id(*id_ptr);
@@ -1475,6 +1747,7 @@ cparser_result_t cparser_cmd_edit_secret_id_secret_field_name(cparser_context_t
 		return CPARSER_NOT_OK;		
 	}
 	s->set_field_secret(*field_name_ptr);
+	db->journalise();
 	cparser_change_current_prompt(context, db->prompt());
 	return CPARSER_OK;
 }
@@ -1484,7 +1757,7 @@ cparser_result_t cparser_cmd_edit_secret_id_secret_field_name(cparser_context_t
  * Rend accessible en niveau 'common' un champ réservé avant au niveau 'secret'
  */
 cparser_result_t cparser_cmd_edit_secret_id_common_field_name(cparser_context_t *context, int32_t *id_ptr, char **field_name_ptr) {
-	t_database **db_ptr = (t_database**)context->cookie[0];
+	t_database **db_ptr = cli_db_ptr(context);
 	t_database *db= *db_ptr;
 	t_secret_folder* cf = db->get_current_folder();
 	t_secret_item* s = cf->get_secret_by_id(*id_ptr);
@@ -1515,5 +1788,6 @@ cparser_result_t cparser_cmd_edit_secret_id_common_field_name(cparser_context_t
 	}
 
 	s->set_field_common(*field_name_ptr);
+	db->journalise();
 	return CPARSER_OK;
 }
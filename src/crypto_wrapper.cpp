@@ -68,8 +68,115 @@ Mais ne pas oublier avant de vérifier si cpuid existe (voir guide AMD64 n° 3)
 static BCRYPT_ALG_HANDLE hAlgorithm;
 #endif
 
+#include "thread_wrapper.h" /* après windows.h et ntstatus.h, pour le mutex de la réserve d'aléa */
 
 
+
+/* Réserve d'aléa
+ *
+ * random_bytes() ne sollicite pas la source système à chaque appel : les octets sont servis depuis une réserve de 
+ * CW_ALEA_RESERVE octets, rechargée quand elle est vide. Avec OpenSSL, la réserve est produite par un DRBG AES256-CTR 
+ * ensemencé par RAND_bytes(), et réensemencé toutes les CW_ALEA_RESEMENCE recharges. Après chaque recharge, la clé du 
+ * DRBG est remplacée par les premiers octets produits (effacement rapide de la clé) : ni la clé en mémoire ni la 
+ * réserve ne permettent de retrouver les octets déjà servis, qui sont d'ailleurs effacés de la réserve.
+ * Sous Windows, la réserve est remplie directement par BCryptGenRandom(), lui-même un DRBG AES-CTR.
+ */
+
+#define CW_ALEA_RESERVE 4096  /* octets d'aléa produits à chaque recharge de la réserve */
+#define CW_ALEA_RESEMENCE 256 /* recharges entre deux ensemencements par la source système, soit 1 Mo */
+
+/** \brief État de la réserve d'aléa, partagée par tous les threads */
+typedef struct t_cw_alea {
+	unsigned char reserve[CW_ALEA_RESERVE];
+	size_t dispo;      ///< octets pas encore servis, à la fin de reserve
+	int recharges;     ///< recharges depuis le dernier ensemencement
+	int pret;          ///< mutex initialisé, voir cw_alea_prepare()
+	tw_mutex mutex;
+	#ifdef MPM_OPENSSL
+	EVP_CIPHER_CTX *drbg; ///< AES256-CTR, NULL tant qu'il n'est pas ensemencé
+	#endif
+} t_cw_alea;
+
+static t_cw_alea cw_alea;
+
+/** \brief Octets de la source système, sans passer par la réserve */
+static void cw_alea_source(void *dest, size_t n) {
+	#ifdef MPM_OPENSSL 
+			int rc = RAND_bytes((unsigned char*)dest, (int) n);
+			if(rc != 1) {
+				fprintf(stderr, "runtime error, SSL RAND_bytes()");
+				abort();
+			}
+	
+	#else
+		#ifdef MPM_WINCRYPTO
+			// https://docs.microsoft.com/en-us/windows/desktop/api/bcrypt/nf-bcrypt-bcryptgenrandom
+    		NTSTATUS status= STATUS_UNSUCCESSFUL;
+			status=BCryptGenRandom(hAlgorithm, (PUCHAR)dest, n, 	0 );
+			if(!NT_SUCCESS(status)) {
+				fprintf(stderr, "%s() %s:%d runtime error\n", __func__, __FILE__, __LINE__);
+			}
+		#else
+			size_t i;
+			unsigned char *d;
+			d = (unsigned char*)dest;
+			for (i=0;i<n;i++) {
+				*d = (unsigned char)(rand() & 0xff);
+				d++;
+			}
+			fprintf(stderr,"Warning: use of weak rand() standard function as random source\nThis is not a release-grade build\n");
+		#endif
+	#endif
+}
+
+/** \brief Initialise le mutex de la réserve, au premier besoin. Invoqué depuis le thread principal (random_init()) */
+static void cw_alea_prepare() {
+	if (cw_alea.pret) return;
+	tw_mutex_init(&cw_alea.mutex);
+	cw_alea.dispo = 0;
+	cw_alea.recharges = 0;
+	cw_alea.pret = 1;
+}
+
+#ifdef MPM_OPENSSL
+/** \brief (Re)clé le DRBG avec 48 octets : clé AES256 puis compteur initial */
+static void cw_alea_cle(const unsigned char *graine) {
+	if (cw_alea.drbg == NULL) cw_alea.drbg = EVP_CIPHER_CTX_new();
+	if ((cw_alea.drbg == NULL) || (EVP_EncryptInit_ex(cw_alea.drbg, EVP_aes_256_ctr(), NULL, graine, graine+32) != 1)) {
+		fprintf(stderr, "%s Runtime line %d file %s\n", __func__,  __LINE__, __FILE__);
+		abort();
+	}
+}
+#endif
+
+/** \brief Recharge la réserve. Appelé avec le mutex pris */
+static void cw_alea_recharge() {
+	#ifdef MPM_OPENSSL
+	unsigned char graine[48];
+	int l=0;
+
+	if ((cw_alea.drbg == NULL) || (cw_alea.recharges >= CW_ALEA_RESEMENCE)) {
+		cw_alea_source(graine, sizeof(graine));
+		cw_alea_cle(graine);
+		memset(graine, 0, sizeof(graine));
+		cw_alea.recharges = 0;
+	}
+	memset(cw_alea.reserve, 0, CW_ALEA_RESERVE);
+	if ((EVP_EncryptUpdate(cw_alea.drbg, cw_alea.reserve, &l, cw_alea.reserve, CW_ALEA_RESERVE) != 1) || (l != CW_ALEA_RESERVE)) {
+		fprintf(stderr, "%s Runtime line %d file %s\n", __func__,  __LINE__, __FILE__);
+		abort();
+	}
+	// Effacement rapide de la clé : les 48 premiers octets deviennent la clé suivante, et ne sont pas servis
+	cw_alea_cle(cw_alea.reserve);
+	memset(cw_alea.reserve, 0, 48);
+	cw_alea.dispo = CW_ALEA_RESERVE - 48;
+	#else
+	cw_alea_source(cw_alea.reserve, CW_ALEA_RESERVE);
+	cw_alea.dispo = CW_ALEA_RESERVE;
+	#endif
+	cw_alea.recharges++;
+}
+
 /** \brief Initialisation du générateur aléatoire 
  */
 void random_init() {
@@ -101,13 +208,29 @@ void random_init() {
 		debug_printf(0,"random_init() API BCrypt/Windows ok\n");
 		#endif
 	#endif
+
+	cw_alea_prepare();
+	cw_aes_backend(); // choisi et vérifié ici, dans le thread principal
 	return;
 }
 
 /** \brief Libération des ressources du générateur aléatoire 
+ *  \note 
+ *  - la réserve d'aléa et la clé du DRBG sont effacées
  */
 void random_deinit() {
 
+	if (cw_alea.pret) {
+		memset(cw_alea.reserve, 0, CW_ALEA_RESERVE);
+		#ifdef MPM_OPENSSL
+		EVP_CIPHER_CTX_free(cw_alea.drbg); // efface la clé
+		cw_alea.drbg = NULL;
+		#endif
+		tw_mutex_destroy(&cw_alea.mutex);
+		cw_alea.dispo = 0;
+		cw_alea.pret = 0;
+	}
+
 	#ifdef MPM_WINCRYPTO
 	NTSTATUS status = BCryptCloseAlgorithmProvider(&hAlgorithm, 0 );
 	if(!NT_SUCCESS(status)) {
@@ -123,37 +246,27 @@ void random_deinit() {
  *  \param[in]  n      Le nombre d'octets
  *  \note 
  *  - Fonctionne un peu comme memset()
- *  - Fonction à surcharger comme on peut, avec le meilleur génrateur disponible
+ *  - servi depuis la réserve d'aléa, rechargée au besoin : un appel pour quelques octets ne coûte qu'une copie
  *  - random_init() et random_deinit() sont là pour initialiser le générateur si nécessaire
  */
 void *random_bytes(void *dest, size_t n) {
-	#ifdef MPM_OPENSSL 
-			int rc = RAND_bytes((unsigned char*)dest, (int) n);
-			if(rc != 1) {
-				fprintf(stderr, "runtime error, SSL RAND_bytes()");
-				abort();
-			}
-	
-	#else
-		#ifdef MPM_WINCRYPTO
-			// https://docs.microsoft.com/en-us/windows/desktop/api/bcrypt/nf-bcrypt-bcryptgenrandom
-    		NTSTATUS status= STATUS_UNSUCCESSFUL;
-			status=BCryptGenRandom(hAlgorithm, (PUCHAR)dest, n, 	0 );
-			if(!NT_SUCCESS(status)) {
-				fprintf(stderr, "%s() %s:%d runtime error\n", __func__, __FILE__, __LINE__);
-			}
-		#else
-			size_t i;
-			unsigned char *d;
-			d = (unsigned char*)dest;
-			for (i=0;i<n;i++) {
-				*d = (unsigned char)(rand() & 0xff);
-				d++;
-			}
-			fprintf(stderr,"Warning: use of weak rand() standard function as random source\nThis is not a release-grade build\n");
-		#endif
-	#endif
-	
+	unsigned char *d = (unsigned char*)dest;
+	unsigned char *r;
+	size_t l;
+
+	cw_alea_prepare();
+	tw_mutex_lock(&cw_alea.mutex);
+	while (n > 0) {
+		if (cw_alea.dispo == 0) cw_alea_recharge();
+		l = (n < cw_alea.dispo) ? n : cw_alea.dispo;
+		r = cw_alea.reserve + CW_ALEA_RESERVE - cw_alea.dispo;
+		memcpy(d, r, l);
+		memset(r, 0, l); // un octet servi ne reste pas en mémoire
+		cw_alea.dispo -= l;
+		d += l;
+		n -= l;
+	}
+	tw_mutex_unlock(&cw_alea.mutex);
 	return dest;
 }
 
@@ -163,14 +276,17 @@ void *random_bytes(void *dest, size_t n) {
  *  \note 
  *  - l'appelant fournit le buffer, et prévoit qu'on ajoutera un \0 à la fin
  *  - MdP utilisant a..z A..Z 0..9
+ *  - un octet aléatoire par caractère, rejeté s'il dépasse 247 = 4*62-1 : les 62 caractères sont exactement équiprobables
  */
 char *generate_password(char *dest, int n) {
 	char *d=dest;
-	uint64_t b64;
+	unsigned char octet;
 	int b;
 	for (int i=0; i<n; i++) {
-		random_bytes((unsigned char*) &b64, sizeof(b64));
-		b = b64 % 62;
+		do {
+			random_bytes(&octet, 1);
+		} while (octet >= 4*62);
+		b = octet % 62;
 		
 		if (b<26) {
 			b+= 'a';
@@ -209,127 +325,610 @@ static char *NT_STATUS_str(NTSTATUS n) {
 #endif
 
 
-/** \brief Chiffre/déchiffre une zone mémoire en AES256-CBC 
- *  \param[in,out] buffer   Le buffer contenant les données. Les données sont traitées en place
- *  \param[in]  len      Longueur à traiter. Sera arrondi au multiple de 16 supérieur
- *  \param[in]  key      Clé AES256 (= 32 octets)
- *  \param[in]  iv       Vecteur d'initialisation du CBC
- *  \param[in]  enc      0=déchiffre, 1=chiffre
+/* Chiffrement AES256-CBC
+ *
+ * Une clé utilisée plusieurs fois (common_key, secret_key) est préparée une seule fois par cw_aes_new() : contexte 
+ * du fournisseur et expansion de la clé. Chaque appel à cw_aes_cbc_cle() ne fait plus que repartir de l'IV, et
+ * traite les données en place, sans copie.
+ * Un long flux peut aussi être traité morceau par morceau : cw_aes_cbc_debut() puis cw_aes_cbc_suite() autant de 
+ * fois que nécessaire, le chaînage CBC continuant d'un morceau à l'autre.
+ * La même clé préparée sert aussi en AES256-GCM, voir cw_aes_gcm(), pour les pages de la base common.
+ * Le CBC passe par le moteur natif AES-NI/VAES quand le processeur le permet, voir cw_aes_backend().
+ */
+
+/* Moteur AES256-CBC natif x86
+ *
+ * Avec AES-NI, le CBC est fait directement avec les instructions aesenc/aesdec, sans passer par la bibliothèque.
+ * Le chiffrement CBC est séquentiel par nature, mais le déchiffrement ne l'est pas : chaque bloc ne dépend que du
+ * chiffré précédent. Il est fait par 8 blocs avec AES-NI, et par 16 blocs (4 registres de 4 blocs) avec VAES.
+ * Le moteur est choisi une fois pour toutes, d'après le processeur, et n'est retenu qu'après avoir été comparé à la 
+ * bibliothèque (voir cw_aes_backend()). Comme pour les sha, chaque fonction porte son propre attribut target().
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MPM_AES_X86
+#include <immintrin.h>
+#include <cpuid.h>
+#ifndef bit_VAES
+#define bit_VAES (1 << 9)
+#endif
+#endif
+
+static int cw_aes_choix = -1; ///< moteur retenu par cw_aes_backend(), -1 tant qu'il n'est pas choisi
+
+#ifdef MPM_AES_X86
+#define CW_AESNI __attribute__((target("aes,sse4.1")))
+#define CW_VAES __attribute__((target("vaes,avx512f,aes,sse4.1")))
+
+/** \brief Clé AES256 étendue pour le moteur natif, et flux CBC en cours */
+typedef struct t_cw_aesni {
+	__m128i enc[15];  ///< clés de tour du chiffrement
+	__m128i dec[15];  ///< clés de tour du déchiffrement, dans l'ordre d'utilisation par aesdec
+	__m128i iv;       ///< chaînage du flux en cours
+	int sens;         ///< 0=déchiffre, 1=chiffre
+	int vaes;         ///< déchiffrement par 16 blocs
+} t_cw_aesni;
+
+/** \brief Étape de l'expansion de clé AES256 : k ^ (k<<32) ^ (k<<64) ^ (k<<96) ^ t */
+CW_AESNI static inline __attribute__((always_inline)) __m128i cw_aesni_melange(__m128i k, __m128i t) {
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	return _mm_xor_si128(k, t);
+}
+
+/* Deux clés de tour : la première avec RotWord/SubWord et rcon, la seconde avec SubWord seul (aeskeygenassist veut une constante) */
+#define CW_AESNI_PAIRE(rk, i, rcon) \
+	rk[i]   = cw_aesni_melange(rk[i-2], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[i-1], rcon), 0xff)); \
+	rk[i+1] = cw_aesni_melange(rk[i-1], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[i], 0), 0xaa));
+
+/** \brief Expansion d'une clé AES256 (FIPS-197), pour les deux sens */
+CW_AESNI static void cw_aesni_cle(t_cw_aesni *n, const unsigned char *key) {
+	__m128i *rk = n->enc;
+
+	rk[0] = _mm_loadu_si128((const __m128i*)key);
+	rk[1] = _mm_loadu_si128((const __m128i*)(key+16));
+	CW_AESNI_PAIRE(rk, 2, 0x01)
+	CW_AESNI_PAIRE(rk, 4, 0x02)
+	CW_AESNI_PAIRE(rk, 6, 0x04)
+	CW_AESNI_PAIRE(rk, 8, 0x08)
+	CW_AESNI_PAIRE(rk, 10, 0x10)
+	CW_AESNI_PAIRE(rk, 12, 0x20)
+	rk[14] = cw_aesni_melange(rk[12], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[13], 0x40), 0xff));
+
+	n->dec[0] = rk[14];
+	for (int r=1; r<14; r++) n->dec[r] = _mm_aesimc_si128(rk[14-r]);
+	n->dec[14] = rk[0];
+}
+
+/** \brief Chiffrement CBC, bloc par bloc */
+CW_AESNI static void cw_aesni_cbc_chiffre(t_cw_aesni *n, unsigned char *buffer, size_t len) {
+	__m128i k[15];
+	__m128i c = n->iv;
+
+	// Clés dans des registres : les écritures dans buffer pourraient sinon les modifier, pour le compilateur
+	#pragma GCC unroll 15
+	for (int r=0; r<15; r++) k[r] = n->enc[r];
+	for (size_t o=0; o<len; o+=16) {
+		__m128i b = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128((__m128i*)(buffer+o)), c), k[0]);
+		#pragma GCC unroll 13
+		for (int r=1; r<14; r++) b = _mm_aesenc_si128(b, k[r]);
+		c = _mm_aesenclast_si128(b, k[14]);
+		_mm_storeu_si128((__m128i*)(buffer+o), c);
+	}
+	n->iv = c;
+}
+
+/** \brief Déchiffrement CBC, par 8 blocs indépendants puis bloc par bloc */
+CW_AESNI static void cw_aesni_cbc_dechiffre(t_cw_aesni *n, unsigned char *buffer, size_t len) {
+	__m128i k[15];
+	__m128i prec = n->iv;
+	size_t o = 0;
+
+	#pragma GCC unroll 15
+	for (int r=0; r<15; r++) k[r] = n->dec[r];
+	for (; o + 8*16 <= len; o += 8*16) {
+		__m128i c[8], b[8];
+		#pragma GCC unroll 8
+		for (int j=0; j<8; j++) {
+			c[j] = _mm_loadu_si128((__m128i*)(buffer+o+16*j));
+			b[j] = _mm_xor_si128(c[j], k[0]);
+		}
+		#pragma GCC unroll 13
+		for (int r=1; r<14; r++) {
+			#pragma GCC unroll 8
+			for (int j=0; j<8; j++) b[j] = _mm_aesdec_si128(b[j], k[r]);
+		}
+		#pragma GCC unroll 8
+		for (int j=0; j<8; j++) {
+			b[j] = _mm_xor_si128(_mm_aesdeclast_si128(b[j], k[14]), j ? c[j-1] : prec);
+			_mm_storeu_si128((__m128i*)(buffer+o+16*j), b[j]);
+		}
+		prec = c[7];
+	}
+	for (; o < len; o += 16) {
+		__m128i c = _mm_loadu_si128((__m128i*)(buffer+o));
+		__m128i b = _mm_xor_si128(c, k[0]);
+		#pragma GCC unroll 13
+		for (int r=1; r<14; r++) b = _mm_aesdec_si128(b, k[r]);
+		_mm_storeu_si128((__m128i*)(buffer+o), _mm_xor_si128(_mm_aesdeclast_si128(b, k[14]), prec));
+		prec = c;
+	}
+	n->iv = prec;
+}
+
+/** \brief Déchiffrement CBC par 16 blocs avec VAES, la fin étant laissée à cw_aesni_cbc_dechiffre()
  *  \note 
- *  - Le buffer doit prévoir que la longueur sera éventuellement arrondie au multiple de 16 supérieur. Il doit être assez grand
- *  - invoqué depuis plusieurs endroits
- *  \todo Traiter les erreurs en les remontant à l'appelant
+ *  - le chiffré précédent de chaque bloc s'obtient en décalant d'un bloc la concaténation de deux registres (valignq)
+ */
+CW_VAES static void cw_vaes_cbc_dechiffre(t_cw_aesni *n, unsigned char *buffer, size_t len) {
+	__m512i k[15];
+	__m512i prec = _mm512_broadcast_i32x4(n->iv); // seul le bloc de poids fort sert
+	size_t o = 0;
+
+	#pragma GCC unroll 15
+	for (int r=0; r<15; r++) k[r] = _mm512_broadcast_i32x4(n->dec[r]);
+	for (; o + 16*16 <= len; o += 16*16) {
+		__m512i c[4], b[4];
+		#pragma GCC unroll 4
+		for (int v=0; v<4; v++) {
+			c[v] = _mm512_loadu_si512((void*)(buffer+o+64*v));
+			b[v] = _mm512_xor_si512(c[v], k[0]);
+		}
+		#pragma GCC unroll 13
+		for (int r=1; r<14; r++) {
+			#pragma GCC unroll 4
+			for (int v=0; v<4; v++) b[v] = _mm512_aesdec_epi128(b[v], k[r]);
+		}
+		#pragma GCC unroll 4
+		for (int v=0; v<4; v++) {
+			b[v] = _mm512_xor_si512(_mm512_aesdeclast_epi128(b[v], k[14]), _mm512_alignr_epi64(c[v], v ? c[v-1] : prec, 6));
+			_mm512_storeu_si512((void*)(buffer+o+64*v), b[v]);
+		}
+		prec = c[3];
+	}
+	n->iv = _mm512_extracti32x4_epi32(prec, 3);
+	cw_aesni_cbc_dechiffre(n, buffer+o, len-o);
+}
+
+/** \brief Chiffrement CBC de plusieurs flux indépendants, 8 à la fois
+ *  \note 
+ *  - un flux seul est séquentiel, mais 8 flux différents occupent aesenc comme le déchiffrement par 8 blocs
+ *  - chaque voie reprend le flux suivant dès que le sien est terminé. Une voie sans flux tourne dans le vide
+ */
+CW_AESNI static void cw_aesni_cbc_chiffre_multi(t_cw_aesni *n, int nb, unsigned char **buffers, const size_t *lens, unsigned char **ivs) {
+	__m128i k[15];
+	__m128i c[8];
+	unsigned char *p[8];
+	size_t reste[8];           // blocs restant dans le flux de chaque voie, 0 pour une voie libre
+	unsigned char vide[8][16]; // cible des voies libres
+	int suivant = 0, actives = 0, libre = 1;
+
+	#pragma GCC unroll 15
+	for (int r=0; r<15; r++) k[r] = n->enc[r];
+	for (int j=0; j<8; j++) {
+		c[j] = _mm_setzero_si128();
+		reste[j] = 0;
+	}
+	for (;;) {
+		if (libre) {
+			// (Re)charge les voies libres avec les flux suivants
+			libre = 0;
+			for (int j=0; j<8; j++) {
+				if (reste[j]) continue;
+				while ((suivant < nb) && (lens[suivant] == 0)) suivant++;
+				if (suivant < nb) {
+					p[j] = buffers[suivant];
+					reste[j] = (lens[suivant]+15) >> 4;
+					c[j] = _mm_loadu_si128((const __m128i*)ivs[suivant]);
+					suivant++;
+					actives++;
+				} else {
+					p[j] = vide[j];
+				}
+			}
+			if (actives == 0) break;
+		}
+
+		__m128i b[8];
+		#pragma GCC unroll 8
+		for (int j=0; j<8; j++) b[j] = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128((__m128i*)p[j]), c[j]), k[0]);
+		#pragma GCC unroll 13
+		for (int r=1; r<14; r++) {
+			#pragma GCC unroll 8
+			for (int j=0; j<8; j++) b[j] = _mm_aesenc_si128(b[j], k[r]);
+		}
+		#pragma GCC unroll 8
+		for (int j=0; j<8; j++) {
+			c[j] = _mm_aesenclast_si128(b[j], k[14]);
+			_mm_storeu_si128((__m128i*)p[j], c[j]);
+		}
+
+		for (int j=0; j<8; j++) {
+			if (reste[j] == 0) continue;
+			p[j] += 16;
+			if (--reste[j] == 0) {
+				actives--;
+				libre = 1;
+			}
+		}
+	}
+	memset(vide, 0, sizeof(vide));
+}
+
+/** \brief Prépare une clé pour le moteur natif, NULL si le moteur retenu est la bibliothèque */
+static t_cw_aesni *cw_aesni_new(const unsigned char *key) {
+	t_cw_aesni *n;
+
+	if (cw_aes_backend() == CW_AES_BIBLIOTHEQUE) return NULL;
+	n = (t_cw_aesni*)calloc(1, sizeof(t_cw_aesni)); // malloc() aligne sur 16 octets en 64 bits
+	cw_aesni_cle(n, key);
+	n->vaes = (cw_aes_choix == CW_AES_VAES);
+	return n;
+}
+
+static void cw_aesni_free(t_cw_aesni *n) {
+	if (n == NULL) return;
+	memset(n, 0, sizeof(t_cw_aesni));
+	free(n);
+}
+
+static void cw_aesni_debut(t_cw_aesni *n, const unsigned char *iv, int enc) {
+	n->iv = _mm_loadu_si128((const __m128i*)iv);
+	n->sens = enc;
+}
+
+static void cw_aesni_suite(t_cw_aesni *n, unsigned char *buffer, size_t len) {
+	if (n->sens) cw_aesni_cbc_chiffre(n, buffer, len);
+	else if (n->vaes) cw_vaes_cbc_dechiffre(n, buffer, len);
+	else cw_aesni_cbc_dechiffre(n, buffer, len);
+}
+
+/** \brief Moteur natif que permet le processeur, sans vérification */
+static int cw_aes_natif_disponible() {
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_AES) || !(ecx & bit_SSE4_1)) return CW_AES_BIBLIOTHEQUE;
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ecx & bit_VAES) && __builtin_cpu_supports("avx512f")) return CW_AES_VAES;
+	return CW_AES_AESNI;
+}
+
+/** 
+ *  \brief Vérifie le moteur natif : vecteur de FIPS-197, puis CBC comparé à la bibliothèque dans les deux sens
+ *  \note 
+ *  - assez de blocs pour passer par les boucles de 16 et de 8 blocs, et par le reste bloc par bloc
+ */
+static int cw_aes_natif_verifie(int moteur) {
+	static const unsigned char fips_cle[32] = {
+		0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f,
+		0x10,0x11,0x12,0x13,0x14,0x15,0x16,0x17,0x18,0x19,0x1a,0x1b,0x1c,0x1d,0x1e,0x1f };
+	static const unsigned char fips_clair[16] = {
+		0x00,0x11,0x22,0x33,0x44,0x55,0x66,0x77,0x88,0x99,0xaa,0xbb,0xcc,0xdd,0xee,0xff };
+	static const unsigned char fips_chiffre[16] = {
+		0x8e,0xa2,0xb7,0xca,0x51,0x67,0x45,0xbf,0xea,0xfc,0x49,0x90,0x4b,0x49,0x60,0x89 };
+	unsigned char cle[32], iv[16], zero[16] = {0};
+	unsigned char clair[35*16], natif[35*16], biblio[35*16];
+	t_cw_aesni *n = (t_cw_aesni*)calloc(1, sizeof(t_cw_aesni));
+	t_cw_aes *aes;
+	int ok;
+
+	// Un bloc en CBC avec un IV nul, c'est de l'ECB
+	cw_aesni_cle(n, fips_cle);
+	n->vaes = (moteur == CW_AES_VAES);
+	memcpy(natif, fips_clair, 16);
+	cw_aesni_debut(n, zero, 1);
+	cw_aesni_suite(n, natif, 16);
+	ok = (memcmp(natif, fips_chiffre, 16) == 0);
+	cw_aesni_debut(n, zero, 0);
+	cw_aesni_suite(n, natif, 16);
+	ok = ok && (memcmp(natif, fips_clair, 16) == 0);
+
+	// Comparaison à la bibliothèque
+	random_bytes(cle, 32);
+	random_bytes(iv, 16);
+	random_bytes(clair, sizeof(clair));
+	cw_aesni_cle(n, cle);
+	aes = cw_aes_new(cle); // le moteur n'est pas encore choisi : bibliothèque seule
+	for (int enc=0; enc<2; enc++) {
+		memcpy(natif, clair, sizeof(clair));
+		memcpy(biblio, clair, sizeof(clair));
+		cw_aesni_debut(n, iv, enc);
+		cw_aesni_suite(n, natif, 19*16); // deux morceaux, pour le chaînage
+		cw_aesni_suite(n, natif + 19*16, 16*16);
+		cw_aes_cbc_cle(aes, biblio, sizeof(biblio), iv, enc);
+		ok = ok && (memcmp(natif, biblio, sizeof(clair)) == 0);
+	}
+	cw_aes_free(aes);
+	cw_aesni_free(n);
+	memset(cle, 0, sizeof(cle));
+	return ok;
+}
+#else
+typedef struct t_cw_aesni t_cw_aesni;
+static t_cw_aesni *cw_aesni_new(const unsigned char *key) { return NULL; }
+static void cw_aesni_free(t_cw_aesni *n) { }
+static void cw_aesni_debut(t_cw_aesni *n, const unsigned char *iv, int enc) { }
+static void cw_aesni_suite(t_cw_aesni *n, unsigned char *buffer, size_t len) { }
+static void cw_aesni_cbc_chiffre_multi(t_cw_aesni *n, int nb, unsigned char **buffers, const size_t *lens, unsigned char **ivs) { }
+#endif /* MPM_AES_X86 */
+
+/** \brief Choisit le moteur du CBC, au premier appel
+ *  \return CW_AES_VAES, CW_AES_AESNI ou CW_AES_BIBLIOTHEQUE
+ *  \note 
+ *  - invoqué par random_init(), dans le thread principal, avant toute clé préparée
+ *  - le moteur natif n'est retenu que s'il donne les mêmes résultats que la bibliothèque, sinon on s'en passe
  */
- 
+int cw_aes_backend() {
+	if (cw_aes_choix < 0) {
+		int moteur = CW_AES_BIBLIOTHEQUE;
+		cw_aes_choix = CW_AES_BIBLIOTHEQUE; // pour les clés préparées par la vérification
+		#ifdef MPM_AES_X86
+		moteur = cw_aes_natif_disponible();
+		if ((moteur != CW_AES_BIBLIOTHEQUE) && !cw_aes_natif_verifie(moteur)) {
+			fprintf(stderr, "Warning: native AES engine %d disagrees with the crypto library, not used\n", moteur);
+			moteur = CW_AES_BIBLIOTHEQUE;
+		}
+		#endif
+		cw_aes_choix = moteur;
+		#ifdef DEBUG
+		debug_printf(0, (char*)"%s() moteur AES %d\n", __func__, moteur);
+		#endif
+	}
+	return cw_aes_choix;
+}
+
 #ifdef MPM_OPENSSL 
-void cw_aes_cbc(unsigned char *buffer, size_t len, unsigned char *key, unsigned char *iv, int enc) {
-	EVP_CIPHER_CTX *chiffreur;
-	
-	len = (len+15)&(0xfffffffffffffff0); // aligne la longueur sur 16 octets
-	
-	unsigned char* dest = (unsigned char*) alloca(len+32);
-	if (!(chiffreur = EVP_CIPHER_CTX_new())) {
+/** \brief Clé AES256 préparée, un contexte par sens */
+struct t_cw_aes {
+	EVP_CIPHER_CTX *dechiffreur; ///< enc=0
+	EVP_CIPHER_CTX *chiffreur;   ///< enc=1
+	EVP_CIPHER_CTX *courant;     ///< celui du flux en cours, fixé par cw_aes_cbc_debut()
+	EVP_CIPHER_CTX *gcm;         ///< GCM, dans les deux sens : seul le chiffrement du compteur utilise la clé étendue
+	t_cw_aesni *natif;           ///< moteur natif pour le CBC, NULL s'il n'est pas retenu
+};
+
+/** \brief Prépare une clé AES256 pour cw_aes_cbc_cle()
+ *  \param[in]  key      Clé AES256 (= 32 octets). N'est pas conservée, seule sa forme étendue l'est
+ *  \return la clé préparée, à libérer par cw_aes_free()
+ */
+t_cw_aes *cw_aes_new(const unsigned char *key) {
+	t_cw_aes *aes = (t_cw_aes*)calloc(1, sizeof(t_cw_aes));
+
+	if (!(aes->dechiffreur = EVP_CIPHER_CTX_new()) || !(aes->chiffreur = EVP_CIPHER_CTX_new()) || !(aes->gcm = EVP_CIPHER_CTX_new())) {
 		fprintf(stderr, "%s Runtime line %d file %s\n", __func__,  __LINE__, __FILE__);
 		abort();
 	}
-	
-	
 	/* int EVP_CipherInit_ex(EVP_CIPHER_CTX *ctx, const EVP_CIPHER *type, ENGINE *impl, const unsigned char *key, const unsigned char *iv, int enc); */
-	if (EVP_CipherInit_ex(chiffreur, EVP_aes_256_cbc(), NULL, key, iv, enc) !=1) {
+	if ((EVP_CipherInit_ex(aes->dechiffreur, EVP_aes_256_cbc(), NULL, key, NULL, 0) !=1)
+	 || (EVP_CipherInit_ex(aes->chiffreur, EVP_aes_256_cbc(), NULL, key, NULL, 1) !=1)
+	 || (EVP_CipherInit_ex(aes->gcm, EVP_aes_256_gcm(), NULL, key, NULL, 1) !=1)) {
 		fprintf(stderr, "%s Runtime line %d file %s\n", __func__,  __LINE__, __FILE__);
 		abort(); 
 	}
-	EVP_CIPHER_CTX_set_padding(chiffreur,0);	
-	
-	/* int EVP_CipherUpdate(EVP_CIPHER_CTX *ctx, unsigned char *out, int *outl, const unsigned char *in, int inl); */
-	size_t len_out=0;
-	size_t l=0; // Important. Car comme on caste le pointeur, qu'openssl attend en *int, pas forcément de même largeur...
-	if (EVP_CipherUpdate(chiffreur, dest, (int*)&l, buffer, (int)len) !=1) {
+	EVP_CIPHER_CTX_set_padding(aes->dechiffreur,0);	
+	EVP_CIPHER_CTX_set_padding(aes->chiffreur,0);	
+	aes->natif = cw_aesni_new(key);
+	return aes;
+}
+
+/** \brief Efface et libère une clé préparée par cw_aes_new(). Sans effet sur NULL */
+void cw_aes_free(t_cw_aes *aes) {
+	if (aes == NULL) return;
+	EVP_CIPHER_CTX_free(aes->dechiffreur); // efface la clé étendue
+	EVP_CIPHER_CTX_free(aes->chiffreur);
+	EVP_CIPHER_CTX_free(aes->gcm);
+	cw_aesni_free(aes->natif);
+	free(aes);
+}
+
+/** \brief Commence un flux AES256-CBC avec une clé préparée par cw_aes_new()
+ *  \param[in]  iv       Vecteur d'initialisation du CBC
+ *  \param[in]  enc      0=déchiffre, 1=chiffre
+ *  \note 
+ *  - une clé préparée ne doit pas servir à deux threads en même temps, ni à deux flux à la fois
+ */
+void cw_aes_cbc_debut(t_cw_aes *aes, const unsigned char *iv, int enc) {
+	if (aes->natif) {
+		cw_aesni_debut(aes->natif, iv, enc);
+		return;
+	}
+	aes->courant = enc ? aes->chiffreur : aes->dechiffreur;
+
+	// Repart de l'IV, la clé étendue est conservée
+	if (EVP_CipherInit_ex(aes->courant, NULL, NULL, NULL, iv, enc) !=1) {
 		fprintf(stderr, "%s Runtime line %d file %s\n", __func__,  __LINE__, __FILE__);
 		abort(); 
 	}
-	len_out+=l;
+}
+
+/** \brief Chiffre/déchiffre en place le morceau suivant d'un flux commencé par cw_aes_cbc_debut()
+ *  \param[in,out] buffer   Le morceau, traité en place
+ *  \param[in]  len      Longueur du morceau, multiple de 16
+ */
+void cw_aes_cbc_suite(t_cw_aes *aes, unsigned char *buffer, size_t len) {
+	int l=0;
+
+	if (((len & 0xf) != 0) || (len > 0x7ffffff0)) {
+		fprintf(stderr, "%s() Runtime line %d - len=%lu\n", __func__,  __LINE__, (unsigned long)len);
+		abort();	
+	}
+	if (aes->natif) {
+		cw_aesni_suite(aes->natif, buffer, len);
+		return;
+	}
 	
-	if (EVP_CipherFinal_ex(chiffreur, buffer + len_out, (int*)&l ) != 1) {
+	// En place : OpenSSL accepte un buffer de sortie égal au buffer d'entrée. Sans padding, rien n'est retenu d'un morceau à l'autre
+	/* int EVP_CipherUpdate(EVP_CIPHER_CTX *ctx, unsigned char *out, int *outl, const unsigned char *in, int inl); */
+	if (EVP_CipherUpdate(aes->courant, buffer, &l, buffer, (int)len) !=1) {
 		fprintf(stderr, "%s Runtime line %d file %s\n", __func__,  __LINE__, __FILE__);
 		abort(); 
 	}
-	len_out+=l;	
-	
-	if (len_out != len) {
-		fprintf(stderr, "%s() Runtime line %d - len_out=%ld len=%ld\n", __func__,  __LINE__, len_out, len);
+	if ((size_t)l != len) {
+		fprintf(stderr, "%s() Runtime line %d - len_out=%d len=%ld\n", __func__,  __LINE__, l, len);
+		abort();	
+	}
+}
+
+/** \brief Chiffre/déchiffre en place un message en AES256-GCM, avec une clé préparée par cw_aes_new()
+ *  \param[in,out] buffer   Le message, traité en place. Pas de contrainte de longueur
+ *  \param[in]  nonce    Nonce de 12 octets, à ne jamais réutiliser avec la même clé
+ *  \param[in]  aad      Données authentifiées avec le message mais non chiffrées
+ *  \param[in,out] tag   Tag de 16 octets : produit si enc=1, vérifié si enc=0
+ *  \param[in]  enc      0=déchiffre, 1=chiffre
+ *  \return 1 si le tag est bon (toujours en chiffrement), 0 sinon. Le clair n'est alors pas à utiliser
+ */
+int cw_aes_gcm(t_cw_aes *aes, unsigned char *buffer, size_t len, const unsigned char *nonce, const unsigned char *aad, size_t aad_len, unsigned char *tag, int enc) {
+	int l=0;
+
+	if (len > 0x7ffffff0) {
+		fprintf(stderr, "%s() Runtime line %d - len=%lu\n", __func__,  __LINE__, (unsigned long)len);
 		abort();	
 	}
-	memcpy(buffer, dest, len);
+
+	// Repart du nonce (12 octets, longueur par défaut du GCM), la clé étendue est conservée
+	if ((EVP_CipherInit_ex(aes->gcm, NULL, NULL, NULL, nonce, enc) !=1)
+	 || (EVP_CipherUpdate(aes->gcm, NULL, &l, aad, (int)aad_len) !=1)
+	 || (EVP_CipherUpdate(aes->gcm, buffer, &l, buffer, (int)len) !=1)) {
+		fprintf(stderr, "%s Runtime line %d file %s\n", __func__,  __LINE__, __FILE__);
+		abort(); 
+	}
+	if (enc) {
+		if ((EVP_CipherFinal_ex(aes->gcm, buffer + l, &l) !=1) || (EVP_CIPHER_CTX_ctrl(aes->gcm, EVP_CTRL_GCM_GET_TAG, 16, tag) !=1)) {
+			fprintf(stderr, "%s Runtime line %d file %s\n", __func__,  __LINE__, __FILE__);
+			abort(); 
+		}
+		return 1;
+	}
+	if (EVP_CIPHER_CTX_ctrl(aes->gcm, EVP_CTRL_GCM_SET_TAG, 16, tag) !=1) {
+		fprintf(stderr, "%s Runtime line %d file %s\n", __func__,  __LINE__, __FILE__);
+		abort(); 
+	}
+	return (EVP_CipherFinal_ex(aes->gcm, buffer + l, &l) == 1); // échoue si le tag ne correspond pas
 }
 #endif /* MPM_OPENSSL */
 
 #ifdef MPM_WINCRYPTO
 // Exemple trouvé ici : https://docs.microsoft.com/en-us/windows/desktop/seccng/encrypting-data-with-cng
-void cw_aes_cbc(unsigned char *buffer, size_t len, unsigned char *key, unsigned char *iv, int enc) {
-	
-    BCRYPT_ALG_HANDLE       hAesAlg                     = NULL;
-    BCRYPT_KEY_HANDLE       hKey                        = NULL;
-	PBYTE                   pbKeyObject                 = NULL;
-	DWORD					cbKeyObject                 = 0,
-							cbData                      = 0; /* pour contenir des lg en résultat, pas vraiment utilisé */
-    NTSTATUS                status                      = STATUS_UNSUCCESSFUL;
+/** \brief Clé AES256 préparée */
+struct t_cw_aes {
+	BCRYPT_ALG_HANDLE hAesAlg;
+	BCRYPT_KEY_HANDLE hKey;
+	PBYTE pbKeyObject;
+	DWORD cbKeyObject;
+	BCRYPT_ALG_HANDLE hAesAlgGcm; ///< idem en mode GCM, le mode de chaînage étant fixé sur le fournisseur
+	BCRYPT_KEY_HANDLE hKeyGcm;
+	PBYTE pbKeyObjectGcm;
+	DWORD cbKeyObjectGcm;
+	UCHAR iv_courant[32]; ///< IV du flux en cours, mis à jour par BCryptEncrypt()/BCryptDecrypt() pour le chaînage
+	int enc;              ///< sens du flux en cours
+	t_cw_aesni *natif;    ///< moteur natif pour le CBC, NULL s'il n'est pas retenu
+};
+
+/** \brief Ouvre un fournisseur AES dans un mode de chaînage donné, et y prépare la clé */
+static void cw_aes_bcrypt_cle(BCRYPT_ALG_HANDLE *hAlg, BCRYPT_KEY_HANDLE *hKey, PBYTE *pbKeyObject, DWORD *cbKeyObject, LPCWSTR mode, ULONG taille_mode, const unsigned char *key) {
+	DWORD cbData = 0; /* pour contenir des lg en résultat, pas vraiment utilisé */
+    NTSTATUS status = STATUS_UNSUCCESSFUL;
 	
 	// Open an algorithm handle.
-	if(!NT_SUCCESS(status = BCryptOpenAlgorithmProvider(&hAesAlg, BCRYPT_AES_ALGORITHM, NULL, 0))) {
+	if(!NT_SUCCESS(status = BCryptOpenAlgorithmProvider(hAlg, BCRYPT_AES_ALGORITHM, NULL, 0))) {
 		fprintf(stderr, "%s() Runtime line %s:%d\n", __func__,  __FILE__, __LINE__);
 		abort();			
 	}
 
 	// Calculate the size of the buffer to hold the KeyObject.
-    if(!NT_SUCCESS(status = BCryptGetProperty(hAesAlg, BCRYPT_OBJECT_LENGTH, (PBYTE)&cbKeyObject, sizeof(DWORD), &cbData, 0))) {
+    if(!NT_SUCCESS(status = BCryptGetProperty(*hAlg, BCRYPT_OBJECT_LENGTH, (PBYTE)cbKeyObject, sizeof(DWORD), &cbData, 0))) {
 		fprintf(stderr, "%s() Runtime line %s:%d\n", __func__,  __FILE__, __LINE__);
 		abort();			
 	}
 
     // Allocate the key object on the heap.
-    pbKeyObject = (PBYTE)HeapAlloc (GetProcessHeap (), 0, cbKeyObject);
-    if(NULL == pbKeyObject) {
+    *pbKeyObject = (PBYTE)HeapAlloc (GetProcessHeap (), 0, *cbKeyObject);
+    if(NULL == *pbKeyObject) {
 		fprintf(stderr, "%s() Runtime line %s:%d\n", __func__,  __FILE__, __LINE__);
 		abort();		
     }
 
-	// Fixe le mode CBC
-    if(!NT_SUCCESS(status = BCryptSetProperty(hAesAlg, BCRYPT_CHAINING_MODE, 
-                                (PBYTE)BCRYPT_CHAIN_MODE_CBC, sizeof(BCRYPT_CHAIN_MODE_CBC), 0))) {
+	// Fixe le mode de chaînage
+    if(!NT_SUCCESS(status = BCryptSetProperty(*hAlg, BCRYPT_CHAINING_MODE, (PBYTE)mode, taille_mode, 0))) {
 		fprintf(stderr, "%s() Runtime line %s:%d\n", __func__,  __FILE__, __LINE__);
 		abort();										
 	}
 
-	// Le buffer contenant l'IV sera modifié, donc on le recopie avant de l'utiliser
-	// (curieuse coutume de l'API Wincrypt, onne sait pas ce qu'il met dedans)
-	PUCHAR iv_temp = (PUCHAR)alloca(32);
-	memcpy(iv_temp, iv, 32);
-
 	// Generate the key from supplied input key bytes.
-    if(!NT_SUCCESS(status = BCryptGenerateSymmetricKey(hAesAlg, &hKey, pbKeyObject, cbKeyObject, 
-                                        (PBYTE)key, 32, 0))) {
+    if(!NT_SUCCESS(status = BCryptGenerateSymmetricKey(*hAlg, hKey, *pbKeyObject, *cbKeyObject, (PBYTE)key, 32, 0))) {
 		fprintf(stderr, "%s() Runtime line %s:%d\n", __func__,  __FILE__, __LINE__);
 		abort();									
 	}
-	
+}
+
+t_cw_aes *cw_aes_new(const unsigned char *key) {
+	t_cw_aes *aes = (t_cw_aes*)calloc(1, sizeof(t_cw_aes));
+
+	cw_aes_bcrypt_cle(&aes->hAesAlg, &aes->hKey, &aes->pbKeyObject, &aes->cbKeyObject, BCRYPT_CHAIN_MODE_CBC, sizeof(BCRYPT_CHAIN_MODE_CBC), key);
+	cw_aes_bcrypt_cle(&aes->hAesAlgGcm, &aes->hKeyGcm, &aes->pbKeyObjectGcm, &aes->cbKeyObjectGcm, BCRYPT_CHAIN_MODE_GCM, sizeof(BCRYPT_CHAIN_MODE_GCM), key);
+	aes->natif = cw_aesni_new(key);
+	return aes;
+}
+
+void cw_aes_free(t_cw_aes *aes) {
+	if (aes == NULL) return;
+	if (aes->hKey) BCryptDestroyKey(aes->hKey);
+	if (aes->hAesAlg) BCryptCloseAlgorithmProvider(aes->hAesAlg,0);
+	if (aes->pbKeyObject) {
+		SecureZeroMemory(aes->pbKeyObject, aes->cbKeyObject);
+		HeapFree(GetProcessHeap(), 0, aes->pbKeyObject);
+	}
+	if (aes->hKeyGcm) BCryptDestroyKey(aes->hKeyGcm);
+	if (aes->hAesAlgGcm) BCryptCloseAlgorithmProvider(aes->hAesAlgGcm,0);
+	if (aes->pbKeyObjectGcm) {
+		SecureZeroMemory(aes->pbKeyObjectGcm, aes->cbKeyObjectGcm);
+		HeapFree(GetProcessHeap(), 0, aes->pbKeyObjectGcm);
+	}
+	SecureZeroMemory(aes->iv_courant, sizeof(aes->iv_courant));
+	cw_aesni_free(aes->natif);
+	free(aes);
+}
+
+void cw_aes_cbc_debut(t_cw_aes *aes, const unsigned char *iv, int enc) {
+	if (aes->natif) {
+		cw_aesni_debut(aes->natif, iv, enc);
+		return;
+	}
+	// Le buffer contenant l'IV sera modifié, donc on le recopie avant de l'utiliser
+	// (curieuse coutume de l'API Wincrypt : il y laisse de quoi enchaîner le morceau suivant)
+	memcpy(aes->iv_courant, iv, 32);
+	aes->enc = enc;
+}
+
+void cw_aes_cbc_suite(t_cw_aes *aes, unsigned char *buffer, size_t len) {
+	DWORD cbData = 0;
+    NTSTATUS status = STATUS_UNSUCCESSFUL;
+
+	if ((len & 0xf) != 0) {
+		fprintf(stderr, "%s() Runtime line %s:%d longueur non multiple de 16\n", __func__,  __FILE__, __LINE__);
+		abort();		
+	}
+	if (aes->natif) {
+		cw_aesni_suite(aes->natif, buffer, len);
+		return;
+	}
+
 	// Chiffre proprement dit
 	// Note sur l'API Windows : on peut avoir le buffer d'entrée et de sortie égaux
 	// Si on ne donne pas de buffer de sortie, ça ne chiffre pas, mais ça calcule la taille nécessaire 
 	// du buffer de sortie
-	if (enc) {
-		status = BCryptEncrypt(hKey, 
+	if (aes->enc) {
+		status = BCryptEncrypt(aes->hKey, 
             buffer, len,  /* buffer d'entrée */
             NULL,         /* padding info */
-            iv_temp, 32,  /* IV et len IV */
+            aes->iv_courant, 32,  /* IV et len IV */
             buffer, len,  /* buffer de sortie */
             &cbData,      /* Contiendra le nb d'octets effectivement produits */ 
             0 /* flag. On demande pas de padding notamment */ );
 	} else {
-		status = BCryptDecrypt(hKey, 
+		status = BCryptDecrypt(aes->hKey, 
             buffer, len,  /* buffer d'entrée */
             NULL,         /* padding info */
-            iv_temp, 32,  /* IV et len IV */
+            aes->iv_courant, 32,  /* IV et len IV */
             buffer, len,  /* buffer de sortie */
             &cbData,      /* Contiendra le nb d'octets effectivement produits */ 
             0 /* flag. On demande pas de padding notamment */ );		
@@ -344,28 +943,90 @@ void cw_aes_cbc(unsigned char *buffer, size_t len, unsigned char *key, unsigned
 		fprintf(stderr, "%s() Runtime line %s:%d N'a pas chiffré le bon nombre d'octets\n", __func__,  __FILE__, __LINE__);
 		abort();		
 	}
+}
 
+int cw_aes_gcm(t_cw_aes *aes, unsigned char *buffer, size_t len, const unsigned char *nonce, const unsigned char *aad, size_t aad_len, unsigned char *tag, int enc) {
+	BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO info;
+	DWORD cbData = 0;
+    NTSTATUS status = STATUS_UNSUCCESSFUL;
 
-cleanup: /* Libération des ressources */
- 	if(hAesAlg)
-    {
-        BCryptCloseAlgorithmProvider(hAesAlg,0);
-    }
-
-    if (hKey)    
-    {
-        BCryptDestroyKey(hKey);
-    }
-
-    if(pbKeyObject)
-    {
-        HeapFree(GetProcessHeap(), 0, pbKeyObject);
-    }
+	BCRYPT_INIT_AUTH_MODE_INFO(info);
+	info.pbNonce = (PUCHAR)nonce;
+	info.cbNonce = 12;
+	info.pbAuthData = (PUCHAR)aad;
+	info.cbAuthData = (ULONG)aad_len;
+	info.pbTag = tag;
+	info.cbTag = 16;
+	if (enc) {
+		status = BCryptEncrypt(aes->hKeyGcm, buffer, len, &info, NULL, 0, buffer, len, &cbData, 0);
+	} else {
+		status = BCryptDecrypt(aes->hKeyGcm, buffer, len, &info, NULL, 0, buffer, len, &cbData, 0);
+		if (status == STATUS_AUTH_TAG_MISMATCH) return 0;
+	}
+    if(!NT_SUCCESS(status) || (cbData != len)) {
+		fprintf(stderr, "%s() Runtime line %s:%d\n", __func__,  __FILE__, __LINE__);
+		abort();													
+	}
+	return 1;
 }
 #endif /* MPM_WINCRYPTO */
 
 
-/** \brief Calcul d'un sha pour certaines opération avec les MdP, nickname et sels
+/** \brief Chiffre/déchiffre une zone mémoire en AES256-CBC, avec une clé préparée par cw_aes_new()
+ *  \param[in,out] buffer   Le buffer contenant les données. Les données sont traitées en place
+ *  \param[in]  len      Longueur à traiter. Sera arrondi au multiple de 16 supérieur
+ *  \param[in]  iv       Vecteur d'initialisation du CBC
+ *  \param[in]  enc      0=déchiffre, 1=chiffre
+ *  \note 
+ *  - Le buffer doit prévoir que la longueur sera éventuellement arrondie au multiple de 16 supérieur. Il doit être assez grand
+ */
+void cw_aes_cbc_cle(t_cw_aes *aes, unsigned char *buffer, size_t len, const unsigned char *iv, int enc) {
+	len = (len+15)&(0xfffffffffffffff0); // aligne la longueur sur 16 octets
+	cw_aes_cbc_debut(aes, iv, enc);
+	cw_aes_cbc_suite(aes, buffer, len);
+}
+
+
+/** \brief Chiffre/déchiffre en place plusieurs zones indépendantes en AES256-CBC, avec la même clé préparée
+ *  \param[in]  n        Nombre de zones
+ *  \param[in,out] buffers  Les zones, traitées en place
+ *  \param[in]  lens     Longueur de chaque zone, arrondie au multiple de 16 supérieur comme pour cw_aes_cbc_cle(). 0 pour ignorer la zone
+ *  \param[in]  ivs      Vecteur d'initialisation de chaque zone
+ *  \param[in]  enc      0=déchiffre, 1=chiffre
+ *  \note 
+ *  - même résultat que n appels à cw_aes_cbc_cle()
+ *  - avec le moteur natif, le chiffrement entrelace 8 zones à la fois. Le déchiffrement de chaque zone est déjà parallèle
+ *  - sert aux champs secrets déchiffrés par lot, qui le sont dans le sens 'chiffre' (voir t_secret_item::decrypt_secrets() )
+ */
+void cw_aes_cbc_multi(t_cw_aes *aes, int n, unsigned char **buffers, const size_t *lens, unsigned char **ivs, int enc) {
+	if (aes->natif && enc) {
+		cw_aesni_cbc_chiffre_multi(aes->natif, n, buffers, lens, ivs);
+		return;
+	}
+	for (int i=0; i<n; i++) {
+		if (lens[i]) cw_aes_cbc_cle(aes, buffers[i], lens[i], ivs[i], enc);
+	}
+}
+
+
+/** \brief Chiffre/déchiffre une zone mémoire en AES256-CBC, pour une clé qui ne sert qu'une fois
+ *  \param[in,out] buffer   Le buffer contenant les données. Les données sont traitées en place
+ *  \param[in]  len      Longueur à traiter. Sera arrondi au multiple de 16 supérieur
+ *  \param[in]  key      Clé AES256 (= 32 octets)
+ *  \param[in]  iv       Vecteur d'initialisation du CBC
+ *  \param[in]  enc      0=déchiffre, 1=chiffre
+ *  \note 
+ *  - Le buffer doit prévoir que la longueur sera éventuellement arrondie au multiple de 16 supérieur. Il doit être assez grand
+ *  - invoqué pour les chunks holders, chacun avec sa pkey. Pour common_key et secret_key, voir cw_aes_cbc_cle()
+ */
+void cw_aes_cbc(unsigned char *buffer, size_t len, unsigned char *key, unsigned char *iv, int enc) {
+	t_cw_aes *aes = cw_aes_new(key);
+	cw_aes_cbc_cle(aes, buffer, len, iv, enc);
+	cw_aes_free(aes);
+}
+
+
+/** \brief Calcul d'un sha pour certaines opération avec les MdP, nickname et sels
  *  \param[in]  chaine1   Une chaine de caractères de longueur variable terminé par un \0
  *  \param[in]  salt      Un sel de 32 octets
  *  \param[in]  chaine2   Une chaine de caractères de longueur variable terminé par un \0
@@ -421,20 +1082,368 @@ void cw_sha256_mix1(unsigned char *result, char *chaine1, unsigned char *salt, c
 #endif /* MPM_WINCRYPTO */
 
 
+/* Mémoire de travail des sha itérés
+ *
+ * Chaque calcul écrit 32 octets par itération (plus pour les moteurs multi-lanes). Plutôt qu'un malloc()/free() à 
+ * chaque calcul, avec les défauts de page et la remise à zéro qui vont avec, un t_cw_kdf_ctx garde une arena d'un
+ * calcul à l'autre : deux dérivations de suite dans t_holder::set_password(), ou tous les lots d'un thread de 
+ * recherche des chunks. Les hachés intermédiaires ne sont effacés qu'une fois, par cw_kdf_ctx_free().
+ */
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/** \brief Crée un contexte de KDF, sans arena : elle est allouée au premier calcul, à la taille nécessaire
+ */
+t_cw_kdf_ctx *cw_kdf_ctx_new() {
+	t_cw_kdf_ctx *ctx = (t_cw_kdf_ctx*)calloc(1, sizeof(t_cw_kdf_ctx));
+	return ctx;
+}
+
+/** \brief Efface et libère l'arena d'un contexte */
+static void cw_kdf_ctx_libere_arena(t_cw_kdf_ctx *ctx) {
+	if (ctx->arena == NULL) return;
+	memset(ctx->arena, 0, ctx->taille);
+	#ifdef _WIN32
+	if (ctx->verrouillee) VirtualUnlock(ctx->arena, ctx->taille);
+	VirtualFree(ctx->arena, 0, MEM_RELEASE);
+	#else
+	if (ctx->verrouillee) munlock(ctx->arena, ctx->taille);
+	munmap(ctx->arena, ctx->taille);
+	#endif
+	ctx->arena = NULL;
+	ctx->taille = 0;
+	ctx->verrouillee = 0;
+}
+
+/** \brief Efface l'arena et libère le contexte
+ */
+void cw_kdf_ctx_free(t_cw_kdf_ctx *ctx) {
+	if (ctx == NULL) return;
+	cw_kdf_ctx_libere_arena(ctx);
+	free(ctx);
+}
+
+/** \brief Renvoie une arena d'au moins taille octets, alignée sur une page
+ *  \return NULL si la mémoire manque : l'appelant se replie sur un calcul plus petit, ou échoue sans arrêter le programme
+ *  \note 
+ *  - l'arena est agrandie si besoin, l'ancienne étant effacée. Elle n'est pas remise à zéro d'un calcul à l'autre
+ *  - le verrouillage en mémoire peut échouer (limite RLIMIT_MEMLOCK, par exemple) : le calcul se fait quand même
+ */
+unsigned char *cw_kdf_ctx_arena(t_cw_kdf_ctx *ctx, size_t taille) {
+	if (ctx->taille >= taille) return ctx->arena;
+	cw_kdf_ctx_libere_arena(ctx);
+
+	#ifdef _WIN32
+	ctx->arena = (unsigned char*)VirtualAlloc(NULL, taille, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (ctx->arena == NULL) {
+		#ifdef DEBUG
+		debug_printf(0, (char*)"%s() allocation de %lu octets impossible\n", __func__, (unsigned long)taille);
+		#endif
+		return NULL;
+	}
+	ctx->verrouillee = VirtualLock(ctx->arena, taille) ? 1 : 0;
+	#else
+	void *p = mmap(NULL, taille, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		#ifdef DEBUG
+		debug_printf(0, (char*)"%s() allocation de %lu octets impossible\n", __func__, (unsigned long)taille);
+		#endif
+		return NULL;
+	}
+	ctx->arena = (unsigned char*)p;
+	#ifdef MADV_DONTDUMP
+	madvise(p, taille, MADV_DONTDUMP);
+	#endif
+	ctx->verrouillee = (mlock(p, taille) == 0) ? 1 : 0;
+	#endif
+	ctx->taille = taille;
+
+	#ifdef DEBUG
+	debug_printf(0, (char*)"%s() arena de %lu octets, verrouillée=%d\n", __func__, (unsigned long)taille, ctx->verrouillee);
+	#endif
+	return ctx->arena;
+}
+
+
+/** \brief Décalage entre deux hachés intermédiaires lus pour le sha final des sha itérés
+ *  \param[in]  iterations   Le nombre d'itérations, une puissance de 2 (voir MPM_KDF_ITERATIONS() )
+ *  \return MPM_SHA_OFFSET_ITERATIONS pour le nombre d'itérations par défaut, sinon la même proportion arrondie à l'impair :
+ *          premier avec iterations, le parcours passe une fois par chaque haché
+ */
+static int cw_offset_iterations(int iterations) {
+	return (int)(((int64_t)MPM_SHA_OFFSET_ITERATIONS * iterations / MPM_SHA_ITERATIONS) | 1);
+}
+
+
+/* Moteurs SHA-256 natifs x86
+ *
+ * Les messages chaine1 | r | chaine2 des sha itérés ont tous la même longueur : seul r change d'une itération à
+ * l'autre. On prépare donc une fois pour toutes le message complété (le "gabarit"), et on enchaîne directement
+ * les fonctions de compression, sans passer par SHA256_Init/Update/Final.
+ * 
+ * Utilise les intrinsèques de GCC, donc réservé à GCC/clang sur x86. Chaque fonction porte son propre attribut
+ * target(), le reste du programme est compilé sans option particulière.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MPM_SHA256_X86
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+#ifdef MPM_SHA256_X86
+
+static const uint32_t cw_sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t cw_sha256_h0[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#define CW_GABARIT_BLOCS 4 /* blocs du gabarit tenant dans t_cw_gabarit, soit nickname et MdP jusqu'à 183 octets au total */
+
+/** \brief Message chaine1 | r | chaine2 complété selon SHA-256, en mots big endian, avec r=0 */
+typedef struct t_cw_gabarit {
+	int nb_blocs;   ///< nombre de blocs de 64 octets
+	int decalage;   ///< position de r dans le mot qui le contient
+	int mot_r;      ///< premier mot contenant r
+	uint32_t *mots; ///< nb_blocs*16 mots, dans mots_locaux si possible, sinon malloc()és
+	uint32_t mots_locaux[16*CW_GABARIT_BLOCS];
+} t_cw_gabarit;
+
+static void cw_gabarit_init(t_cw_gabarit *g, char *chaine1, char *chaine2) {
+	int l1 = strlen(chaine1);
+	int len = l1 + 32 + strlen(chaine2);
+
+	g->nb_blocs = (len+9+63)/64;
+	g->decalage = l1 & 3;
+	g->mot_r = l1 >> 2;
+	g->mots = (g->nb_blocs <= CW_GABARIT_BLOCS) ? g->mots_locaux : (uint32_t*)malloc(g->nb_blocs*64);
+
+	// Octet k du message complété, sans copie intermédiaire
+	for (int i=0; i<g->nb_blocs*16; i++) {
+		uint32_t m = 0;
+		for (int k=4*i; k<4*i+4; k++) {
+			unsigned char o = 0;
+			if (k < l1) o = (unsigned char)chaine1[k];
+			else if ((k >= l1+32) && (k < len)) o = (unsigned char)chaine2[k-l1-32];
+			else if (k == len) o = 0x80;
+			else if (k >= g->nb_blocs*64-8) o = (unsigned char)(((uint64_t)len*8) >> (8*(g->nb_blocs*64-1-k)));
+			m = (m << 8) | o;
+		}
+		g->mots[i] = m;
+	}
+}
+
+static void cw_gabarit_free(t_cw_gabarit *g) {
+	memset(g->mots, 0, g->nb_blocs*64);
+	if (g->mots != g->mots_locaux) free(g->mots);
+}
+
+/** \brief Calcule le mot m du message, r étant donné par les 8 mots d'état d[] du sha précédent
+ *  \note
+ *  - V est uint32_t pour le moteur mono-buffer, ou un type vecteur pour le moteur multi-lanes
+ *  - les mots qui chevauchent r sont recomposés par décalage, car chaine1 n'a pas forcément une longueur multiple de 4
+ */
+template<typename V> static inline __attribute__((always_inline)) void cw_gabarit_mot(V *w, const t_cw_gabarit *g, int m, const V *d) {
+	V zero = {};
+	int k = m - g->mot_r;
+	int decalage = g->decalage;
+
+	if ((k<0) || (k>8) || ((k==8) && (decalage==0))) {
+		*w = zero + g->mots[m];
+	} else if (decalage == 0) {
+		*w = d[k];
+	} else if (k == 0) {
+		*w = (d[0] >> (8*decalage)) | g->mots[m];
+	} else if (k == 8) {
+		*w = (d[7] << (32-8*decalage)) | g->mots[m];
+	} else {
+		*w = (d[k-1] << (32-8*decalage)) | (d[k] >> (8*decalage));
+	}
+}
+
+
+/* Moteur mono-buffer avec les extensions SHA d'Intel/AMD (SHA-NI)
+ *
+ * L'état est conservé dans deux registres au format ABEF/CDGH attendu par sha256rnds2, et n'est remis au format
+ * a..h qu'à la fin de chaque sha, pour fabriquer le r de l'itération suivante.
+ */
+#define CW_SHANI __attribute__((target("sha,sse4.1")))
+
+/** \brief Fonction de compression SHA-256 avec les instructions sha256rnds2/sha256msg1/sha256msg2
+ *  \param[in,out] abef,cdgh  L'état
+ *  \param[in]     w0,w8      Les mots 0 à 7 et 8 à 15 du bloc, big endian déjà convertis
+ */
+CW_SHANI static inline __attribute__((always_inline)) void cw_sha256_compress_shani(__m128i *abef, __m128i *cdgh, const uint32_t *w0, const uint32_t *w8) {
+	__m128i abef_prec = *abef, cdgh_prec = *cdgh;
+	__m128i m[4], msg;
+
+	m[0] = _mm_loadu_si128((const __m128i*)w0);
+	m[1] = _mm_loadu_si128((const __m128i*)(w0+4));
+	m[2] = _mm_loadu_si128((const __m128i*)w8);
+	m[3] = _mm_loadu_si128((const __m128i*)(w8+4));
+
+	_Pragma("GCC unroll 16")
+	for (int i=0; i<16; i++) {
+		if (i>=4) { // expansion : mots 4i à 4i+3
+			msg = _mm_add_epi32(_mm_sha256msg1_epu32(m[i&3], m[(i+1)&3]), _mm_alignr_epi8(m[(i+3)&3], m[(i+2)&3], 4));
+			m[i&3] = _mm_sha256msg2_epu32(msg, m[(i+3)&3]);
+		}
+		msg = _mm_add_epi32(m[i&3], _mm_loadu_si128((const __m128i*)&cw_sha256_k[4*i]));
+		*cdgh = _mm_sha256rnds2_epu32(*cdgh, *abef, msg);
+		*abef = _mm_sha256rnds2_epu32(*abef, *cdgh, _mm_shuffle_epi32(msg, 0x0E));
+	}
+	*abef = _mm_add_epi32(*abef, abef_prec);
+	*cdgh = _mm_add_epi32(*cdgh, cdgh_prec);
+}
+
+/** \brief Etat a..h vers registres ABEF/CDGH */
+CW_SHANI static inline __attribute__((always_inline)) void cw_shani_charge(__m128i *abef, __m128i *cdgh, const uint32_t *st) {
+	__m128i dcba = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)st), 0xB1);     // CDAB
+	__m128i hgfe = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(st+4)), 0x1B); // EFGH
+	*abef = _mm_alignr_epi8(dcba, hgfe, 8);
+	*cdgh = _mm_blend_epi16(hgfe, dcba, 0xF0);
+}
+
+/** \brief Registres ABEF/CDGH vers état a..h */
+CW_SHANI static inline __attribute__((always_inline)) void cw_shani_decharge(uint32_t *st, __m128i abef, __m128i cdgh) {
+	__m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+	__m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+	_mm_storeu_si128((__m128i*)st, _mm_blend_epi16(feba, dchg, 0xF0));
+	_mm_storeu_si128((__m128i*)(st+4), _mm_alignr_epi8(dchg, feba, 8));
+}
+
+/** \brief cw_sha256_iterated_mix1() avec les extensions SHA
+ *  \note
+ *  - les blocs entièrement situés avant r (chaine1 de 64 octets ou plus) ne changent jamais : leur état
+ *    intermédiaire n'est calculé qu'une fois
+ */
+CW_SHANI static void cw_sha256_iterated_mix1_shani(unsigned char *result, char *chaine1, unsigned char *salt, char *chaine2, int iterations, t_cw_kdf_ctx *ctx) {
+	t_cw_gabarit g;
+	uint32_t d[8], w[16];
+	__m128i abef, cdgh, abef_fixe, cdgh_fixe;
+
+	int offset = cw_offset_iterations(iterations);
+
+	cw_gabarit_init(&g, chaine1, chaine2);
+	uint32_t *buffer = (uint32_t*)cw_kdf_ctx_arena(ctx, (size_t)32*iterations);
+
+	int bloc_r = g.mot_r / 16; // premier bloc qui dépend de r
+	cw_shani_charge(&abef_fixe, &cdgh_fixe, cw_sha256_h0);
+	for (int b=0; b<bloc_r; b++) {
+		cw_sha256_compress_shani(&abef_fixe, &cdgh_fixe, g.mots+16*b, g.mots+16*b+8);
+	}
+
+	// Le premier sha porte sur le sel
+	for (int j=0; j<8; j++) {
+		d[j] = ((uint32_t)salt[4*j]<<24) | ((uint32_t)salt[4*j+1]<<16) | ((uint32_t)salt[4*j+2]<<8) | salt[4*j+3];
+	}
+
+	for (int i=-1; i<iterations; i++) {
+		abef = abef_fixe;
+		cdgh = cdgh_fixe;
+		for (int b=bloc_r; b<g.nb_blocs; b++) {
+			for (int t=0; t<16; t++) cw_gabarit_mot<uint32_t>(&w[t], &g, 16*b+t, d);
+			cw_sha256_compress_shani(&abef, &cdgh, w, w+8);
+		}
+		cw_shani_decharge(d, abef, cdgh);
+		if (i>=0) memcpy(buffer+8*i, d, 32);
+	}
+
+	// Calcule le sha final, deux hachés intermédiaires par bloc
+	cw_shani_charge(&abef, &cdgh, cw_sha256_h0);
+	int ofs=0;
+	for (int i=0; i<iterations; i+=2) {
+		uint32_t *h1 = buffer+8*ofs;
+		ofs+=offset;
+		if (ofs>iterations) ofs-=iterations;
+		cw_sha256_compress_shani(&abef, &cdgh, h1, buffer+8*ofs);
+		ofs+=offset;
+		if (ofs>iterations) ofs-=iterations;
+	}
+	memset(w, 0, sizeof(w));
+	w[0] = 0x80000000;
+	w[14] = (uint32_t)(((uint64_t)iterations*32*8) >> 32);
+	w[15] = (uint32_t)((uint64_t)iterations*32*8);
+	cw_sha256_compress_shani(&abef, &cdgh, w, w+8);
+	cw_shani_decharge(d, abef, cdgh);
+
+	for (int j=0; j<8; j++) {
+		result[4*j]   = (unsigned char)(d[j]>>24);
+		result[4*j+1] = (unsigned char)(d[j]>>16);
+		result[4*j+2] = (unsigned char)(d[j]>>8);
+		result[4*j+3] = (unsigned char)d[j];
+	}
+
+	memset(d, 0, sizeof(d));
+	cw_gabarit_free(&g);
+}
+
+/** \brief Indique si le processeur dispose des extensions SHA (et de SSE4.1, utilisé pour les conversions d'état)
+ *  \note 
+ *  - le résultat de cpuid est conservé après le premier appel
+ */
+static int cw_shani_disponible() {
+	static int disponible = -1;
+
+	if (disponible < 0) {
+		unsigned int eax, ebx, ecx, edx;
+		int d = 0;
+		if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSSE3) && (ecx & bit_SSE4_1)) {
+			if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA)) d = 1;
+		}
+		disponible = d;
+	}
+	return disponible;
+}
+
+#endif /* MPM_SHA256_X86 */
+
+
 /** \brief Calcul d'un sha itéré pour certaines opération avec les MdP, nickname et sels
  *  \param[in]  chaine1   Une chaine de caractères de longueur variable terminé par un \0
  *  \param[in]  salt      Un sel de 32 octets
  *  \param[in]  chaine1   Une chaine de caractères de longueur variable terminé par un \0
- *  \param[out] result    Le résultat = SHA256( chaine1 | salt[32] | chaine2 ))
+ *  \param[in]  iterations Le nombre de sha itérés, puissance de 2 donnée par MPM_KDF_ITERATIONS(). Fixe aussi la mémoire utilisée, 32 octets par itération
+ *  \param[in]  ctx       La mémoire de travail, réutilisée d'un appel à l'autre. Si NULL, allouée et effacée pour ce seul calcul
+ *  \param[out] result    Le résultat = SHA256( chaine1 | salt[32] | chaine2 )), mis à zéro en cas d'échec
+ *  \return 0 si la mémoire de travail n'a pas pu être allouée, 1 sinon
  *  \note 
  *  - invoqué depuis t_holder::set_password()
+ *  - passe par cw_sha256_iterated_mix1_shani() si le processeur dispose des extensions SHA, même résultat
  *  \todo gérer les erreurs libcrypto
  */
 #ifdef MPM_OPENSSL 
-void cw_sha256_iterated_mix1(unsigned char *result, char *chaine1, unsigned char *salt, char *chaine2) {
+int cw_sha256_iterated_mix1(unsigned char *result, char *chaine1, unsigned char *salt, char *chaine2, int iterations, t_cw_kdf_ctx *ctx) {
+	t_cw_kdf_ctx *ctx_local = NULL;
+	if (ctx == NULL) ctx = ctx_local = cw_kdf_ctx_new();
+	if (cw_kdf_ctx_arena(ctx, (size_t)32*iterations) == NULL) {
+		memset(result, 0, 32);
+		cw_kdf_ctx_free(ctx_local);
+		return 0;
+	}
+	#ifdef MPM_SHA256_X86
+	if (cw_shani_disponible()) {
+		cw_sha256_iterated_mix1_shani(result, chaine1, salt, chaine2, iterations, ctx);
+		cw_kdf_ctx_free(ctx_local);
+		return 1;
+	}
+	#endif
 	unsigned char* r = (unsigned char*)alloca(32);
 	SHA256_CTX hacheur;
-	unsigned char* buffer = (unsigned char*) malloc(32*MPM_SHA_ITERATIONS);
+	unsigned char* buffer = cw_kdf_ctx_arena(ctx, (size_t)32*iterations);
+	int offset = cw_offset_iterations(iterations);
 	
 	if (SHA256_Init(&hacheur) == 0) {
 		fprintf(stderr, "%s runtime error file %s line %d\n", __func__, __FILE__, __LINE__);
@@ -447,7 +1456,7 @@ void cw_sha256_iterated_mix1(unsigned char *result, char *chaine1, unsigned char
 
 
 	// Remplit le buffer des sha itérés
-	for (int i=0; i<MPM_SHA_ITERATIONS; i++) {
+	for (int i=0; i<iterations; i++) {
 		if (SHA256_Init(&hacheur) == 0) {
 			fprintf(stderr, "%s runtime error file %s line %d\n", __func__, __FILE__,__LINE__);
 			abort();
@@ -466,22 +1475,38 @@ void cw_sha256_iterated_mix1(unsigned char *result, char *chaine1, unsigned char
 	}
 	
 	int ofs=0;
-	for (int i=0; i<MPM_SHA_ITERATIONS; i++) {
+	for (int i=0; i<iterations; i++) {
 		SHA256_Update(&hacheur, &buffer[ofs*32], 32);
-		ofs+=MPM_SHA_OFFSET_ITERATIONS;
-		if (ofs>MPM_SHA_ITERATIONS) ofs-=MPM_SHA_ITERATIONS;
+		ofs+=offset;
+		if (ofs>iterations) ofs-=iterations;
 	}
 	SHA256_Final(result, &hacheur);
-	free(buffer);
+	cw_kdf_ctx_free(ctx_local);
+	return 1;
 }
 #endif /* MPM_OPENSSL */
 
 #ifdef MPM_WINCRYPTO
-void cw_sha256_iterated_mix1(unsigned char *result, char *chaine1, unsigned char *salt, char *chaine2) {
+int cw_sha256_iterated_mix1(unsigned char *result, char *chaine1, unsigned char *salt, char *chaine2, int iterations, t_cw_kdf_ctx *ctx) {
+	t_cw_kdf_ctx *ctx_local = NULL;
+	if (ctx == NULL) ctx = ctx_local = cw_kdf_ctx_new();
+	if (cw_kdf_ctx_arena(ctx, (size_t)32*iterations) == NULL) {
+		memset(result, 0, 32);
+		cw_kdf_ctx_free(ctx_local);
+		return 0;
+	}
+	#ifdef MPM_SHA256_X86
+	if (cw_shani_disponible()) {
+		cw_sha256_iterated_mix1_shani(result, chaine1, salt, chaine2, iterations, ctx);
+		cw_kdf_ctx_free(ctx_local);
+		return 1;
+	}
+	#endif
 	BCRYPT_ALG_HANDLE hAlgorithm;
 	BCRYPT_HASH_HANDLE hHash;
-	unsigned char* buffer = (unsigned char*) malloc(32*MPM_SHA_ITERATIONS);
+	unsigned char* buffer = cw_kdf_ctx_arena(ctx, (size_t)32*iterations);
 	unsigned char* r = (unsigned char*)alloca(32);
+	int offset = cw_offset_iterations(iterations);
 
 	NTSTATUS ret=BCryptOpenAlgorithmProvider( &hAlgorithm, BCRYPT_SHA256_ALGORITHM,  NULL,	0);
 	if (ret != STATUS_SUCCESS) { 
@@ -500,7 +1525,7 @@ void cw_sha256_iterated_mix1(unsigned char *result, char *chaine1, unsigned char
 	ret = BCryptFinishHash (hHash, r,                        32,              0);
 
 	// Remplit le buffer des sha itérés
-	for (int i=0; i<MPM_SHA_ITERATIONS; i++) {
+	for (int i=0; i<iterations; i++) {
 		ret = BCryptHashData   (hHash, (unsigned char *)chaine1, strlen(chaine1), 0);
 		ret = BCryptHashData   (hHash, r,                        32,              0);
 		ret = BCryptHashData   (hHash, (unsigned char *)chaine2, strlen(chaine2), 0);
@@ -509,18 +1534,408 @@ void cw_sha256_iterated_mix1(unsigned char *result, char *chaine1, unsigned char
 	}
 
 	int ofs=0;
-	for (int i=0; i<MPM_SHA_ITERATIONS; i++) {
+	for (int i=0; i<iterations; i++) {
 		ret = BCryptHashData   (hHash, &buffer[ofs*32], 32, 0);
-		ofs+=MPM_SHA_OFFSET_ITERATIONS;
-		if (ofs>MPM_SHA_ITERATIONS) ofs-=MPM_SHA_ITERATIONS;
+		ofs+=offset;
+		if (ofs>iterations) ofs-=iterations;
 	}
 	ret = BCryptFinishHash (hHash, result, 32, 0);
 	ret = BCryptDestroyHash(hHash);	
-	free(buffer);
+	cw_kdf_ctx_free(ctx_local);
+	return 1;
 }
 #endif /* MPM_WINCRYPTO */
 
 
+/* Moteur SHA-256 multi-lanes (AVX2 = 8 lanes, AVX-512 = 16 lanes)
+ *
+ * Calcule cw_sha256_iterated_mix1() pour plusieurs sels à la fois, avec les mêmes chaine1 et chaine2. Tous les
+ * messages ont donc la même longueur et le même découpage en blocs, seuls les 32 octets du milieu diffèrent.
+ * Chaque lane d'un registre SIMD porte un des calculs. Le résultat est identique octet pour octet à la version
+ * OpenSSL ci-dessus.
+ * 
+ * La sélection se fait à l'exécution selon le processeur, avec repli sur cw_sha256_iterated_mix1() si rien
+ * n'est disponible.
+ */
+#ifdef MPM_SHA256_X86
+
+typedef uint32_t cw_v8 __attribute__((vector_size(32)));  /* 8 lanes de 32 bits, AVX2 */
+typedef uint32_t cw_v16 __attribute__((vector_size(64))); /* 16 lanes de 32 bits, AVX-512 */
+
+#define CW_ROTR(x,n) (((x) >> (n)) | ((x) << (32-(n))))
+
+/** \brief Fonction de compression SHA-256 sur toutes les lanes
+ *  \param[in,out] st  L'état, 8 mots
+ *  \param[in,out] w   Les 16 mots du bloc, big endian déjà convertis. Ecrasé par l'expansion
+ */
+template<typename V> static inline __attribute__((always_inline)) void cw_sha256_compress_multi(V *st, V *w) {
+	V a=st[0], b=st[1], c=st[2], d=st[3], e=st[4], f=st[5], g=st[6], h=st[7];
+	V wi, t1, t2;
+
+	_Pragma("GCC unroll 64")
+	for (int i=0; i<64; i++) {
+		if (i<16) {
+			wi = w[i];
+		} else {
+			V w15 = w[(i-15)&15], w2 = w[(i-2)&15];
+			wi = w[i&15] += (CW_ROTR(w15,7) ^ CW_ROTR(w15,18) ^ (w15>>3)) + w[(i-7)&15] + (CW_ROTR(w2,17) ^ CW_ROTR(w2,19) ^ (w2>>10));
+		}
+		t1 = h + (CW_ROTR(e,6) ^ CW_ROTR(e,11) ^ CW_ROTR(e,25)) + ((e&f) ^ (~e&g)) + cw_sha256_k[i] + wi;
+		t2 = (CW_ROTR(a,2) ^ CW_ROTR(a,13) ^ CW_ROTR(a,22)) + ((a&b) ^ (a&c) ^ (b&c));
+		h=g; g=f; f=e; e=d+t1; d=c; c=b; b=a; a=t1+t2;
+	}
+	st[0]+=a; st[1]+=b; st[2]+=c; st[3]+=d; st[4]+=e; st[5]+=f; st[6]+=g; st[7]+=h;
+}
+
+/** \brief cw_sha256_iterated_mix1() sur NL lanes
+ *  \param[out] results  n*32 octets
+ *  \param[in]  n        nombre de sels, au plus NL. Les lanes inutilisées recalculent le premier sel
+ *  \note
+ *  - les mots du gabarit qui ne dépendent pas de r sont diffusés tels quels dans toutes les lanes
+ *  - les hachés intermédiaires sont conservés sous forme de mots d'état, ce qui donne directement les blocs du sha final
+ */
+template<typename V, int NL> static inline __attribute__((always_inline)) 
+void cw_sha256_iterated_mix1_lanes(unsigned char *results, int n, char *chaine1, unsigned char **salts, char *chaine2, int iterations, t_cw_kdf_ctx *ctx) {
+	t_cw_gabarit g;
+	V d[8], st[8], w[16];
+	int offset = cw_offset_iterations(iterations);
+
+	cw_gabarit_init(&g, chaine1, chaine2);
+
+	// Le premier sha porte sur les sels
+	for (int j=0; j<8; j++) {
+		for (int l=0; l<NL; l++) {
+			unsigned char *p = salts[(l<n) ? l : 0] + 4*j;
+			d[j][l] = ((uint32_t)p[0]<<24) | ((uint32_t)p[1]<<16) | ((uint32_t)p[2]<<8) | p[3];
+		}
+	}
+
+	V *buffer = (V*)cw_kdf_ctx_arena(ctx, sizeof(V)*8*(size_t)iterations); // alignée sur une page, déjà allouée par cw_sha256_iterated_mix1_multi()
+
+	for (int i=-1; i<iterations; i++) {
+		for (int j=0; j<8; j++) st[j] = (V){} + cw_sha256_h0[j];
+		for (int b=0; b<g.nb_blocs; b++) {
+			for (int t=0; t<16; t++) cw_gabarit_mot<V>(&w[t], &g, 16*b+t, d);
+			cw_sha256_compress_multi<V>(st, w);
+		}
+		for (int j=0; j<8; j++) d[j] = st[j];
+		if (i>=0) for (int j=0; j<8; j++) buffer[i*8+j] = st[j];
+	}
+
+	// Calcule le sha final, deux hachés intermédiaires par bloc
+	for (int j=0; j<8; j++) st[j] = (V){} + cw_sha256_h0[j];
+	int ofs=0;
+	for (int i=0; i<iterations; i+=2) {
+		for (int j=0; j<8; j++) w[j] = buffer[ofs*8+j];
+		ofs+=offset;
+		if (ofs>iterations) ofs-=iterations;
+		for (int j=0; j<8; j++) w[8+j] = buffer[ofs*8+j];
+		ofs+=offset;
+		if (ofs>iterations) ofs-=iterations;
+		cw_sha256_compress_multi<V>(st, w);
+	}
+	w[0] = (V){} + 0x80000000;
+	for (int j=1; j<14; j++) w[j] = (V){};
+	w[14] = (V){} + (uint32_t)(((uint64_t)iterations*32*8) >> 32);
+	w[15] = (V){} + (uint32_t)((uint64_t)iterations*32*8);
+	cw_sha256_compress_multi<V>(st, w);
+
+	for (int l=0; l<n; l++) {
+		for (int j=0; j<8; j++) {
+			uint32_t x = st[j][l];
+			results[l*32+4*j]   = (unsigned char)(x>>24);
+			results[l*32+4*j+1] = (unsigned char)(x>>16);
+			results[l*32+4*j+2] = (unsigned char)(x>>8);
+			results[l*32+4*j+3] = (unsigned char)x;
+		}
+	}
+
+	cw_gabarit_free(&g);
+}
+
+__attribute__((target("avx2")))
+static void cw_sha256_iterated_mix1_avx2(unsigned char *results, int n, char *chaine1, unsigned char **salts, char *chaine2, int iterations, t_cw_kdf_ctx *ctx) {
+	cw_sha256_iterated_mix1_lanes<cw_v8, 8>(results, n, chaine1, salts, chaine2, iterations, ctx);
+}
+
+__attribute__((target("avx512f")))
+static void cw_sha256_iterated_mix1_avx512(unsigned char *results, int n, char *chaine1, unsigned char **salts, char *chaine2, int iterations, t_cw_kdf_ctx *ctx) {
+	cw_sha256_iterated_mix1_lanes<cw_v16, 16>(results, n, chaine1, salts, chaine2, iterations, ctx);
+}
+
+#endif /* MPM_SHA256_X86 */
+
+
+/** \brief Nombre de sels que cw_sha256_iterated_mix1_multi() traite en un seul passage sur ce processeur
+ *  \return 16 avec AVX-512, 8 avec AVX2, 1 sinon
+ *  \note 
+ *  - invoqué par t_database::find_chunk_holder() pour dimensionner les lots de chunks distribués aux threads
+ */
+int cw_sha256_lanes() {
+	#ifdef MPM_SHA256_X86
+	if (__builtin_cpu_supports("avx512f")) return 16;
+	if (__builtin_cpu_supports("avx2")) return 8;
+	#endif
+	return 1;
+}
+
+#define CW_SHANI_PAR_PASSAGE 5 /* durée d'un passage AVX2 ou AVX-512, en calculs SHA-NI, quel que soit le nombre de lanes remplies */
+
+/** \brief Nombre minimal de sels pour que cw_sha256_iterated_mix1_multi() fasse un passage multi-lanes
+ *  \note 
+ *  - avec les extensions SHA, un passage SIMD ne vaut que s'il remplace plus de CW_SHANI_PAR_PASSAGE calculs SHA-NI
+ */
+static int cw_sha256_seuil_lanes() {
+	#ifdef MPM_SHA256_X86
+	if (cw_shani_disponible()) return CW_SHANI_PAR_PASSAGE + 1;
+	#endif
+	return 2;
+}
+
+/** \brief Calcul de cw_sha256_iterated_mix1() pour plusieurs sels, avec les mêmes chaines
+ *  \param[out] results   n*32 octets, résultat pour chaque sel dans l'ordre
+ *  \param[in]  n         Le nombre de sels
+ *  \param[in]  chaine1   Une chaine de caractères de longueur variable terminé par un \0
+ *  \param[in]  salts     Tableau de n pointeurs sur des sels de 32 octets
+ *  \param[in]  chaine2   Une chaine de caractères de longueur variable terminé par un \0
+ *  \param[in]  iterations Le nombre de sha itérés, voir cw_sha256_iterated_mix1()
+ *  \param[in]  ctx       La mémoire de travail, voir cw_sha256_iterated_mix1()
+ *  \note 
+ *  - invoqué depuis t_database::find_chunk_holder(), où seul le sel change d'un chunk à l'autre
+ *  - utilise le moteur SIMD le plus large disponible, sinon cw_sha256_iterated_mix1() sel par sel. Aussi sel par sel pour 
+ *    les derniers sels, s'ils sont trop peu nombreux pour un passage (voir cw_sha256_seuil_lanes())
+ *  - si la mémoire de travail d'un passage ne peut pas être allouée, les passages suivants sont plus étroits
+ *  \return 0 si même le calcul sel par sel n'a pas eu sa mémoire : les résultats concernés sont à zéro
+ */
+int cw_sha256_iterated_mix1_multi(unsigned char *results, int n, char *chaine1, unsigned char **salts, char *chaine2, int iterations, t_cw_kdf_ctx *ctx) {
+	int lanes = cw_sha256_lanes();
+	int seuil = cw_sha256_seuil_lanes();
+	int i=0, ok=1;
+	t_cw_kdf_ctx *ctx_local = NULL;
+
+	if (ctx == NULL) ctx = ctx_local = cw_kdf_ctx_new();
+
+	while (i<n) {
+		#ifdef MPM_SHA256_X86
+		if ((lanes >= 16) && (n-i > 8) && (n-i >= seuil)) {
+			if (cw_kdf_ctx_arena(ctx, sizeof(cw_v16)*8*(size_t)iterations) != NULL) {
+				int nl = (n-i > 16) ? 16 : n-i;
+				cw_sha256_iterated_mix1_avx512(results+32*i, nl, chaine1, salts+i, chaine2, iterations, ctx);
+				i += nl;
+				continue;
+			}
+			lanes = 8; // mémoire insuffisante : passages plus étroits
+		}
+		if ((lanes >= 8) && (n-i >= seuil)) {
+			if (cw_kdf_ctx_arena(ctx, sizeof(cw_v8)*8*(size_t)iterations) != NULL) {
+				int nl = (n-i > 8) ? 8 : n-i;
+				cw_sha256_iterated_mix1_avx2(results+32*i, nl, chaine1, salts+i, chaine2, iterations, ctx);
+				i += nl;
+				continue;
+			}
+			lanes = 1;
+		}
+		#endif
+		if (!cw_sha256_iterated_mix1(results+32*i, chaine1, salts[i], chaine2, iterations, ctx)) ok = 0;
+		i++;
+	}
+	cw_kdf_ctx_free(ctx_local);
+	return ok;
+}
+
+
+
+/*
+ * KDF des holders : sha256 itérés ou Argon2id, selon la version des chunks holders de la base
+ */
+
+#ifdef MPM_ARGON2
+#include <argon2.h>
+
+/** \brief Argon2id, avec chaine1 en données associées
+ *  \return 0 si la mémoire n'a pas pu être allouée, 1 sinon
+ *  \note 
+ *  - le nombre de lanes fait partie du calcul. Seul le nombre de threads qui les calculent dépend de la machine
+ */
+static int cw_argon2id(unsigned char *result, char *chaine1, unsigned char *salt, char *chaine2, const t_cw_kdf *kdf) {
+	argon2_context ctx;
+	int r;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.out = result;
+	ctx.outlen = 32;
+	ctx.pwd = (uint8_t*)chaine2;
+	ctx.pwdlen = (uint32_t)strlen(chaine2);
+	ctx.salt = salt;
+	ctx.saltlen = 32;
+	ctx.ad = (uint8_t*)chaine1;
+	ctx.adlen = (uint32_t)strlen(chaine1);
+	ctx.t_cost = MPM_ARGON2_PASSES;
+	ctx.m_cost = 1u << kdf->cout;
+	ctx.lanes = kdf->lanes;
+	ctx.threads = (tw_nb_cpu() < kdf->lanes) ? tw_nb_cpu() : kdf->lanes;
+	ctx.version = ARGON2_VERSION_13;
+	ctx.flags = ARGON2_DEFAULT_FLAGS;
+
+	r = argon2_ctx(&ctx, Argon2_id);
+	if (r == ARGON2_MEMORY_ALLOCATION_ERROR) {
+		memset(result, 0, 32);
+		return 0;
+	}
+	if (r != ARGON2_OK) {
+		fprintf(stderr, "Erreur Argon2id : %s\n", argon2_error_message(r));
+		abort();
+	}
+	return 1;
+}
+#endif /* MPM_ARGON2 */
+
+
+/** \brief Indique si une KDF est disponible dans cet exécutable
+ *  \param[in] algo  MPM_KDF_SHA256 ou MPM_KDF_ARGON2ID
+ */
+int cw_kdf_disponible(int algo) {
+	if (algo == MPM_KDF_SHA256) return 1;
+	#ifdef MPM_ARGON2
+	if (algo == MPM_KDF_ARGON2ID) return 1;
+	#endif
+	return 0;
+}
+
+/** \brief KDF des holders : hash de reconnaissance et pkey des chunks
+ *  \param[out] result    Le résultat, 32 octets
+ *  \param[in]  chaine1   Le nickname
+ *  \param[in]  salt      Un sel de 32 octets
+ *  \param[in]  chaine2   Le mot de passe
+ *  \param[in]  kdf       Les paramètres de la base, voir t_database::kdf
+ *  \param[in]  ctx       La mémoire de travail des sha itérés, ou NULL, voir cw_sha256_iterated_mix1(). Argon2id alloue la sienne
+ *  \return 0 si la mémoire de travail manque : le résultat est à zéro, et le calcul est à signaler comme non fait
+ *  \note 
+ *  - invoqué par t_holder::set_password(), t_holder::try_tardif() et la recherche des chunks de t_database
+ */
+int cw_kdf(unsigned char *result, char *chaine1, unsigned char *salt, char *chaine2, const t_cw_kdf *kdf, t_cw_kdf_ctx *ctx) {
+	switch (kdf->algo) {
+		case MPM_KDF_SHA256:
+			return cw_sha256_iterated_mix1(result, chaine1, salt, chaine2, MPM_KDF_ITERATIONS(kdf->cout), ctx);
+
+		#ifdef MPM_ARGON2
+		case MPM_KDF_ARGON2ID:
+			return cw_argon2id(result, chaine1, salt, chaine2, kdf);
+		#endif
+
+		default:
+			fprintf(stderr, "KDF %d non disponible\n", kdf->algo);
+			abort();
+	}
+}
+
+/** \brief Nombre de sels que cw_kdf_multi() traite en un seul passage
+ *  \note 
+ *  - Argon2id parallélise déjà chaque calcul sur ses lanes
+ */
+int cw_kdf_passage(const t_cw_kdf *kdf) {
+	return (kdf->algo == MPM_KDF_SHA256) ? cw_sha256_lanes() : 1;
+}
+
+/** \brief Mémoire de travail d'un passage de cw_kdf_multi() sur nb_sels sels
+ *  \note 
+ *  - un passage SIMD occupe toutes les lanes du moteur choisi par cw_sha256_iterated_mix1_multi(), même partiellement rempli
+ */
+size_t cw_kdf_memoire(const t_cw_kdf *kdf, int nb_sels) {
+	int lanes = cw_sha256_lanes();
+	int largeur = 1;
+
+	if (kdf->algo != MPM_KDF_SHA256) return (size_t)1024 << kdf->cout;
+	if ((lanes >= 16) && (nb_sels > 8)) largeur = 16;
+	else if ((lanes >= 8) && (nb_sels >= 2) && (nb_sels >= cw_sha256_seuil_lanes())) largeur = 8;
+	return (size_t)largeur * 32 * MPM_KDF_ITERATIONS(kdf->cout);
+}
+
+/** \brief Nombre de sels par passage et nombre de threads d'une recherche, dans la limite de MPM_KDF_MEMOIRE_MAX
+ *  \param[in,out] nb_threads  Nombre de threads souhaité, réduit si même un sel par passage dépasse la limite
+ *  \return le nombre de sels par passage, au plus cw_kdf_passage()
+ *  \note 
+ *  - les lanes sont réduites d'abord : à mémoire égale, un thread de plus vaut autant que des lanes de plus
+ *  - invoqué par scan_calcul() et kdf_projection(), qui répartissent la recherche de la même façon
+ */
+int cw_kdf_repartition(const t_cw_kdf *kdf, int *nb_threads) {
+	int lanes = cw_kdf_passage(kdf);
+
+	while ((lanes > 1) && ((size_t)*nb_threads * cw_kdf_memoire(kdf, lanes) > MPM_KDF_MEMOIRE_MAX)) lanes = (lanes > 8) ? 8 : 1;
+	while ((*nb_threads > 1) && ((size_t)*nb_threads * cw_kdf_memoire(kdf, lanes) > MPM_KDF_MEMOIRE_MAX)) (*nb_threads)--;
+	return lanes;
+}
+
+/** \brief Calcul de cw_kdf() pour plusieurs sels, avec les mêmes chaines. Voir cw_sha256_iterated_mix1_multi()
+ *  \return 0 si la mémoire de travail a manqué pour au moins un sel, voir cw_kdf()
+ */
+int cw_kdf_multi(unsigned char *results, int n, char *chaine1, unsigned char **salts, char *chaine2, const t_cw_kdf *kdf, t_cw_kdf_ctx *ctx) {
+	int ok = 1;
+
+	if (kdf->algo == MPM_KDF_SHA256) return cw_sha256_iterated_mix1_multi(results, n, chaine1, salts, chaine2, MPM_KDF_ITERATIONS(kdf->cout), ctx);
+	for (int i=0; i<n; i++) if (!cw_kdf(results+32*i, chaine1, salts[i], chaine2, kdf, ctx)) ok = 0;
+	return ok;
+}
+
+/** \brief Nombre de coeurs occupés par un seul calcul de cw_kdf() */
+static int cw_kdf_threads(const t_cw_kdf *kdf) {
+	if (kdf->algo == MPM_KDF_SHA256) return 1;
+	return (tw_nb_cpu() < kdf->lanes) ? tw_nb_cpu() : kdf->lanes;
+}
+
+/** \brief Indique si cw_kdf_double() prend le temps d'un seul calcul
+ *  \param[in] nb_simultanes   Nombre de cw_kdf_double() lancés en même temps, un par thread
+ *  \note 
+ *  - vrai si les deux sels tiennent dans les lanes SIMD, ou s'il reste assez de coeurs pour un thread de plus par calcul
+ *  - sert à décider des calculs spéculatifs : la pkey calculée avant de savoir si le hash correspond
+ */
+int cw_kdf_double_gratuit(const t_cw_kdf *kdf, int nb_simultanes) {
+	if ((cw_kdf_passage(kdf) >= 2) && (cw_sha256_seuil_lanes() <= 2)) return 1;
+	return (tw_nb_cpu() >= 2 * nb_simultanes * cw_kdf_threads(kdf)) ? 1 : 0;
+}
+
+/** \brief Paramètres du second calcul de cw_kdf_double(), fait dans un autre thread */
+typedef struct t_cw_kdf_second {
+	unsigned char *result;
+	char *chaine1;
+	unsigned char *salt;
+	char *chaine2;
+	const t_cw_kdf *kdf;
+	int ok;
+} t_cw_kdf_second;
+
+static void cw_kdf_second_thread(void *arg) {
+	t_cw_kdf_second *s = (t_cw_kdf_second*)arg;
+	s->ok = cw_kdf(s->result, s->chaine1, s->salt, s->chaine2, s->kdf, NULL);
+}
+
+/** \brief Deux calculs de cw_kdf() avec les mêmes chaines, menés en même temps
+ *  \param[out] results   Les 2 résultats à la suite, 64 octets : salt_a puis salt_b
+ *  \param[in]  ctx       La mémoire de travail du premier calcul, ou NULL. Le second thread a la sienne
+ *  \note 
+ *  - invoqué par t_holder::set_password() pour la pkey et le hash, et pour le calcul spéculatif de la pkey pendant 
+ *    que le hash est testé : t_holder::try_tardif(), recherche des chunks de t_database
+ *  - un seul passage multi-lanes si possible, sinon un second thread quand il reste des coeurs (voir cw_kdf_double_gratuit()),
+ *    sinon l'un après l'autre
+ *  \return 0 si la mémoire de travail a manqué pour l'un des calculs, voir cw_kdf()
+ */
+int cw_kdf_double(unsigned char *results, char *chaine1, unsigned char *salt_a, unsigned char *salt_b, char *chaine2, const t_cw_kdf *kdf, t_cw_kdf_ctx *ctx) {
+	unsigned char *salts[2] = { salt_a, salt_b };
+	t_cw_kdf_second second = { results+32, chaine1, salt_b, chaine2, kdf, 0 };
+	tw_thread thread;
+	int ok;
+
+	if ((cw_kdf_passage(kdf) >= 2) && (cw_sha256_seuil_lanes() <= 2)) {
+		return cw_kdf_multi(results, 2, chaine1, salts, chaine2, kdf, ctx);
+	} else if (cw_kdf_double_gratuit(kdf, 1) && (tw_thread_create(&thread, cw_kdf_second_thread, &second) == 0)) {
+		ok = cw_kdf(results, chaine1, salt_a, chaine2, kdf, ctx);
+		tw_thread_join(thread);
+		return ok && second.ok;
+	}
+	return cw_kdf_multi(results, 2, chaine1, salts, chaine2, kdf, ctx);
+}
+
+
 /** \brief Calcul d'un sha pour certaines opérations avec la base common
  *  \param[in]  salt            Un sel de 32 octets
  *  \param[in]  common_magic    Le nonce choisi à la création de la base pour détecter le chunk common une fois le premier chunk holder ouvert
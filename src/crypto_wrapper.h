@@ -17,6 +17,8 @@
     You can also see <https://www.gnu.org/licenses/>.
 */
 
+#ifndef HAVE_CRYPTO_WRAPPER_H
+#define HAVE_CRYPTO_WRAPPER_H
 
 #ifdef __cplusplus
 extern "C" {
@@ -44,8 +46,41 @@ extern "C" {
 
 
 
-#define MPM_SHA_ITERATIONS (65536) /* nombre de sha itérés pour la génération des marqueurs de chunk et clé de holder */
+#define MPM_SHA_ITERATIONS (65536) /* nombre de sha itérés par défaut pour la génération des marqueurs de chunk et clé de holder */
 #define MPM_SHA_OFFSET_ITERATIONS (3*5*11*13*17) /* nombre premier avec MPM_SHA_ITERATIONS mais qui s'approche entre 1 et 2 tiers */
+#define MPM_KDF_COST_DEFAULT 16 /* coût de la KDF par défaut, log2 du nombre de sha itérés : donne MPM_SHA_ITERATIONS */
+#define MPM_KDF_COST_MIN 10     /* coût minimum accepté par 'init ... kdf cost' */
+#define MPM_KDF_COST_MAX 20     /* coût maximum : 32 Mo par calcul sha, 512 Mo pour 16 lanes AVX-512, 1 Go pour Argon2id. Voir MPM_KDF_MEMOIRE_MAX */
+#define MPM_KDF_ITERATIONS(cost) (1 << (cost)) /* nombre de sha itérés pour un coût donné */
+#define CW_SHA256_MAX_LANES 16 /* nombre maximum de sels traités en un passage par cw_sha256_iterated_mix1_multi() */
+#define MPM_KDF_MEMOIRE_MAX ((size_t)256 << 20) /* mémoire de travail des KDF simultanées d'une recherche, voir cw_kdf_repartition() */
+
+#define MPM_KDF_SHA256 0   /* sha256 itérés, voir cw_sha256_iterated_mix1(). Chunks holders CHUNK_HOLDER_VERSION */
+#define MPM_KDF_ARGON2ID 1 /* Argon2id, 2^coût Ko de mémoire. Chunks holders CHUNK_HOLDER_VERSION_ARGON2, nécessite MPM_ARGON2 */
+#define MPM_ARGON2_PASSES 3 /* nombre de passes sur la mémoire d'Argon2id */
+#define MPM_KDF_LANES_MAX 16 /* nombre maximum de lanes d'Argon2id, fixé à la création de la base d'après le nombre de coeurs */
+
+/** \brief Paramètres de la KDF des holders d'une base, voir cw_kdf() */
+typedef struct t_cw_kdf {
+	int algo;  ///< MPM_KDF_SHA256 ou MPM_KDF_ARGON2ID
+	int cout;  ///< entre MPM_KDF_COST_MIN et MPM_KDF_COST_MAX : log2 du nombre de sha itérés, ou de la mémoire d'Argon2id en Ko
+	int lanes; ///< parallélisme d'Argon2id, entre 1 et MPM_KDF_LANES_MAX. Fait partie du calcul, ne dépend pas de la machine qui ouvre la base
+} t_cw_kdf;
+
+/** \brief Mémoire de travail des sha itérés, réutilisée d'un calcul à l'autre. Voir cw_kdf_ctx_new()
+ *  \note sert aussi d'arena pour les champs secrets déchiffrés par lot, voir t_secret_item::decrypt_secrets() */
+typedef struct t_cw_kdf_ctx {
+	unsigned char *arena; ///< alignée sur une page, verrouillée en mémoire si possible. NULL tant qu'aucun calcul n'a eu lieu
+	size_t taille;        ///< taille de l'arena, agrandie au besoin
+	int verrouillee;      ///< l'arena ne peut pas être écrite dans le swap
+} t_cw_kdf_ctx;
+
+/** \brief Clé AES256 préparée une fois pour toutes, voir cw_aes_new() */
+typedef struct t_cw_aes t_cw_aes;
+
+#define CW_AES_BIBLIOTHEQUE 0 /* CBC par la bibliothèque crypto, OpenSSL EVP ou BCrypt */
+#define CW_AES_AESNI 1        /* CBC natif AES-NI, déchiffrement par 8 blocs */
+#define CW_AES_VAES 2         /* CBC natif AES-NI, déchiffrement par 16 blocs avec VAES et AVX-512 */
 
 void random_init();
 void random_deinit();
@@ -53,11 +88,34 @@ void *random_bytes(void *dest, size_t n);
 char *generate_password(char *dest, int n);
 
 void cw_aes_cbc(unsigned char *buffer, size_t len, unsigned char *key, unsigned char *iv, int enc);
+t_cw_aes *cw_aes_new(const unsigned char *key);
+void cw_aes_free(t_cw_aes *aes);
+void cw_aes_cbc_cle(t_cw_aes *aes, unsigned char *buffer, size_t len, const unsigned char *iv, int enc);
+void cw_aes_cbc_debut(t_cw_aes *aes, const unsigned char *iv, int enc);
+void cw_aes_cbc_suite(t_cw_aes *aes, unsigned char *buffer, size_t len);
+void cw_aes_cbc_multi(t_cw_aes *aes, int n, unsigned char **buffers, const size_t *lens, unsigned char **ivs, int enc);
+int cw_aes_backend();
+int cw_aes_gcm(t_cw_aes *aes, unsigned char *buffer, size_t len, const unsigned char *nonce, const unsigned char *aad, size_t aad_len, unsigned char *tag, int enc);
 void cw_sha256_mix1(unsigned char *result, char *chaine1, unsigned char *salt, char *chaine2);
-void cw_sha256_iterated_mix1(unsigned char *result, char *chaine1, unsigned char *salt, char *chaine2);
+t_cw_kdf_ctx *cw_kdf_ctx_new();
+void cw_kdf_ctx_free(t_cw_kdf_ctx *ctx);
+unsigned char *cw_kdf_ctx_arena(t_cw_kdf_ctx *ctx, size_t taille);
+int cw_sha256_iterated_mix1(unsigned char *result, char *chaine1, unsigned char *salt, char *chaine2, int iterations, t_cw_kdf_ctx *ctx);
+int cw_sha256_lanes();
+int cw_sha256_iterated_mix1_multi(unsigned char *results, int n, char *chaine1, unsigned char **salts, char *chaine2, int iterations, t_cw_kdf_ctx *ctx);
+int cw_kdf_disponible(int algo);
+int cw_kdf(unsigned char *result, char *chaine1, unsigned char *salt, char *chaine2, const t_cw_kdf *kdf, t_cw_kdf_ctx *ctx);
+int cw_kdf_passage(const t_cw_kdf *kdf);
+size_t cw_kdf_memoire(const t_cw_kdf *kdf, int nb_sels);
+int cw_kdf_repartition(const t_cw_kdf *kdf, int *nb_threads);
+int cw_kdf_multi(unsigned char *results, int n, char *chaine1, unsigned char **salts, char *chaine2, const t_cw_kdf *kdf, t_cw_kdf_ctx *ctx);
+int cw_kdf_double_gratuit(const t_cw_kdf *kdf, int nb_simultanes);
+int cw_kdf_double(unsigned char *results, char *chaine1, unsigned char *salt_a, unsigned char *salt_b, char *chaine2, const t_cw_kdf *kdf, t_cw_kdf_ctx *ctx);
 void cw_sha256_mix2(unsigned char *result, unsigned char *salt, uint64_t common_magic);
 
 
 #ifdef __cplusplus
 }
-#endif
\ No newline at end of file
+#endif
+
+#endif /* HAVE_CRYPTO_WRAPPER_H */
@@ -25,6 +25,18 @@
 #include <cparser.h>  /* pour CPARSER_MAX_PROMPT */
 #include "database.h"
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <io.h> /* pour _commit() et _chsize() */
+#endif
+#ifdef MPM_ZLIB
+#include <zlib.h>
+#endif
+
 
 
 /** 
@@ -41,17 +53,31 @@ t_database::t_database(void) {
 	status=MPM_LEVEL_INIT;
 	next_id_holder=1;
 	sss_common = sss_secret = NULL;
+	common_aes = secret_aes = NULL;
+	clairs=NULL;
+	clairs_lot=1;
 	nb_holders=0;
+	kdf.algo=MPM_KDF_SHA256;
+	kdf.cout=MPM_KDF_COST_DEFAULT;
+	kdf.lanes=1;
+	common_index=0;
+	common_format=MPM_COMMON_PAGES_ECRIT;
+	pages=NULL;
+	pending_tries=NULL;
+	vue=NULL;
+	chunks_connus=false;
 	changed=0;
 	common_treshold=secret_treshold=-1;
 }
 
 /** 
  *  \brief Constructeur pour création d'une nouvelle base initialement vide, connaissant les treshold et nom de fichier
+ *  \param[in] kdf_cost_ Coût de la KDF des holders, entre MPM_KDF_COST_MIN et MPM_KDF_COST_MAX. Ne peut plus changer ensuite
+ *  \param[in] kdf_algo_ MPM_KDF_SHA256 ou MPM_KDF_ARGON2ID, voir cw_kdf_disponible(). Pour Argon2id, une lane par coeur de cette machine
  *  \note la base est créée directement avec status=MPM_LEVEL_SECRET, mais attention, les parts ne sont pas encore distribuées
  *  \TODO Gérer les erreurs sans interaction UI
  */
-t_database::t_database(int common_treshold_, int secret_treshold_, char *filename_) : t_database() {
+t_database::t_database(int common_treshold_, int secret_treshold_, char *filename_, int kdf_cost_, int kdf_algo_) : t_database() {
 	if (filename_) {
 		filename=strdup(filename_);
 	} else {
@@ -68,6 +94,7 @@ t_database::t_database(int common_treshold_, int secret_treshold_, char *filenam
 	}
 	random_bytes(common_key, 32);
 	lsss_set_secret(sss_common, common_key);
+	common_aes = cw_aes_new(common_key);
 
 	#ifdef DEBUG
 	debug_printf(0,(char*)"%s() nouvelle common key=%" PRIx64 "\n", __func__, *(uint64_t*) common_key);
@@ -82,12 +109,19 @@ t_database::t_database(int common_treshold_, int secret_treshold_, char *filenam
 	}
 	random_bytes(secret_key, 32);
 	lsss_set_secret(sss_secret, secret_key);
+	secret_aes = cw_aes_new(secret_key);
 	#ifdef DEBUG
 	debug_printf(0,(char*)"%s() nouvelle secret key=%" PRIx64 "\n", __func__, *(uint64_t*) secret_key);
 	#endif
 	
 	common_treshold = common_treshold_;
 	secret_treshold = secret_treshold_;	
+	assert((kdf_cost_ >= MPM_KDF_COST_MIN) && (kdf_cost_ <= MPM_KDF_COST_MAX));
+	assert(cw_kdf_disponible(kdf_algo_));
+	kdf.algo = kdf_algo_;
+	kdf.cout = kdf_cost_;
+	kdf.lanes = (kdf_algo_ == MPM_KDF_ARGON2ID) ? tw_nb_cpu() : 1;
+	if (kdf.lanes > MPM_KDF_LANES_MAX) kdf.lanes = MPM_KDF_LANES_MAX;
 	random_bytes(&common_magic, 8);
 	
 	changed=MPM_CHANGED_NEW;
@@ -113,12 +147,28 @@ t_database::~t_database() {
 
 	// faire de même avec les secrets
 	if (filename) free(filename);
+	clear_chunks_cache();
+	while (pending_tries) try_pending_free((t_try_pending*)pending_tries->data);
 
 	// Libération du node JSon à faire complexe json_root_node=NULL;
 	if (sss_common) lsss_free(sss_common);
 	if (sss_secret) lsss_free(sss_secret);
 
 	if (root_folder!=NULL) delete root_folder;
+	cw_aes_free(common_aes);
+	cw_aes_free(secret_aes);
+	cw_kdf_ctx_free(clairs);
+	pages_free();
+}
+
+/** 
+ *  \brief Efface les champs secrets déchiffrés par lot, et change de numéro de lot
+ *  \note les champs concernés seront déchiffrés à nouveau, un par un, par t_secret_field::get_value()
+ */
+void t_database::oublie_clairs() {
+	if ((clairs) && (clairs->arena)) memset(clairs->arena, 0, clairs->taille);
+	clairs_lot++;
+	if (clairs_lot == 0) clairs_lot = 1; // 0 désigne un champ déchiffré seul
 }
 
 /** 
@@ -213,6 +263,24 @@ char *t_database::prompt() {
 		strncat(prompt, "(noname)", CPARSER_MAX_PROMPT);
 	}
 
+	// Essais dont les calculs sont en cours
+	if (pending_tries) {
+		strncat(prompt, "[", CPARSER_MAX_PROMPT-strlen(prompt)-1);
+		for (tdllist *l=pending_tries; l!=NULL; l=l->next) {
+			t_try_pending *tp = (t_try_pending*)l->data;
+			for (int k=0; k<tp->n; k++) {
+				if ((l != pending_tries) || (k > 0)) strncat(prompt, ",", CPARSER_MAX_PROMPT-strlen(prompt)-1);
+				strncat(prompt, tp->nicknames[k], CPARSER_MAX_PROMPT-strlen(prompt)-1);
+			}
+		}
+		// garde la place pour le ']' et l'indicateur de niveau
+		if (strlen(prompt) > CPARSER_MAX_PROMPT-8) {
+			prompt[CPARSER_MAX_PROMPT-8] = 0;
+			strncat(prompt, "...", CPARSER_MAX_PROMPT-strlen(prompt)-1);
+		}
+		strncat(prompt, "]", CPARSER_MAX_PROMPT-strlen(prompt)-1);
+	}
+
 	switch (status) {
 		case MPM_LEVEL_INIT : /* Base vide pas encore initialisée */
 			strncat(prompt, "(init) ", CPARSER_MAX_PROMPT);
@@ -279,341 +347,2406 @@ int t_database::is_changed() {
 	return changed;
 }
 
+/* Projection du fichier
+ *
+ * Les essais lisent tout le fichier, puis open_common() y relit la base common. Le fichier est projeté en mémoire une
+ * seule fois, en lecture seule : les recherches de chunks travaillent directement dans la projection, et les essais
+ * suivants ne coûtent plus aucun appel système. Chaque calcul de recherche garde une référence sur la projection, 
+ * elle reste donc valide s'il se termine après que la base l'ait oubliée.
+ * Les références sont prises et rendues dans le thread de la CLI seulement (try_async(), try_finish(), save()...).
+ */
+
+/** \brief Projection en lecture seule du fichier de la base */
+typedef struct t_vue_fichier {
+	unsigned char *data;  ///< le contenu du fichier, NULL s'il est vide
+	long taille;          ///< taille du fichier
+	int refs;             ///< la base, plus chaque calcul de recherche qui lit dedans
+	bool projete;         ///< data vient de mmap()/MapViewOfFile(). Sinon, malloc()é et lu par fread(), si la projection a échoué
+	#ifdef _WIN32
+	HANDLE fichier;
+	HANDLE projection;
+	#endif
+} t_vue_fichier;
+
+/** 
+ *  \brief Projette le fichier en mémoire
+ *  \return la projection avec une référence, NULL si le fichier n'a pas pu être ouvert
+ *  \note 
+ *  - MADV_WILLNEED : la recherche de chunks va lire tout le fichier, autant lancer la lecture tout de suite
+ *  - si la projection est impossible (système de fichiers particulier...), le fichier est lu comme avant dans un malloc()
+ */
+static t_vue_fichier *vue_ouvre(const char *filename) {
+	t_vue_fichier *v = (t_vue_fichier*)calloc(1, sizeof(t_vue_fichier));
+	FILE *f;
+
+	v->refs = 1;
+	#ifdef _WIN32
+	v->fichier = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (v->fichier != INVALID_HANDLE_VALUE) {
+		LARGE_INTEGER t;
+		GetFileSizeEx(v->fichier, &t);
+		v->taille = (long)t.QuadPart;
+		if (v->taille > 0) {
+			v->projection = CreateFileMapping(v->fichier, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (v->projection != NULL) v->data = (unsigned char*)MapViewOfFile(v->projection, FILE_MAP_READ, 0, 0, 0);
+			v->projete = (v->data != NULL);
+		} else {
+			v->projete = true; // fichier vide, rien à projeter
+		}
+		if (!v->projete) {
+			if (v->projection != NULL) CloseHandle(v->projection);
+			CloseHandle(v->fichier);
+		}
+	}
+	#else
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+	if ((fd >= 0) && (fstat(fd, &st) == 0)) {
+		v->taille = (long)st.st_size;
+		if (v->taille > 0) {
+			void *p = mmap(NULL, v->taille, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED) {
+				v->data = (unsigned char*)p;
+				v->projete = true;
+				madvise(p, v->taille, MADV_WILLNEED);
+			}
+		} else {
+			v->projete = true; // fichier vide, rien à projeter
+		}
+	}
+	if (fd >= 0) close(fd); // la projection reste valide
+	#endif
+	if (v->projete) {
+		#ifdef DEBUG
+		debug_printf(0, (char*)"%s() %s projeté, %ld octets\n", __func__, filename, v->taille);
+		#endif
+		return v;
+	}
+
+	// Repli : lecture complète
+	f = fopen(filename,"r+b"); /* Note : sous Windows, ne pas oublier le '+b' */
+	if (f == NULL) {
+		fprintf(stderr, "Erreur à l'ouverture du fichier %s (%s)\n", filename, strerror(errno));
+		free(v);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	v->taille=ftell(f);
+	fseek(f, 0, SEEK_SET);
+	v->data = (unsigned char*)malloc(v->taille+1);
+	if (v->data == NULL) {
+		fprintf(stderr, "Mémoire insuffisante pour lire le fichier %s (%ld octets)\n", filename, v->taille);
+		fclose(f);
+		free(v);
+		return NULL;
+	}
+	if (fread(v->data, 1, v->taille, f) != (size_t)v->taille) {
+		fprintf(stderr, "Taille lue dans le fichier incohérente\n");
+		fclose(f);
+		free(v->data);
+		free(v);
+		return NULL;
+	}
+	fclose(f);
+	return v;
+}
+
+/** \brief Prend une référence sur la projection, pour un calcul de recherche */
+static t_vue_fichier *vue_prend(t_vue_fichier *v) {
+	v->refs++;
+	return v;
+}
+
+/** \brief Rend une référence. La projection est fermée au dernier */
+static void vue_rend(t_vue_fichier *v) {
+	if (--v->refs > 0) return;
+	if (v->projete) {
+		#ifdef _WIN32
+		if (v->data != NULL) UnmapViewOfFile(v->data);
+		if (v->projection != NULL) CloseHandle(v->projection);
+		CloseHandle(v->fichier);
+		#else
+		if (v->data != NULL) munmap(v->data, v->taille);
+		#endif
+	} else if (v->data != NULL) {
+		memset(v->data, 0, v->taille);
+		free(v->data);
+	}
+	free(v);
+}
+
+/** 
+ *  \brief Indique que la fin de la projection, à partir de debut, va être lue une seule fois dans l'ordre
+ *  \note 
+ *  - pour la lecture de la base common : le noyau lit plus loin en avance, et peut libérer les pages déjà lues
+ *  - sans effet sous Windows, où FILE_FLAG_SEQUENTIAL_SCAN a été donné à l'ouverture
+ */
+static void vue_sequentielle(t_vue_fichier *v, long debut) {
+	#ifndef _WIN32
+	long page = sysconf(_SC_PAGESIZE);
+	long d = debut - (debut % page);
+
+	if (v->projete && (v->data != NULL) && (d < v->taille)) madvise(v->data + d, v->taille - d, MADV_SEQUENTIAL);
+	#endif
+}
+
+static void scan_detache_vue(struct t_scan_holder *sc);
+
 /** 
  *  \brief Fixe ou change le nom de fichier de la base
  *  \note 
  *  - Si il était déjà fixé, le nom existant est libéré par free() et le nouveau allouée par malloc()
  */
 void t_database::set_filename(char *fn) {
+	if ((filename == NULL) || (strcmp(filename, fn) != 0)) {
+		if ((filename != NULL) && (root_folder != NULL)) root_folder->charge_tout(); // tant que l'ancien fichier est lisible
+		pages_free(); // un autre fichier sera écrit en entier
+	}
 	if (filename != NULL) free(filename);
 	filename=strdup(fn);
+	clear_chunks_cache();
 	//set_changed(MPM_CHANGED_OTHER);
 }
 
 /** 
- *  \brief Sauvegarde l'ensemble du fichier de BDD
+ *  \brief Oublie la projection du fichier, et les chunks holders repérés dedans par scan_marqueur_common()
  *  \note 
- *  - invoqué par le programme principal/user interface
- *  \todo Rendre cette fonction muette, sans printf
+ *  - invoqué quand le fichier va être réécrit ou change de nom : la projection ne correspond plus au disque
+ *  - les calculs encore en cours dans la projection sont d'abord arrêtés (voir scan_annule()) : la réécriture tronque le 
+ *    fichier, et la projection n'est plus lisible au-delà. Ce qu'ils ont déjà trouvé reste à intégrer par try_finish()
  */
- 
- 
- /*
-tty ../radar2.tty 
-dashb -output /dev/pts/3
-break -source database.cpp -function t_database::save
-dashb expr watch common_treshold
-dashb expr watch secret_treshold
-dashb expr watch common_total
-dashb expr watch secret_total
-dashb expr watch secret_tresh
-dashb expr watch common_tresh
-
- */
-#ifdef MPM_GLIB_JSON 
-void t_database::save() {
-	//GList *gl;
-	tdllist *gl;
-	FILE *file;
-	t_common_marker cm;
-	GError *gerreur;
-	
-	// Utilisé pour la génération json
-	unsigned char padding[16];
-	gchar *json_buffer; // va contenir la base JSON en clair
-	unsigned char *aes_buffer;   // le même en chiffré
-	int len_aes; // , outl, i;
-	JsonGenerator *generator;
-	gsize json_len;
-	JsonObject *json_root_object;
-	JsonArray *json_array;
-	JsonNode *json_root_node;
-
-	printf("Sauvegarde du fichier : %s - ", filename);
-
-	file = fopen(filename, "w+b");
-	if (!file) {
-		printf("Erreur à l'ouverture du fichier\n");
-		perror(NULL);
-		printf("\n");
-		return;
+void t_database::clear_chunks_cache() {
+	if (vue != NULL) {
+		for (tdllist *l = pending_tries; l != NULL; l = l->next) {
+			t_try_pending *tp = (t_try_pending*)l->data;
+			for (int s=0; s<tp->nb_scans; s++) scan_detache_vue(tp->scans[s]);
+		}
+		vue_rend(vue);
 	}
+	vue=NULL;
+	chunks_connus=false;
+}
 
-	// Enregistre les chunks de holders
-	int i = 0;
-	gl = holders;
-	while (gl) {
-		((t_holder*)gl->data)->file_index=i;
-		((t_holder*)gl->data)->save_chunk(file);
-		gl=gl->next; i++;
-	}
-		
-	// Enregistre le marqueur pour la partie common/json
-	random_bytes((void*)cm.salt, 32);
-	//cw_database_save_cm(cm.salt, common_magic, cm.hash);
-	cw_sha256_mix2(cm.hash, cm.salt, common_magic);
-	fwrite(&cm, sizeof(cm), 1, file);
-	
-	
-	// Génére la BDD en json
-	generator = json_generator_new ();
-	json_root_object = json_object_new();
-	
-	json_object_set_member (json_root_object, "common_treshold", json_node_init_int (json_node_alloc (), common_treshold));
-	json_object_set_member (json_root_object, "secret_treshold", json_node_init_int (json_node_alloc (), secret_treshold));
-	json_object_set_member (json_root_object, "next_id_holder", json_node_init_int (json_node_alloc (), next_id_holder));
+/** 
+ *  \brief Renvoie la projection du fichier, en l'ouvrant si besoin
+ *  \return la projection, NULL si le fichier n'a pas pu être ouvert
+ *  \note 
+ *  - un seul open()/mmap() pour tous les essais et la lecture de la base common, jusqu'à la réécriture du fichier
+ */
+t_vue_fichier *t_database::vue_fichier() {
+	if (vue == NULL) vue = vue_ouvre(filename);
+	return vue;
+}
 
-	// Charge les holders
-	json_array = json_array_new();
-	gl = holders;
-	while (gl) {
-		json_array_add_element(json_array, ((t_holder*)gl->data)->save_common());
-		gl=gl->next;
+/** 
+ *  \brief Emplacement préféré d'une holder dans la table des chunks holders
+ *  \param[in] salt        Le sel de la table, voir t_slots_anchor
+ *  \param[in] nickname    Le nickname de la holder
+ *  \param[in] log2_slots  Le log2 de la taille de la table
+ *  \return l'emplacement, entre 0 et 2^log2_slots-1. Le bloc correspondant dans le fichier est 1+emplacement
+ */
+static int slot_prefere(unsigned char *salt, char *nickname, int log2_slots) {
+	unsigned char h[32];
+	cw_sha256_mix1(h, nickname, salt, (char*)"slot");
+	return (int)((*(uint32_t*)h) & ((1u << log2_slots) - 1));
+}
+
+/** 
+ *  \brief Ecrit le bloc t_slots_anchor puis la table d'emplacements des chunks holders
+ *  \param[in] file  Le fichier, positionné au début
+ *  \return le nombre de blocs écrits, c'est à dire la position du marqueur common
+ *  \note
+ *  - invoqué par t_database::save(), fixe le file_index de chaque holder
+ *  - la taille de la table est la plus petite puissance de 2 qui contienne toutes les holders, sans descendre sous
+ *    2^MPM_SLOTS_MIN_LOG2, et on tire des sels jusqu'à ce que chaque holder ait un emplacement préféré différent : un try
+ *    ne calcule alors qu'une seule KDF quand le MdP est bon
+ *  - au delà de MPM_SLOTS_ESSAIS sels, la table est doublée. Si on atteint MPM_SLOTS_MAX_LOG2, les collisions sont
+ *    résolues en prenant l'emplacement libre suivant : ces holders seront trouvées par la recherche complète
+ */
+int t_database::save_chunks_holders(FILE *file) {
+	t_slots_anchor anchor;
+	t_holder **table;
+	tdllist *gl;
+	int n, log2_slots, nb_slots, s, essai;
+	bool place = false;
+
+	n = 0;
+	for (gl = holders; gl != NULL; gl = gl->next) n++;
+	log2_slots = MPM_SLOTS_MIN_LOG2;
+	while ((1 << log2_slots) < n) log2_slots++;
+	assert(sizeof(t_slots_anchor) == CHUNK_HOLDER_SIZE);
+	random_bytes(&anchor, sizeof(anchor));
+	table = (t_holder**)calloc((size_t)1 << MPM_SLOTS_MAX_LOG2, sizeof(t_holder*));
+
+	while (!place) {
+		nb_slots = 1 << log2_slots;
+		for (essai=0; (essai < MPM_SLOTS_ESSAIS) && !place; essai++) {
+			random_bytes(anchor.salt, 32);
+			memset(table, 0, nb_slots*sizeof(t_holder*));
+			place = true;
+			for (gl = holders; gl != NULL; gl = gl->next) {
+				s = slot_prefere(anchor.salt, ((t_holder*)gl->data)->nickname, log2_slots);
+				if (table[s] != NULL) {
+					place = false;
+					break;
+				}
+				table[s] = (t_holder*)gl->data;
+			}
+		}
+		if (!place && (log2_slots == MPM_SLOTS_MAX_LOG2)) {
+			// Placement avec collisions, sur le dernier sel tiré
+			memset(table, 0, nb_slots*sizeof(t_holder*));
+			for (gl = holders; gl != NULL; gl = gl->next) {
+				s = slot_prefere(anchor.salt, ((t_holder*)gl->data)->nickname, log2_slots);
+				while (table[s] != NULL) s = (s+1) & (nb_slots-1);
+				table[s] = (t_holder*)gl->data;
+			}
+			place = true;
+		} else if (!place) {
+			log2_slots++;
+		}
 	}
-	json_object_set_member (json_root_object, "holders", json_node_init_array (json_node_alloc (), json_array));
-	
+	#ifdef DEBUG
+	debug_printf(0, (char*)"%s() %d holders dans %d emplacements, %d essais\n", __func__, n, nb_slots, essai);
+	#endif
 
-	// Raccroche les branches de dossiers et secrets
-	if (root_folder) {
-		json_object_set_member (json_root_object, "root_folder", root_folder->save());
+	anchor.log2_slots = (anchor.log2_slots & 0xe0) | log2_slots;
+	anchor.kdf_cost = (anchor.kdf_cost & 0xe0) | kdf.cout;
+	anchor.kdf_algo = (anchor.kdf_algo & 0xfc) | kdf.algo;
+	anchor.kdf_lanes = (anchor.kdf_lanes & 0xe0) | kdf.lanes;
+	fwrite(&anchor, sizeof(anchor), 1, file);
+	for (s=0; s<nb_slots; s++) {
+		if (table[s] != NULL) {
+			table[s]->file_index = 1+s;
+			table[s]->save_chunk(file);
+		} else {
+			unsigned char leurre[CHUNK_HOLDER_SIZE];
+			random_bytes(leurre, CHUNK_HOLDER_SIZE);
+			fwrite(leurre, CHUNK_HOLDER_SIZE, 1, file);
+		}
 	}
+	free(table);
+	return 1+nb_slots;
+}
 
+/* Base common MPM_COMMON_PAGES
+ *
+ * Après le marqueur, la base common est une suite de pages de MPM_PAGE octets, chiffrées chacune en AES256-GCM avec un
+ * nonce aléatoire écrit en tête de page, et suivies de leur tag. Les données authentifiées sont le marqueur, le numéro
+ * de la page et la sauvegarde qui l'a écrite (t_page_aad) : une page ne peut être ni déplacée, ni reprise d'un autre
+ * fichier, ni remplacée par une version précédente.
+ *  - page 0 : l'entête (t_pages_entete), réécrite en place. Elle désigne les pages du répertoire
+ *  - le répertoire : le json des paramètres et des holders, et pour chaque dossier son titre et ses groupes de pages
+ *  - les groupes : les items consécutifs d'un dossier, à raison d'environ une page par groupe. Chaque item est dans son
+ *    encodage binaire (t_secret_item::save_binaire()), à la suite du précédent
+ * Une sauvegarde incrémentale ne réécrit que les groupes modifiés (voir t_secret_item::set_changed()) et le répertoire,
+ * toujours dans des pages libres : tant que l'entête n'est pas réécrite, le fichier reste celui de la sauvegarde
+ * précédente. Les pages qui ne servent plus sont ensuite effacées. Une nouvelle base, un changement de holders ou de
+ * fichier donnent une sauvegarde complète, avec de nouveaux chunks holders et un nouveau marqueur.
+ * Entre deux sauvegardes, les modifications des secrets sont ajoutées au journal qui suit la dernière page, voir
+ * t_database::journalise().
+ * En MPM_COMMON_PAGES_Z, le clair du répertoire et de chaque groupe est compressé par zlib avant d'être réparti dans les
+ * pages : les tailles de l'entête et du répertoire sont alors celles du flux compressé. Un groupe peut contenir plus
+ * d'items, pour que son flux occupe encore à peu près une page. Le journal n'est pas compressé.
+ */
 
-	// Raccroche au générateur, et génère
-	json_root_node = json_node_init_object (json_node_new(JSON_NODE_OBJECT), json_root_object);
-	json_generator_set_root (generator, json_root_node);
-	json_buffer = json_generator_to_data (generator, &json_len);
-	
-	json_generator_set_pretty (generator, TRUE); // Pour debug uniquement
-	json_generator_set_indent (generator, 4);	 // Pour debug uniquement
-	json_generator_to_file (generator, "mpm.debug.json", &(gerreur=NULL)); // Pour debug uniquement
-	if (gerreur) {
-		fprintf(stderr, "runtime error %s %s %d glib : %s\n", __func__, __FILE__, __LINE__, gerreur->message); 
+#define MPM_PAGES_MAGIC "MPMPAGE2" /**< entête d'une base MPM_COMMON_PAGES */
+#define MPM_PAGES_REPERTOIRE_MAX ((MPM_PAGE_CLAIR-24)/sizeof(t_page_ref)) /**< pages du répertoire au plus, soit 2 Mo de json, compressé ou non */
+#ifdef MPM_ZLIB
+#define MPM_GROUPE_CLAIR (3*MPM_PAGE_CLAIR) /**< clair d'un groupe au plus, sauf item plus grand. Compressé, il tient à peu près dans une page */
+#else
+#define MPM_GROUPE_CLAIR MPM_PAGE_CLAIR /**< clair d'un groupe au plus, sauf item plus grand */
+#endif
+
+/** \brief Clair de la page 0 d'une base MPM_COMMON_PAGES */
+typedef struct t_pages_entete {
+	char magic[8];                                      ///< MPM_PAGES_MAGIC
+	uint32_t generation;                                ///< numéro de la sauvegarde
+	uint32_t nb_pages;                                  ///< pages de la base, entête comprise
+	uint32_t taille_repertoire;                         ///< longueur du json du répertoire
+	uint32_t nb_repertoire;                             ///< pages du répertoire
+	t_page_ref repertoire[MPM_PAGES_REPERTOIRE_MAX];
+} t_pages_entete;
+
+/** \brief Données authentifiées d'une page */
+typedef struct t_page_aad {
+	t_common_marker cm;
+	uint32_t index;
+	uint32_t generation;  ///< 0 pour l'entête
+} t_page_aad;
+
+/** \brief État des pages du fichier, gardé d'une sauvegarde à l'autre. Voir t_database::pages */
+typedef struct t_pages {
+	t_common_marker cm;        ///< le marqueur, authentifié avec chaque page
+	uint32_t generation;       ///< numéro de la dernière sauvegarde
+	uint32_t nb;               ///< pages dans le fichier
+	unsigned char *utilisee;   ///< 1 pour chaque page référencée par l'entête, capacite cases
+	uint32_t capacite;
+	long journal;              ///< octets du journal, qui suit la dernière page
+	uint32_t sequence;         ///< enregistrements dans le journal
+	unsigned char chaine[16];  ///< tag du dernier enregistrement du journal, authentifié avec le suivant
+	struct t_journal_note *notes; ///< items, dossiers et holders modifiés depuis le dernier enregistrement, voir journal_note()
+	int nb_notes, max_notes;
+	struct t_journal_holder *chunks_rejoues; ///< dernier chunk de chaque holder dans le journal, voir journal_applique_holder()
+	int nb_chunks_rejoues;
+} t_pages;
+
+/** \brief Tampon de clair (le json du répertoire, un groupe ou un item en binaire), ou d'enregistrements du journal */
+typedef struct t_tampon_json {
+	unsigned char *data;
+	size_t len;
+	size_t alloue;
+} t_tampon_json;
+
+/** \brief Lot de pages chiffrées ou déchiffrées ensemble, sur plusieurs threads, par pages_lot_traite() */
+typedef struct t_lot_pages {
+	unsigned char *data;                  ///< nb_max pages de MPM_PAGE octets : nonce, clair ou chiffré, tag
+	t_page_ref *refs;                     ///< référence de chaque page, authentifiée avec elle
+	bool *ok;                             ///< page présente dans le fichier, puis tag vérifié
+	int nb;                               ///< pages présentes dans le lot
+	int nb_max;                           ///< capacité du lot en pages
+	int nb_threads;                       ///< threads au plus pour un lot plein
+	int enc;                              ///< 0=déchiffre, 1=chiffre
+	const t_common_marker *cm;            ///< le marqueur, authentifié avec chaque page
+	const unsigned char *key;             ///< common_key, pour préparer la clé des threads supplémentaires
+	t_cw_aes *aes_base;                   ///< common_aes, utilisée par un des threads
+	t_cw_aes *aes[TW_MAX_THREADS];        ///< clés préparées libres, gardées d'un lot à l'autre
+	int nb_aes;
+	int prochain;                         ///< prochaine page à traiter
+	tw_mutex mutex;
+} t_lot_pages;
+
+/** \brief Sauvegarde en cours d'une base MPM_COMMON_PAGES. Voir t_database::save() */
+typedef struct t_save_pages {
+	FILE *file;
+	long base;                      ///< position de la page 0 dans le fichier
+	t_pages *pg;                    ///< état des pages, utilisee étant reconstruit par cette sauvegarde
+	unsigned char *ancienne;        ///< pages référencées par la sauvegarde précédente : à ne pas écraser avant l'entête
+	uint32_t nb_ancienne;
+	uint32_t debut_journal;         ///< pages occupées par le journal, lui aussi à garder jusqu'à l'entête
+	uint32_t fin_journal;
+	uint32_t libre;                 ///< pas de page libre avant celle-ci
+	t_cw_aes *aes;                  ///< common_aes
+	t_lot_pages lot;                ///< pages en attente d'être chiffrées et écrites
+	t_tampon_json groupe;           ///< groupe en cours, puis json du répertoire
+	t_tampon_json item;             ///< encodage binaire d'un item
+	t_tampon_json travail;          ///< MPM_ZLIB : flux compressé du groupe ou du répertoire
+	t_groupe_pages ***attente;      ///< t_secret_item::groupe de chaque item du groupe en cours
+	int nb_attente, max_attente;
+	int nb_ecrites;                 ///< pages écrites, pour le compte rendu
+} t_save_pages;
+
+/** \brief Lecture en cours d'une base MPM_COMMON_PAGES. Voir t_database::read_common_pages() */
+typedef struct t_lit_pages {
+	const unsigned char *base;      ///< page 0, dans la projection du fichier
+	uint32_t nb_dispo;              ///< pages présentes dans le fichier
+	t_pages *pg;                    ///< état des pages, reconstitué au fil de la lecture
+	t_cw_aes *aes;                  ///< common_aes
+	t_lot_pages lot;                ///< pages déchiffrées ensemble : le répertoire, ou plusieurs groupes d'un dossier
+	t_tampon_json clair;            ///< clair du répertoire ou d'un groupe
+	bool comprime;                  ///< MPM_COMMON_PAGES_Z : le clair des pages est à décompresser
+	t_tampon_json travail;          ///< clair décompressé
+} t_lit_pages;
+
+/** \brief Agrandit si besoin le tampon à au moins alloue octets. L'ancienne zone, qui contient du clair, est effacée */
+static void tampon_reserve(t_tampon_json *t, size_t alloue) {
+	if (alloue > t->alloue) {
+		size_t n = t->alloue ? t->alloue : MPM_PAGE_CLAIR;
+		while (alloue > n) n *= 2;
+		unsigned char *plus = (unsigned char*)malloc(n);
+		if (t->data) {
+			memcpy(plus, t->data, t->len);
+			memset(t->data, 0, t->alloue);
+			free(t->data);
+		}
+		t->data = plus;
+		t->alloue = n;
 	}
-	json_node_unref(json_root_node); // supposé tout librer récursivement par le jeu de ref/unref
-	g_object_unref ((gpointer) generator);
+}
+
+/** \brief Ajoute des octets au tampon, agrandi si besoin */
+static void tampon_ajoute(t_tampon_json *t, const void *data, size_t len) {
+	tampon_reserve(t, t->len + len);
+	memcpy(t->data + t->len, data, len);
+	t->len += len;
+}
 
+/** \brief Vide le tampon, en effaçant le clair */
+static void tampon_vide(t_tampon_json *t) {
+	if (t->data) memset(t->data, 0, t->len);
+	t->len = 0;
+}
 
-	// Chiffrement
-	aes_buffer = (unsigned char*)malloc(json_len+64); // normalement 31 devrait suffire, padding de 16 + arrondi dernier bloc AES de 15
-	//memset(aes_buffer, 0, json_len+64); tenté pour supprimé une alerte valgrind de mémoire non initialisée
-	memcpy(aes_buffer, json_buffer, json_len);
-	*(aes_buffer+json_len)=0; // Ajoute un /0 pour le décodage
-	memcpy(aes_buffer+json_len+1, "MAGICCOM", 8); // pour le test d'intégrité de la partie common/json
-	len_aes=(json_len+24)&0xfffffffffffffff0;	
-	cw_aes_cbc(aes_buffer, len_aes, common_key, (unsigned char*)&cm, 1);
+static void tampon_free(t_tampon_json *t) {
+	if (t->data) {
+		memset(t->data, 0, t->alloue);
+		free(t->data);
+	}
+	memset(t, 0, sizeof(t_tampon_json));
+}
 
-	// Ecrit le fichier
-	fwrite(aes_buffer, len_aes, 1, file);
-	fflush(file);
-	g_free(json_buffer);
-	free(aes_buffer);
+#ifdef MPM_ZLIB
+#define MPM_ZLIB_ENTETE 16 /**< devant chaque allocation de zlib, sa taille : l'alignement de malloc() est conservé */
 
-	// ecrit 0 à 15 octets aléatoires en plus, pour qu'on ne voit pas la longueur multiple de 16
-	random_bytes(padding, 16);
-	fwrite(padding, (int)(padding[15]&0xf), 1, file); // le dernier char n'est jamais écrit dans le fichier, mais il sert à déterminer la longueur
-	fflush(file);
+/** \brief Allocation pour zlib, qui y garde du clair. Voir zlib_libere() */
+static voidpf zlib_alloue(voidpf opaque, uInt items, uInt size) {
+	size_t n = (size_t)items * size;
+	unsigned char *p = (unsigned char*)malloc(n + MPM_ZLIB_ENTETE);
 
-	fclose(file); 
-	changed=0;
-	printf("Fait\n\n");
-	
+	if (p == NULL) return Z_NULL;
+	memcpy(p, &n, sizeof(n));
+	return (voidpf)(p + MPM_ZLIB_ENTETE);
 }
-#endif /* GLIB_JSON */
 
-#ifdef  MPM_JANSSON
-void t_database::save() {
-	tdllist *gl;
-	FILE *file;
-	t_common_marker cm;
-	
-	unsigned char padding[16];
-	unsigned char *aes_buffer;   // le même en chiffré
-	int len_aes; // , outl, i;
+/** \brief Libération pour zlib, en effaçant la zone : fenêtres et tables contiennent du json en clair */
+static void zlib_libere(voidpf opaque, voidpf adresse) {
+	unsigned char *p = (unsigned char*)adresse - MPM_ZLIB_ENTETE;
+	size_t n;
 
-	printf("Sauvegarde du fichier : %s - ", filename);
+	memcpy(&n, p, sizeof(n));
+	memset(p, 0, n + MPM_ZLIB_ENTETE);
+	free(p);
+}
 
-	file = fopen(filename, "w+b");
-	if (!file) {
-		printf("Erreur à l'ouverture du fichier\n");
-		perror(NULL);
-		printf("\n");
-		return;
-	}
+/** \brief Échange le contenu de deux tampons */
+static void tampon_echange(t_tampon_json *a, t_tampon_json *b) {
+	t_tampon_json t = *a;
+	*a = *b;
+	*b = t;
+}
 
-	// Enregistre les chunks de holders
-	int i = 0;
-	gl = holders;
-	while (gl) {
-		((t_holder*)gl->data)->file_index=i;
-		((t_holder*)gl->data)->save_chunk(file);
-		gl=gl->next; i++;
-	}
-		
-	// Enregistre le marqueur pour la partie common/json
-	random_bytes((void*)cm.salt, 32);
-	cw_sha256_mix2(cm.hash, cm.salt, common_magic);
-	fwrite(&cm, sizeof(cm), 1, file);
-	fflush(file);
-	
-	// Génére la BDD en json et ajoute les paramètres scalaires
-	json_t *js_root = json_object();
-	if (-1 == json_object_set(js_root, "common_treshold",   json_integer(common_treshold))) {
-		#ifdef DEBUG
-		debug_printf(0, (char*)"%s() %s:%d runtime sur jansson\n", __func__, __FILE__, __LINE__);
-		#endif
+/**
+ *  \brief Compresse le contenu du tampon
+ *  \param[in,out] travail  Tampon de travail, qui reçoit le flux et l'échange avec t. Le clair y est ensuite effacé
+ */
+static void tampon_comprime(t_tampon_json *t, t_tampon_json *travail) {
+	z_stream z;
+
+	memset(&z, 0, sizeof(z));
+	z.zalloc = zlib_alloue;
+	z.zfree = zlib_libere;
+	if (deflateInit(&z, Z_DEFAULT_COMPRESSION) != Z_OK) {
+		fprintf(stderr, "%s() deflateInit() en échec\n", __func__);
+		abort();
 	}
-	if (-1 == json_object_set(js_root, "secret_treshold",   json_integer(secret_treshold))) {
-		#ifdef DEBUG
-		debug_printf(0, (char*)"%s() %s:%d runtime sur jansson\n", __func__, __FILE__, __LINE__);
-		#endif
+	tampon_vide(travail);
+	tampon_reserve(travail, deflateBound(&z, (uLong)t->len));
+	z.next_in = t->data;
+	z.avail_in = (uInt)t->len;
+	z.next_out = travail->data;
+	z.avail_out = (uInt)travail->alloue;
+	if (deflate(&z, Z_FINISH) != Z_STREAM_END) {
+		fprintf(stderr, "%s() deflate() incomplet\n", __func__);
+		abort();
 	}
-	if (-1 == json_object_set(js_root, "next_id_holder",   json_integer(next_id_holder))) {
-		#ifdef DEBUG
-		debug_printf(0, (char*)"%s() %s:%d runtime sur jansson\n", __func__, __FILE__, __LINE__);
-		#endif
+	travail->len = z.total_out;
+	deflateEnd(&z);
+	tampon_echange(t, travail);
+	tampon_vide(travail);
+}
+
+/**
+ *  \brief Décompresse le contenu du tampon
+ *  \param[in,out] travail  Tampon de travail, qui reçoit le json et l'échange avec t
+ *  \return false si le flux est incomplet ou invalide. Il a été authentifié : c'est alors une erreur d'écriture
+ */
+static bool tampon_decomprime(t_tampon_json *t, t_tampon_json *travail) {
+	z_stream z;
+	int r = Z_OK;
+
+	memset(&z, 0, sizeof(z));
+	z.zalloc = zlib_alloue;
+	z.zfree = zlib_libere;
+	if (inflateInit(&z) != Z_OK) return false;
+	tampon_vide(travail);
+	z.next_in = t->data;
+	z.avail_in = (uInt)t->len;
+	while (r == Z_OK) {
+		tampon_reserve(travail, travail->len + 4*t->len + MPM_PAGE_CLAIR);
+		z.next_out = travail->data + travail->len;
+		z.avail_out = (uInt)(travail->alloue - travail->len);
+		r = inflate(&z, Z_NO_FLUSH);
+		travail->len = travail->alloue - z.avail_out;
 	}
-	
-	// Charge les holders
-	json_t *jsha = json_array();
-	gl = holders;
-	while (gl) {
-		if (-1 == json_array_append(jsha, ((t_holder*)gl->data)->save_common()  )) {
-			#ifdef DEBUG
-			debug_printf(0, (char*)"%s() %s:%d runtime sur jansson\n", __func__, __FILE__, __LINE__);
-			#endif	
-		}
-		gl=gl->next;
+	inflateEnd(&z);
+	if ((r != Z_STREAM_END) || (z.avail_in != 0)) return false;
+	tampon_echange(t, travail);
+	tampon_vide(travail);
+	return true;
+}
+#endif
+
+#ifdef MPM_JANSSON
+/** \brief Callback de json_dump_callback() */
+static int tampon_jansson(const char *buffer, size_t size, void *data) {
+	tampon_ajoute((t_tampon_json*)data, buffer, size);
+	return 0;
+}
+#endif
+
+/** \brief Callback de t_secret_item::save_binaire() */
+static void tampon_binaire(const void *data, size_t len, void *contexte) {
+	tampon_ajoute((t_tampon_json*)contexte, data, len);
+}
+
+/** \brief Ajoute au tampon l'encodage binaire d'un item */
+static void tampon_item(t_tampon_json *t, t_secret_item *s) {
+	s->save_binaire(tampon_binaire, t);
+}
+
+/** \brief Note qu'une page est utilisée, et agrandit au besoin la table et le nombre de pages du fichier */
+static void pages_marque(t_pages *pg, uint32_t index) {
+	if (index >= pg->capacite) {
+		uint32_t capacite = pg->capacite ? pg->capacite : 64;
+		while (index >= capacite) capacite *= 2;
+		pg->utilisee = (unsigned char*)realloc(pg->utilisee, capacite);
+		memset(pg->utilisee + pg->capacite, 0, capacite - pg->capacite);
+		pg->capacite = capacite;
 	}
-	json_object_set(js_root, "holders", jsha); 
+	pg->utilisee[index] = 1;
+	if (index >= pg->nb) pg->nb = index + 1;
+}
 
-	// Raccroche les branches de dossiers et secrets
-	if (root_folder) {
-		json_object_set(js_root, "root_folder", root_folder->save());
+/**
+ *  \brief Chiffre ou déchiffre une page en place
+ *  \param[in,out] page  MPM_PAGE octets : le nonce, le clair ou le chiffré en page+12, puis le tag
+ *  \return false si le tag n'est pas vérifié (déchiffrement seulement)
+ */
+static bool page_gcm(unsigned char *page, const t_common_marker *cm, t_cw_aes *aes, t_page_ref ref, int enc) {
+	t_page_aad aad;
+
+	memset(&aad, 0, sizeof(aad));
+	aad.cm = *cm;
+	aad.index = ref.index;
+	aad.generation = ref.generation;
+	return cw_aes_gcm(aes, page+12, MPM_PAGE_CLAIR, page, (unsigned char*)&aad, sizeof(aad), page+12+MPM_PAGE_CLAIR, enc) != 0;
+}
+
+/**
+ *  \brief Chiffre une page
+ *  \param[in,out] page  MPM_PAGE octets, le clair en page+12. Le nonce et le tag sont ajoutés autour
+ */
+static void page_chiffre(unsigned char *page, const t_common_marker *cm, t_cw_aes *aes, t_page_ref ref) {
+	random_bytes(page, 12);
+	page_gcm(page, cm, aes, ref, 1);
+}
+
+/**
+ *  \brief Déchiffre une page de la projection
+ *  \param[out] clair  MPM_PAGE_CLAIR octets
+ *  \return false si le tag n'est pas vérifié : page modifiée, déplacée, ou d'une autre sauvegarde
+ */
+static bool page_dechiffre(unsigned char *clair, const unsigned char *page, const t_common_marker *cm, t_cw_aes *aes, t_page_ref ref) {
+	t_page_aad aad;
+	unsigned char tag[16];
+
+	memset(&aad, 0, sizeof(aad));
+	aad.cm = *cm;
+	aad.index = ref.index;
+	aad.generation = ref.generation;
+	memcpy(clair, page+12, MPM_PAGE_CLAIR); // la projection est en lecture seule
+	memcpy(tag, page+12+MPM_PAGE_CLAIR, 16);
+	return cw_aes_gcm(aes, clair, MPM_PAGE_CLAIR, page, (unsigned char*)&aad, sizeof(aad), tag, 0);
+}
+
+/** \brief Donne au lot une capacité de nb_max pages. Les pages déjà dans le lot sont conservées */
+static void pages_lot_reserve(t_lot_pages *lot, int nb_max) {
+	unsigned char *data = (unsigned char*)malloc((size_t)nb_max * MPM_PAGE);
+
+	lot->refs = (t_page_ref*)realloc(lot->refs, nb_max * sizeof(t_page_ref));
+	lot->ok = (bool*)realloc(lot->ok, nb_max * sizeof(bool));
+	if ((data == NULL) || (lot->refs == NULL) || (lot->ok == NULL)) {
+		fprintf(stderr, "%s() lot de %d pages non alloué\n", __func__, nb_max);
+		abort();
 	}
+	if (lot->data) {
+		memcpy(data, lot->data, (size_t)lot->nb * MPM_PAGE);
+		memset(lot->data, 0, (size_t)lot->nb * MPM_PAGE);
+		free(lot->data);
+	}
+	lot->data = data;
+	lot->nb_max = nb_max;
+}
 
-	// Raccroche au générateur, et génère
-	char *json_buffer = json_dumps(js_root, JSON_INDENT(4) ); // Génère le flux json
-	if (json_buffer == NULL) {
-		#ifdef DEBUG
-		debug_printf(0, (char*)"%s() %s:%d runtime sur jansson\n", __func__, __FILE__, __LINE__);
-		#endif			
-	} 
-	json_decref(js_root); // supprime l'arbre Jansson en mémoire
-	
-	int json_len = strlen(json_buffer);
-	#ifdef DEBUG
-	{
-		FILE *f=fopen("mpm.debug.json","w+b");
-		fwrite(json_buffer, json_len, 1, f);
-		fclose(f);
+/**
+ *  \brief Prépare un lot de pages
+ *  \note
+ *  - assez de pages pour MPM_PAGES_THREAD par thread, sans dépasser MPM_PAGES_THREADS_MAX threads
+ */
+static void pages_lot_init(t_lot_pages *lot, const t_common_marker *cm, const unsigned char *key, t_cw_aes *aes, int enc) {
+	memset(lot, 0, sizeof(t_lot_pages));
+	lot->nb_threads = tw_nb_cpu();
+	if (lot->nb_threads > MPM_PAGES_THREADS_MAX) lot->nb_threads = MPM_PAGES_THREADS_MAX;
+	pages_lot_reserve(lot, lot->nb_threads * MPM_PAGES_THREAD);
+	lot->cm = cm;
+	lot->key = key;
+	lot->aes_base = aes;
+	lot->aes[lot->nb_aes++] = aes;
+	lot->enc = enc;
+	tw_mutex_init(&lot->mutex);
+}
+
+/** \brief Vide le lot, en effaçant le clair qu'il contient */
+static void pages_lot_vide(t_lot_pages *lot) {
+	memset(lot->data, 0, (size_t)lot->nb * MPM_PAGE);
+	lot->nb = 0;
+}
+
+/** \brief Efface et libère le lot, et les clés préparées pour les threads */
+static void pages_lot_free(t_lot_pages *lot) {
+	pages_lot_vide(lot);
+	free(lot->data);
+	free(lot->refs);
+	free(lot->ok);
+	for (int a=0; a<lot->nb_aes; a++) if (lot->aes[a] != lot->aes_base) cw_aes_free(lot->aes[a]);
+	tw_mutex_destroy(&lot->mutex);
+	memset(lot, 0, sizeof(t_lot_pages));
+}
+
+/**
+ *  \brief Ajoute une page au lot, agrandi si besoin
+ *  \return la page, de MPM_PAGE octets, à remplir par l'appelant
+ *  \note
+ *  - en sauvegarde, le lot est écrit avant d'être plein (voir pages_ecrit()). En lecture, il peut dépasser sa capacité
+ *    initiale pour contenir un groupe de plus de pages
+ */
+static unsigned char *pages_lot_ajoute(t_lot_pages *lot, t_page_ref ref) {
+	if (lot->nb == lot->nb_max) pages_lot_reserve(lot, 2*lot->nb_max);
+	lot->refs[lot->nb] = ref;
+	lot->ok[lot->nb] = true;
+	return lot->data + (size_t)(lot->nb++) * MPM_PAGE;
+}
+
+/** \brief Travail d'un thread de pages_lot_traite() : chaque thread prend la page suivante, avec sa propre clé préparée */
+static void pages_lot_thread(void *arg) {
+	t_lot_pages *lot = (t_lot_pages*)arg;
+	t_cw_aes *aes = NULL;
+	int k;
+
+	tw_mutex_lock(&lot->mutex);
+	if (lot->nb_aes > 0) aes = lot->aes[--lot->nb_aes];
+	tw_mutex_unlock(&lot->mutex);
+	if (aes == NULL) aes = cw_aes_new(lot->key);
+
+	while (true) {
+		tw_mutex_lock(&lot->mutex);
+		k = lot->prochain++;
+		tw_mutex_unlock(&lot->mutex);
+		if (k >= lot->nb) break;
+		if (lot->ok[k]) lot->ok[k] = page_gcm(lot->data + (size_t)k*MPM_PAGE, lot->cm, aes, lot->refs[k], lot->enc);
 	}
-	#endif
-	
-	
-	// Chiffrement
-	aes_buffer = (unsigned char*)malloc(json_len+64); // normalement 31 devrait suffire, padding de 16 + arrondi dernier bloc AES de 15
-	memcpy(aes_buffer, json_buffer, json_len);
-	*(aes_buffer+json_len)=0; // Ajoute un /0 pour le décodage
-	memcpy(aes_buffer+json_len+1, "MAGICCOM", 8); // pour le test d'intégrité de la partie common/json
-	len_aes=(json_len+24)&0xfffffffffffffff0;	
-	cw_aes_cbc(aes_buffer, len_aes, common_key, (unsigned char*)&cm, 1);
-
-	// Ecrit le fichier
-	fwrite(aes_buffer, len_aes, 1, file);
-	fflush(file);
-	free(json_buffer);
-	free(aes_buffer);
-	
 
-	// ecrit 0 à 15 octets aléatoires en plus, pour qu'on ne voit pas la longueur multiple de 16
-	random_bytes(padding, 16);
-	fwrite(padding, (int)(padding[15]&0xf), 1, file); // le dernier char n'est jamais écrit dans le fichier, mais il sert à déterminer la longueur
-	fflush(file);
-	fclose(file); 
-	changed=0;
-	printf("Fait\n\n");
+	tw_mutex_lock(&lot->mutex);
+	lot->aes[lot->nb_aes++] = aes;
+	tw_mutex_unlock(&lot->mutex);
 }
-#endif /* JANSSON */
 
+/**
+ *  \brief Chiffre ou déchiffre en place les pages du lot
+ *  \note
+ *  - en chiffrement, les nonces sont déjà tirés par l'appelant : random_bytes() n'est appelé que depuis un seul thread
+ *  - un thread par MPM_PAGES_THREAD pages : le répertoire ou un petit dossier restent sur le thread appelant
+ */
+static void pages_lot_traite(t_lot_pages *lot) {
+	int nb_threads = (lot->nb + MPM_PAGES_THREAD - 1) / MPM_PAGES_THREAD;
 
-/** 
- *  \brief Recherche un chunk de holder dans le fichier étant donnée un nickname et MdP
- *  \return pointeur sur un bloc nouvellement malloc()é pour contenir le chunk déchiffré, ou NULL si raté
- *  \param[in]   nickname    Le nickname utilisé en entrée pour la crypto
- *  \param[in]   password    Le password qu'on utilise avec dans le test crypto
+	if (nb_threads > lot->nb_threads) nb_threads = lot->nb_threads;
+	lot->prochain = 0;
+	if (nb_threads > 0) tw_parallel(nb_threads, pages_lot_thread, lot);
+}
+
+/** \brief Prochaine page libre : ni utilisée par cette sauvegarde, ni par la précédente */
+static uint32_t pages_alloue(t_save_pages *sp) {
+	uint32_t i = sp->libre;
+
+	while (((i < sp->pg->capacite) && sp->pg->utilisee[i]) || ((i < sp->nb_ancienne) && sp->ancienne[i])
+	    || ((i >= sp->debut_journal) && (i < sp->fin_journal))) i++;
+	sp->libre = i+1;
+	pages_marque(sp->pg, i);
+	return i;
+}
+
+/** \brief Chiffre les pages en attente et les écrit, à la place qui leur a été allouée */
+static void pages_lot_ecrit(t_save_pages *sp) {
+	t_lot_pages *lot = &sp->lot;
+
+	pages_lot_traite(lot);
+	for (int k=0; k<lot->nb; k++) {
+		fseek(sp->file, sp->base + (long)lot->refs[k].index*MPM_PAGE, SEEK_SET);
+		fwrite(lot->data + (size_t)k*MPM_PAGE, MPM_PAGE, 1, sp->file);
+		sp->nb_ecrites++;
+	}
+	pages_lot_vide(lot);
+}
+
+/**
+ *  \brief Écrit du clair dans des pages libres
+ *  \param[out] refs  (len+MPM_PAGE_CLAIR-1)/MPM_PAGE_CLAIR références, pour le répertoire ou l'entête
+ *  \note
+ *  - les pages sont allouées tout de suite, mais chiffrées et écrites par lots (voir pages_lot_ecrit()). Le dernier lot
+ *    est écrit par t_database::save() avant l'entête
+ */
+static void pages_ecrit(t_save_pages *sp, const unsigned char *data, size_t len, t_page_ref *refs) {
+	unsigned char *page;
+	size_t n;
+
+	for (int k=0; (size_t)k*MPM_PAGE_CLAIR < len; k++) {
+		n = len - (size_t)k*MPM_PAGE_CLAIR;
+		if (n > MPM_PAGE_CLAIR) n = MPM_PAGE_CLAIR;
+		refs[k].index = pages_alloue(sp);
+		refs[k].generation = sp->pg->generation;
+		if (sp->lot.nb == sp->lot.nb_max) pages_lot_ecrit(sp);
+		page = pages_lot_ajoute(&sp->lot, refs[k]);
+		random_bytes(page, 12);
+		memcpy(page+12, data + (size_t)k*MPM_PAGE_CLAIR, n);
+		memset(page+12+n, 0, MPM_PAGE_CLAIR-n);
+	}
+}
+
+/**
+ *  \brief Écrit le groupe en cours dans des pages libres, et le donne à ses items
+ *  \return le groupe, ou NULL s'il n'y avait pas d'item en attente
+ */
+static t_groupe_pages *save_groupe_ferme(t_save_pages *sp) {
+	t_groupe_pages *g;
+
+	if (sp->nb_attente == 0) return NULL;
+	#ifdef MPM_ZLIB
+	tampon_comprime(&sp->groupe, &sp->travail);
+	#endif
+	g = (t_groupe_pages*)calloc(1, sizeof(t_groupe_pages));
+	g->taille = sp->groupe.len;
+	g->nb_pages = (int)((g->taille + MPM_PAGE_CLAIR - 1) / MPM_PAGE_CLAIR);
+	g->pages = (t_page_ref*)malloc(g->nb_pages * sizeof(t_page_ref));
+	pages_ecrit(sp, sp->groupe.data, sp->groupe.len, g->pages);
+	for (int i=0; i<sp->nb_attente; i++) *(sp->attente[i]) = g;
+	sp->nb_attente = 0;
+	tampon_vide(&sp->groupe);
+	return g;
+}
+
+/** \brief Attend que les écritures soient sur le disque : l'entête ne doit pas y arriver avant les pages qu'elle désigne */
+static void fichier_synchronise(FILE *file) {
+	fflush(file);
+	#ifdef _WIN32
+	_commit(_fileno(file));
+	#else
+	fsync(fileno(file));
+	#endif
+}
+
+/** \brief Raccourcit le fichier */
+static void fichier_tronque(FILE *file, long taille) {
+	fflush(file);
+	#ifdef _WIN32
+	if (_chsize(_fileno(file), taille) != 0) {
+	#else
+	if (ftruncate(fileno(file), taille) != 0) {
+	#endif
+		#ifdef DEBUG
+		debug_printf(0, (char*)"%s() fichier non raccourci à %ld\n", __func__, taille);
+		#endif
+	}
+}
+
+/**
+ *  \brief Ecrit de 0 à 15 octets aléatoires à la position donnée, après la dernière page ou le dernier enregistrement du journal
+ *  \return le nombre d'octets écrits
+ *  \note
+ *  - la taille du fichier ne donne alors pas exactement celle des pages et du journal. Le bourrage est trop court pour
+ *    passer pour un enregistrement : journal_rejoue() s'arrête dessus, et l'enregistrement suivant l'écrase
+ */
+static int fichier_bourrage(FILE *file, long position) {
+	unsigned char bourrage[16];
+	int n;
+
+	random_bytes(bourrage, 16);
+	n = (int)(bourrage[15] & 0xf);
+	fseek(file, position, SEEK_SET);
+	fwrite(bourrage, n, 1, file);
+	memset(bourrage, 0, 16);
+	return n;
+}
+
+/**
+ *  \brief Garde les groupes inchangés dont aucun item n'est connu, en parcourant l'ancienne liste jusqu'au prochain groupe conservé
+ *  \param[in,out] suivant  Prochain groupe de l'ancienne liste à examiner
+ *  \param[in]     jusqua   Groupe conservé suivant, NULL pour garder tous les groupes restants
+ *  \return la nouvelle liste des groupes du dossier
+ */
+static tdllist *save_groupes_non_lus(tdllist *groupes, tdllist **suivant, t_groupe_pages *jusqua, t_save_pages *sp) {
+	t_groupe_pages *g;
+
+	for (; (*suivant != NULL) && ((*suivant)->data != jusqua); *suivant = (*suivant)->next) {
+		g = (t_groupe_pages*)(*suivant)->data;
+		if (g->modifie || g->reference) continue;
+		groupes = tdll_append(groupes, g);
+		for (int k=0; k<g->nb_pages; k++) pages_marque(sp->pg, g->pages[k].index);
+	}
+	if (*suivant != NULL) *suivant = (*suivant)->next;
+	return groupes;
+}
+
+/**
+ *  \brief Réécrit les groupes modifiés d'un dossier, puis de ses sous-dossiers
+ *  \note
+ *  - un groupe inchangé garde ses pages. Les items des groupes modifiés, et les nouveaux items, sont regroupés à la suite
+ *    dans de nouveaux groupes d'au plus MPM_GROUPE_CLAIR octets, sauf item plus grand
+ *  - un nouvel item qui suit un groupe peu rempli le rouvre, pour qu'une suite d'ajouts ne donne pas des groupes d'un item
+ *  - les groupes remplacés sont libérés : leurs pages ne sont plus marquées, et seront effacées après l'entête
+ *  - les groupes d'un dossier dont les items n'ont pas été lus sont gardés, sans déchiffrement
+ *  - un groupe inchangé dont aucun item n'est connu (groupe illisible, voir t_secret_folder::charge_items() ) est gardé
+ *    aussi, à sa place parmi les groupes conservés
+ */
+void t_database::save_groupes(t_secret_folder *f, t_save_pages *sp) {
+	tdllist *groupes = NULL, *gl, *suivant = f->groupes;
+	t_groupe_pages *g, *precedent = NULL, *conserve = NULL;
+	t_secret_item *s;
+
+	if (!f->get_items_lus()) { // dossier jamais ouvert : ses groupes restent tels quels
+		for (gl = f->groupes; gl != NULL; gl = gl->next) {
+			g = (t_groupe_pages*)gl->data;
+			for (int k=0; k<g->nb_pages; k++) pages_marque(sp->pg, g->pages[k].index);
+		}
+		for (gl = f->sub_folders; gl != NULL; gl = gl->next) save_groupes((t_secret_folder*)gl->data, sp);
+		return;
+	}
+
+	for (gl = f->groupes; gl != NULL; gl = gl->next) ((t_groupe_pages*)gl->data)->reference = false;
+	for (gl = f->secrets; gl != NULL; gl = gl->next) {
+		s = (t_secret_item*)gl->data;
+		if ((s->groupe == NULL) && (precedent != NULL) && (precedent->taille < MPM_PAGE_CLAIR*3/4)) precedent->modifie = true;
+		if (s->groupe != NULL) s->groupe->reference = true;
+		precedent = s->groupe;
+	}
+
+	for (gl = f->secrets; gl != NULL; gl = gl->next) {
+		s = (t_secret_item*)gl->data;
+		if ((s->groupe != NULL) && !s->groupe->modifie) {
+			if (s->groupe != conserve) {
+				if ((g = save_groupe_ferme(sp)) != NULL) groupes = tdll_append(groupes, g);
+				groupes = save_groupes_non_lus(groupes, &suivant, s->groupe, sp);
+				conserve = s->groupe;
+				groupes = tdll_append(groupes, conserve);
+				for (int k=0; k<conserve->nb_pages; k++) pages_marque(sp->pg, conserve->pages[k].index);
+			}
+			continue;
+		}
+
+		tampon_vide(&sp->item);
+		tampon_item(&sp->item, s);
+		if ((sp->nb_attente > 0) && (sp->groupe.len + sp->item.len > MPM_GROUPE_CLAIR)) {
+			if ((g = save_groupe_ferme(sp)) != NULL) groupes = tdll_append(groupes, g);
+		}
+		tampon_ajoute(&sp->groupe, sp->item.data, sp->item.len);
+		if (sp->nb_attente == sp->max_attente) {
+			sp->max_attente = sp->max_attente ? 2*sp->max_attente : 32;
+			sp->attente = (t_groupe_pages***)realloc(sp->attente, sp->max_attente * sizeof(t_groupe_pages**));
+		}
+		sp->attente[sp->nb_attente++] = &s->groupe;
+	}
+	if ((g = save_groupe_ferme(sp)) != NULL) groupes = tdll_append(groupes, g);
+	groupes = save_groupes_non_lus(groupes, &suivant, NULL, sp);
+
+	for (gl = f->groupes; gl != NULL; gl = gl->next) {
+		g = (t_groupe_pages*)gl->data;
+		if (g->modifie) {
+			free(g->pages);
+			free(g);
+		}
+	}
+	tdll_free(f->groupes);
+	f->groupes = groupes;
+
+	for (gl = f->sub_folders; gl != NULL; gl = gl->next) save_groupes((t_secret_folder*)gl->data, sp);
+}
+
+#ifdef MPM_GLIB_JSON
+/** \brief Ajoute au répertoire un dossier, ses groupes, puis ses sous-dossiers */
+static void save_repertoire_dossier(JsonArray *json_array, t_secret_folder *f) {
+	JsonObject *o = json_object_new();
+	JsonArray *jsga = json_array_new();
+	tdllist *gl;
+
+	json_object_set_member(o, "id", json_node_init_int(json_node_alloc(), f->get_id()));
+	if (f->get_parent_folder()) json_object_set_member(o, "parent", json_node_init_int(json_node_alloc(), f->get_parent_folder()->get_id()));
+	json_object_set_member(o, "title", json_node_init_string(json_node_alloc(), f->get_title()));
+	for (gl = f->get_groupes(); gl != NULL; gl = gl->next) {
+		t_groupe_pages *g = (t_groupe_pages*)gl->data;
+		JsonArray *jsg = json_array_new();
+		json_array_add_int_element(jsg, g->taille);
+		for (int k=0; k<g->nb_pages; k++) {
+			json_array_add_int_element(jsg, g->pages[k].index);
+			json_array_add_int_element(jsg, g->pages[k].generation);
+		}
+		json_array_add_array_element(jsga, jsg);
+	}
+	json_object_set_member(o, "groups", json_node_init_array(json_node_alloc(), jsga));
+	json_array_add_object_element(json_array, o);
+
+	for (gl = f->get_sub_folders(); gl != NULL; gl = gl->next) save_repertoire_dossier(json_array, (t_secret_folder*)gl->data);
+}
+
+/**
+ *  \brief Génère le répertoire : paramètres, holders, et dossiers dans l'ordre d'un parcours en profondeur
+ *  \note
+ *  - les secrets ne sont pas dans le répertoire, mais dans les groupes que désigne chaque dossier
+ */
+void t_database::save_repertoire(t_tampon_json *t) {
+	tdllist *gl;
+	GError *gerreur;
+	JsonGenerator *generator;
+	JsonObject *json_root_object;
+	JsonArray *json_array;
+	JsonNode *json_root_node;
+	gchar *json_buffer;
+	gsize json_len;
+
+	generator = json_generator_new ();
+	json_root_object = json_object_new();
+
+	json_object_set_member (json_root_object, "common_treshold", json_node_init_int (json_node_alloc (), common_treshold));
+	json_object_set_member (json_root_object, "secret_treshold", json_node_init_int (json_node_alloc (), secret_treshold));
+	json_object_set_member (json_root_object, "next_id_holder", json_node_init_int (json_node_alloc (), next_id_holder));
+	json_object_set_member (json_root_object, "kdf_cost", json_node_init_int (json_node_alloc (), kdf.cout));
+	json_object_set_member (json_root_object, "kdf_algo", json_node_init_int (json_node_alloc (), kdf.algo));
+	json_object_set_member (json_root_object, "kdf_lanes", json_node_init_int (json_node_alloc (), kdf.lanes));
+
+	// Charge les holders
+	json_array = json_array_new();
+	gl = holders;
+	while (gl) {
+		json_array_add_element(json_array, ((t_holder*)gl->data)->save_common());
+		gl=gl->next;
+	}
+	json_object_set_member (json_root_object, "holders", json_node_init_array (json_node_alloc (), json_array));
+
+	// Les dossiers, chacun avec ses groupes de pages
+	json_array = json_array_new();
+	if (root_folder) save_repertoire_dossier(json_array, root_folder);
+	json_object_set_member (json_root_object, "folders", json_node_init_array (json_node_alloc (), json_array));
+
+	// Raccroche au générateur, et génère
+	json_root_node = json_node_init_object (json_node_new(JSON_NODE_OBJECT), json_root_object);
+	json_generator_set_root (generator, json_root_node);
+	json_buffer = json_generator_to_data (generator, &json_len);
+	tampon_ajoute(t, json_buffer, json_len);
+	memset(json_buffer, 0, json_len);
+	g_free(json_buffer);
+
+	json_generator_set_pretty (generator, TRUE); // Pour debug uniquement
+	json_generator_set_indent (generator, 4);	 // Pour debug uniquement
+	json_generator_to_file (generator, "mpm.debug.json", &(gerreur=NULL)); // Pour debug uniquement
+	if (gerreur) {
+		fprintf(stderr, "runtime error %s %s %d glib : %s\n", __func__, __FILE__, __LINE__, gerreur->message);
+	}
+	json_node_unref(json_root_node); // supposé tout librer récursivement par le jeu de ref/unref
+	g_object_unref ((gpointer) generator);
+}
+#endif /* GLIB_JSON */
+
+#ifdef  MPM_JANSSON
+/** \brief Ajoute au répertoire un dossier, ses groupes, puis ses sous-dossiers */
+static void save_repertoire_dossier(json_t *jsfa, t_secret_folder *f) {
+	json_t *jsf = json_object();
+	json_t *jsga = json_array();
+	tdllist *gl;
+
+	json_object_set_new(jsf, "id", json_integer(f->get_id()));
+	if (f->get_parent_folder()) json_object_set_new(jsf, "parent", json_integer(f->get_parent_folder()->get_id()));
+	json_object_set_new(jsf, "title", json_string(f->get_title()));
+	for (gl = f->get_groupes(); gl != NULL; gl = gl->next) {
+		t_groupe_pages *g = (t_groupe_pages*)gl->data;
+		json_t *jsg = json_array();
+		json_array_append_new(jsg, json_integer(g->taille));
+		for (int k=0; k<g->nb_pages; k++) {
+			json_array_append_new(jsg, json_integer(g->pages[k].index));
+			json_array_append_new(jsg, json_integer(g->pages[k].generation));
+		}
+		json_array_append_new(jsga, jsg);
+	}
+	json_object_set_new(jsf, "groups", jsga);
+	json_array_append_new(jsfa, jsf);
+
+	for (gl = f->get_sub_folders(); gl != NULL; gl = gl->next) save_repertoire_dossier(jsfa, (t_secret_folder*)gl->data);
+}
+
+/**
+ *  \brief Génère le répertoire : paramètres, holders, et dossiers dans l'ordre d'un parcours en profondeur
+ *  \note
+ *  - les secrets ne sont pas dans le répertoire, mais dans les groupes que désigne chaque dossier
+ */
+void t_database::save_repertoire(t_tampon_json *t) {
+	tdllist *gl;
+
+	// Paramètres scalaires
+	json_t *js_root = json_object();
+	if ((-1 == json_object_set_new(js_root, "common_treshold", json_integer(common_treshold)))
+	 || (-1 == json_object_set_new(js_root, "secret_treshold", json_integer(secret_treshold)))
+	 || (-1 == json_object_set_new(js_root, "next_id_holder",  json_integer(next_id_holder)))
+	 || (-1 == json_object_set_new(js_root, "kdf_cost",        json_integer(kdf.cout)))
+	 || (-1 == json_object_set_new(js_root, "kdf_algo",        json_integer(kdf.algo)))
+	 || (-1 == json_object_set_new(js_root, "kdf_lanes",       json_integer(kdf.lanes)))) {
+		#ifdef DEBUG
+		debug_printf(0, (char*)"%s() %s:%d runtime sur jansson\n", __func__, __FILE__, __LINE__);
+		#endif
+	}
+
+	// Charge les holders
+	json_t *jsha = json_array();
+	gl = holders;
+	while (gl) {
+		if (-1 == json_array_append_new(jsha, ((t_holder*)gl->data)->save_common()  )) {
+			#ifdef DEBUG
+			debug_printf(0, (char*)"%s() %s:%d runtime sur jansson\n", __func__, __FILE__, __LINE__);
+			#endif
+		}
+		gl=gl->next;
+	}
+	json_object_set_new(js_root, "holders", jsha);
+
+	// Les dossiers, chacun avec ses groupes de pages
+	json_t *jsfa = json_array();
+	if (root_folder) save_repertoire_dossier(jsfa, root_folder);
+	json_object_set_new(js_root, "folders", jsfa);
+
+	#ifdef DEBUG
+	json_dump_file(js_root, "mpm.debug.json", JSON_INDENT(4));
+	#endif
+
+	if (json_dump_callback(js_root, tampon_jansson, t, JSON_COMPACT) != 0) {
+		#ifdef DEBUG
+		debug_printf(0, (char*)"%s() %s:%d runtime sur jansson\n", __func__, __FILE__, __LINE__);
+		#endif
+	}
+	json_decref(js_root); // supprime l'arbre Jansson en mémoire
+}
+#endif /* JANSSON */
+
+/**
+ *  \brief Sauvegarde le fichier de BDD
+ *  \note
+ *  - invoqué par le programme principal/user interface
+ *  - base common MPM_COMMON_PAGES_ECRIT. Si seuls des secrets ont changé depuis la lecture ou la dernière sauvegarde,
+ *    seuls les groupes de pages modifiés et le répertoire sont écrits : le coût dépend de la modification, pas de la
+ *    taille de la base. Sinon (nouvelle base, holders, autre fichier, autre format) le fichier est entièrement réécrit
+ *  - l'entête est écrite en dernier, après synchronisation des autres pages : une sauvegarde interrompue laisse le
+ *    fichier dans l'état de la précédente, journal compris
+ *  - compacte le journal, qui repart vide après l'entête
+ *  \todo Rendre cette fonction muette, sans printf
+ */
+void t_database::save() {
+	FILE *file;
+	bool complete;
+	t_save_pages sp;
+	long taille_fichier, fin;
+	uint32_t i;
+	unsigned char page[MPM_PAGE];
+	t_pages_entete *entete = (t_pages_entete*)(page+12);
+	t_page_ref ref_entete = {0, 0};
+	t_secret_folder *illisible;
+
+	printf("Sauvegarde du fichier : %s - ", filename);
+
+	complete = (pages == NULL) || ((changed & ~MPM_CHANGED_SECRET) != 0) || (common_format != MPM_COMMON_PAGES_ECRIT);
+	if (complete && root_folder) root_folder->charge_tout(); // les pages vont être réécrites, tant qu'elles sont lisibles
+	if (complete && root_folder && ((illisible = root_folder->get_illisible()) != NULL)) {
+		printf("Erreur : le dossier %s a des groupes de pages illisibles, qu'une sauvegarde complète perdrait\n", illisible->get_title());
+		return;
+	}
+	clear_chunks_cache(); // avant la réécriture : les calculs en cours lisent encore la projection
+	file = complete ? NULL : fopen(filename, "r+b");
+	if (file == NULL) {
+		complete = true;
+		file = fopen(filename, "w+b");
+	}
+	if (!file) {
+		printf("Erreur à l'ouverture du fichier\n");
+		perror(NULL);
+		printf("\n");
+		return;
+	}
+
+	if (complete) {
+		pages_free();
+		pages = (t_pages*)calloc(1, sizeof(t_pages));
+
+		// Enregistre les chunks de holders
+		common_index = save_chunks_holders(file);
+
+		// Enregistre le marqueur pour la partie common
+		random_bytes((void*)pages->cm.salt, 32);
+		cw_sha256_mix2(pages->cm.hash, pages->cm.salt, common_magic ^ MPM_COMMON_PAGES_ECRIT_DOMAINE);
+		common_format = MPM_COMMON_PAGES_ECRIT;
+		fwrite(&pages->cm, sizeof(t_common_marker), 1, file);
+		if (root_folder) root_folder->oublie_pages();
+	}
+
+	// Les pages de la sauvegarde précédente et le journal restent intacts jusqu'à l'entête
+	fseek(file, 0, SEEK_END);
+	taille_fichier = ftell(file);
+	memset(&sp, 0, sizeof(sp));
+	sp.file = file;
+	sp.base = (long)common_index*CHUNK_HOLDER_SIZE + (long)sizeof(t_common_marker);
+	sp.pg = pages;
+	sp.ancienne = pages->utilisee;
+	sp.nb_ancienne = pages->capacite;
+	sp.debut_journal = pages->nb;
+	sp.fin_journal = pages->nb + (uint32_t)((pages->journal + MPM_PAGE - 1) / MPM_PAGE);
+	sp.libre = 1;
+	sp.aes = common_aes;
+	pages_lot_init(&sp.lot, &pages->cm, common_key, common_aes, 1);
+	pages->utilisee = NULL;
+	pages->capacite = 0;
+	pages->nb = 0;
+	pages->generation++;
+	pages_marque(pages, 0);
+
+	// Les groupes modifiés, puis le répertoire
+	if (root_folder) save_groupes(root_folder, &sp);
+	save_repertoire(&sp.groupe);
+	#ifdef MPM_ZLIB
+	tampon_comprime(&sp.groupe, &sp.travail);
+	#endif
+	memset(page, 0, sizeof(page));
+	memcpy(entete->magic, MPM_PAGES_MAGIC, 8);
+	entete->generation = pages->generation;
+	entete->taille_repertoire = (uint32_t)sp.groupe.len;
+	entete->nb_repertoire = (uint32_t)((sp.groupe.len + MPM_PAGE_CLAIR - 1) / MPM_PAGE_CLAIR);
+	if (entete->nb_repertoire > MPM_PAGES_REPERTOIRE_MAX) {
+		fprintf(stderr, "%s() répertoire de %u pages, au-delà de %u\n", __func__, entete->nb_repertoire, (unsigned)MPM_PAGES_REPERTOIRE_MAX);
+		abort();
+	}
+	pages_ecrit(&sp, sp.groupe.data, sp.groupe.len, entete->repertoire);
+	pages_lot_ecrit(&sp);
+	fichier_synchronise(file);
+
+	// Validation : l'entête est réécrite en place
+	entete->nb_pages = pages->nb;
+	page_chiffre(page, &pages->cm, common_aes, ref_entete);
+	fseek(file, sp.base, SEEK_SET);
+	fwrite(page, MPM_PAGE, 1, file);
+	fichier_synchronise(file);
+	sp.nb_ecrites++;
+	pages->journal = 0;
+	pages->sequence = 0;
+	pages->nb_notes = 0;
+	memset(pages->chaine, 0, 16);
+
+	// Efface les pages et le journal qui ne servent plus, puis raccourcit le fichier
+	for (i = 1; i < pages->nb; i++) {
+		if (!pages->utilisee[i] && (((i < sp.nb_ancienne) && sp.ancienne[i]) || ((i >= sp.debut_journal) && (i < sp.fin_journal)))) {
+			random_bytes(page, MPM_PAGE);
+			fseek(file, sp.base + (long)i*MPM_PAGE, SEEK_SET);
+			fwrite(page, MPM_PAGE, 1, file);
+		}
+	}
+	fin = sp.base + (long)pages->nb*MPM_PAGE + fichier_bourrage(file, sp.base + (long)pages->nb*MPM_PAGE);
+	if (taille_fichier > fin) fichier_tronque(file, fin);
+	fflush(file);
+	fclose(file);
+
+	#ifdef DEBUG
+	debug_printf(0, (char*)"%s() sauvegarde %s n°%u : %d pages écrites, %u pages dans le fichier\n", __func__, complete ? "complète" : "incrémentale", pages->generation, sp.nb_ecrites, pages->nb);
+	#endif
+	memset(page, 0, sizeof(page));
+	free(sp.ancienne);
+	free(sp.attente);
+	pages_lot_free(&sp.lot);
+	tampon_free(&sp.groupe);
+	tampon_free(&sp.item);
+	tampon_free(&sp.travail);
+	changed=0;
+	printf("Fait\n\n");
+}
+
+/** \brief Oublie l'état des pages du fichier : la prochaine sauvegarde sera complète */
+void t_database::pages_free() {
+	if (pages == NULL) return;
+	free(pages->utilisee);
+	free(pages->notes);
+	free(pages);
+	pages = NULL;
+}
+
+/* Journal d'une base MPM_COMMON_PAGES
+ *
+ * Entre deux sauvegardes, chaque commande qui modifie des secrets ajoute à la fin du fichier, après la dernière page, un
+ * enregistrement par item ou dossier modifié : l'item entier, le dossier (parent et titre), ou sa suppression. Chaque
+ * enregistrement est chiffré en AES256-GCM sous common_key : un nonce aléatoire et la longueur en clair, le chiffré, 
+ * puis le tag. Les données authentifiées (t_journal_aad) enchaînent les enregistrements à la sauvegarde qu'ils 
+ * complètent, et chacun au précédent par son tag : ils ne peuvent être ni retirés, ni permutés, ni rejoués sur une 
+ * autre sauvegarde.
+ * À la lecture, le journal est rejoué sur les pages jusqu'au premier enregistrement incomplet ou non vérifié : une
+ * session interrompue ne perd au plus que la dernière commande, et le bourrage aléatoire qui termine le fichier (voir
+ * fichier_bourrage()) est ignoré. La sauvegarde suivante (save, compact, ou journal dépassant MPM_JOURNAL_MAX) écrit les
+ * groupes concernés dans les pages, et vide le journal.
+ * Le nouveau MdP, les nouvelles parts ou l'email d'une holder qui a déjà son emplacement sont journalisés avec le chunk
+ * tel qu'il doit être dans le fichier (MPM_JOURNAL_HOLDER). journalise() réécrit ensuite ce chunk en place : si cette
+ * écriture est interrompue, le chunk est réécrit depuis le journal à la lecture suivante, par une autre holder. L'ajout 
+ * ou la suppression d'une holder change la table d'emplacements, et demande une sauvegarde complète.
+ */
+
+/** \brief Modification notée par journal_note(), que journalise() transforme en enregistrement */
+typedef struct t_journal_note {
+	uint32_t id;       ///< ID de l'item ou du dossier, id_holder pour MPM_JOURNAL_HOLDER
+	uint32_t op;       ///< MPM_JOURNAL_xxx, fixé quand la modification est faite : les ID sont recyclés
+} t_journal_note;
+
+/** \brief Début du clair d'un enregistrement du journal */
+typedef struct t_journal_op {
+	uint32_t op;       ///< MPM_JOURNAL_xxx
+	uint32_t id;
+	uint32_t parent;
+} t_journal_op;
+
+/** \brief Suite du clair d'un enregistrement MPM_JOURNAL_HOLDER, avant l'email */
+typedef struct t_journal_holder {
+	uint32_t file_index;                    ///< emplacement du chunk dans le fichier, en blocs de CHUNK_HOLDER_SIZE
+	uint16_t common_nb_parts;               ///< les parts, comme dans le répertoire
+	uint16_t secret_nb_parts;
+	unsigned char chunk[CHUNK_HOLDER_SIZE]; ///< le chunk tel qu'il est écrit dans le fichier, voir t_holder::chunk_fichier()
+} t_journal_holder;
+
+/** \brief Données authentifiées d'un enregistrement du journal */
+typedef struct t_journal_aad {
+	t_common_marker cm;
+	uint32_t generation;         ///< la sauvegarde que le journal complète
+	uint32_t sequence;           ///< rang de l'enregistrement
+	uint32_t len;                ///< longueur du clair
+	unsigned char precedent[16]; ///< tag de l'enregistrement précédent, 0 pour le premier
+} t_journal_aad;
+
+static void journal_aad(t_journal_aad *aad, const t_pages *pg, uint32_t len) {
+	memset(aad, 0, sizeof(t_journal_aad));
+	aad->cm = pg->cm;
+	aad->generation = pg->generation;
+	aad->sequence = pg->sequence;
+	aad->len = len;
+	memcpy(aad->precedent, pg->chaine, 16);
+}
+
+/** 
+ *  \brief Chiffre un enregistrement à la suite du tampon, et avance la chaîne
+ *  \note le tampon est écrit par journalise() d'une seule écriture, pour tous les enregistrements d'une commande
+ */
+static void journal_chiffre(t_pages *pg, t_cw_aes *aes, t_tampon_json *sortie, const unsigned char *clair, size_t len) {
+	static const unsigned char zeros[16] = {0};
+	unsigned char entete[16];
+	t_journal_aad aad;
+	size_t debut = sortie->len;
+	uint32_t n = (uint32_t)len;
+
+	random_bytes(entete, 12);
+	memcpy(entete+12, &n, 4);
+	tampon_ajoute(sortie, entete, 16);
+	tampon_ajoute(sortie, clair, len);
+	tampon_ajoute(sortie, zeros, 16);
+
+	unsigned char *r = sortie->data + debut;
+	journal_aad(&aad, pg, n);
+	cw_aes_gcm(aes, r+16, len, r, (unsigned char*)&aad, sizeof(aad), r+16+len, 1);
+	memcpy(pg->chaine, r+16+len, 16);
+	pg->sequence++;
+}
+
+/** \brief Cherche un dossier par son ID, dans un dossier et ses sous-dossiers */
+static t_secret_folder *cherche_dossier(t_secret_folder *f, uint32_t id) {
+	t_secret_folder *r;
+
+	if (f == NULL) return NULL;
+	if (f->get_id() == id) return f;
+	for (tdllist *gl = f->get_sub_folders(); gl != NULL; gl = gl->next) {
+		if ((r = cherche_dossier((t_secret_folder*)gl->data, id)) != NULL) return r;
+	}
+	return NULL;
+}
+
+/** 
+ *  \brief Cherche un item par son ID, dans un dossier et ses sous-dossiers. Son dossier est rendu dans *dossier
+ *  \param[in] charge  false pour ne chercher que dans les dossiers dont les items ont déjà été lus
+ */
+static t_secret_item *cherche_item(t_secret_folder *f, uint32_t id, t_secret_folder **dossier, bool charge) {
+	t_secret_item *s;
+
+	if (f == NULL) return NULL;
+	if ((charge || f->get_items_lus()) && ((s = f->get_secret_by_id(id)) != NULL)) {
+		*dossier = f;
+		return s;
+	}
+	for (tdllist *gl = f->get_sub_folders(); gl != NULL; gl = gl->next) {
+		if ((s = cherche_item((t_secret_folder*)gl->data, id, dossier, charge)) != NULL) return s;
+	}
+	return NULL;
+}
+
+/** \brief Crée un item depuis son encodage binaire, NULL s'il est illisible */
+static t_secret_item *item_depuis_binaire(const unsigned char *data, size_t len, t_secret_folder *f) {
+	t_lit_binaire lb = {data, data + len, false};
+	t_secret_item *s = new t_secret_item(&lb, f);
+
+	if (lb.erreur || (lb.p != lb.fin)) {
+		delete s;
+		return NULL;
+	}
+	return s;
+}
+
+/** \brief Cherche une holder par son ID */
+static t_holder *cherche_holder(tdllist *holders, uint32_t id) {
+	for (tdllist *gl = holders; gl != NULL; gl = gl->next) {
+		if (((t_holder*)gl->data)->id_holder == id) return (t_holder*)gl->data;
+	}
+	return NULL;
+}
+
+/** \brief Les deux notes portent-elles sur le même objet ? Les ID des holders sont une autre série que ceux des items et dossiers */
+static bool notes_meme_objet(const t_journal_note *a, const t_journal_note *b) {
+	return (a->id == b->id) && ((a->op == MPM_JOURNAL_HOLDER) == (b->op == MPM_JOURNAL_HOLDER));
+}
+
+/** 
+ *  \brief Note un item, un dossier ou une holder modifié, créé ou supprimé, pour le prochain enregistrement du journal
+ *  \param[in] op  MPM_JOURNAL_xxx : ce qui a été fait, et non ce que l'ID désignera au moment de journalise()
+ *  \return false si le fichier n'a pas de journal (base pas encore sauvegardée, ou ancien format) : rien n'est noté
+ *  \note 
+ *  - une note identique à la dernière sur le même objet n'est pas répétée. Une suppression suivie de la création d'un 
+ *    objet qui reprend l'ID donne deux notes, dans cet ordre
+ */
+bool t_database::journal_note(uint32_t id, uint32_t op) {
+	t_journal_note note = {id, op};
+
+	if (pages == NULL) return false;
+	for (int i=pages->nb_notes-1; i>=0; i--) {
+		if (notes_meme_objet(&pages->notes[i], &note)) {
+			if (pages->notes[i].op == op) return true;
+			break;
+		}
+	}
+	if (pages->nb_notes == pages->max_notes) {
+		pages->max_notes = pages->max_notes ? 2*pages->max_notes : 16;
+		pages->notes = (t_journal_note*)realloc(pages->notes, pages->max_notes * sizeof(t_journal_note));
+	}
+	pages->notes[pages->nb_notes++] = note;
+	return true;
+}
+
+/** 
+ *  \brief Ajoute au journal les items et dossiers notés depuis le dernier appel
+ *  \return 0 si rien n'a été écrit, 1 si le journal a été complété, 2 s'il a été compacté par une sauvegarde, -1 en cas
+ *          d'erreur à l'ouverture du fichier
+ *  \note 
+ *  - invoqué par la CLI après chaque commande qui modifie des secrets ou une holder : une seule écriture, suivie d'un fsync()
+ *  - une création ou une modification déjà suivie d'une autre note sur le même objet n'est pas écrite : la dernière note
+ *    donne son état. Les suppressions sont toujours écrites, l'ID ayant pu être repris ensuite
+ *  - les chunks des enregistrements MPM_JOURNAL_HOLDER sont réécrits en place une fois le journal synchronisé. La taille
+ *    du fichier ne change pas : la projection et les calculs en cours restent valides
+ *  - les modifications journalisées sont dans le fichier : MPM_CHANGED_SECRET et MPM_CHANGED_PASSWORD disparaissent de changed
+ *  - au-delà de MPM_JOURNAL_MAX, le journal est compacté par save()
+ */
+int t_database::journalise() {
+	t_tampon_json clair, sortie;
+	t_journal_op op;
+	t_journal_holder jh;
+	t_journal_holder *chunks = NULL;
+	int nb_chunks = 0;
+	t_secret_folder *f;
+	t_secret_item *s;
+	t_holder *h;
+	unsigned char chaine[16];
+	uint32_t sequence;
+	FILE *file;
+	int j;
+
+	if ((pages == NULL) || (pages->nb_notes == 0) || (filename == NULL)) return 0;
+	memset(&clair, 0, sizeof(clair));
+	memset(&sortie, 0, sizeof(sortie));
+	sequence = pages->sequence;
+	memcpy(chaine, pages->chaine, 16);
+
+	for (int i=0; i<pages->nb_notes; i++) {
+		t_journal_note *note = &pages->notes[i];
+		if ((note->op != MPM_JOURNAL_SUPPRIME_ITEM) && (note->op != MPM_JOURNAL_SUPPRIME_DOSSIER)) {
+			for (j=i+1; (j<pages->nb_notes) && !notes_meme_objet(note, &pages->notes[j]); j++);
+			if (j < pages->nb_notes) continue;
+		}
+		memset(&op, 0, sizeof(op));
+		op.op = note->op;
+		op.id = note->id;
+		tampon_vide(&clair);
+		switch (note->op) {
+		case MPM_JOURNAL_ITEM:
+			if ((s = cherche_item(root_folder, op.id, &f, false)) == NULL) continue; // un item modifié a été lu
+			op.parent = f->get_id();
+			tampon_ajoute(&clair, &op, sizeof(op));
+			tampon_item(&clair, s);
+			break;
+
+		case MPM_JOURNAL_DOSSIER:
+			if ((f = cherche_dossier(root_folder, op.id)) == NULL) continue;
+			op.parent = f->get_parent_folder() ? f->get_parent_folder()->get_id() : 0;
+			tampon_ajoute(&clair, &op, sizeof(op));
+			tampon_ajoute(&clair, f->get_title(), strlen(f->get_title()));
+			break;
+
+		case MPM_JOURNAL_HOLDER:
+			if (((h = cherche_holder(holders, op.id)) == NULL) || (h->file_index < 1)) continue; // pas encore d'emplacement
+			jh.file_index = (uint32_t)h->file_index;
+			jh.common_nb_parts = h->common_nb_parts;
+			jh.secret_nb_parts = h->secret_nb_parts;
+			h->chunk_fichier(jh.chunk);
+			tampon_ajoute(&clair, &op, sizeof(op));
+			tampon_ajoute(&clair, &jh, sizeof(jh));
+			if (h->email) tampon_ajoute(&clair, h->email, strlen(h->email));
+			chunks = (t_journal_holder*)realloc(chunks, (nb_chunks+1) * sizeof(t_journal_holder));
+			chunks[nb_chunks++] = jh;
+			break;
+
+		default: // MPM_JOURNAL_SUPPRIME_ITEM, MPM_JOURNAL_SUPPRIME_DOSSIER
+			tampon_ajoute(&clair, &op, sizeof(op));
+			break;
+		}
+		journal_chiffre(pages, common_aes, &sortie, clair.data, clair.len);
+	}
+	tampon_free(&clair);
+
+	file = fopen(filename, "r+b");
+	if (file == NULL) {
+		// Les modifications restent dans changed, pour la prochaine sauvegarde
+		#ifdef DEBUG
+		debug_printf(0, (char*)"%s() ouverture de %s impossible\n", __func__, filename);
+		#endif
+		pages->sequence = sequence;
+		memcpy(pages->chaine, chaine, 16);
+		tampon_free(&sortie);
+		free(chunks);
+		return -1;
+	}
+	fseek(file, (long)common_index*CHUNK_HOLDER_SIZE + (long)sizeof(t_common_marker) + (long)pages->nb*MPM_PAGE + pages->journal, SEEK_SET);
+	fwrite(sortie.data, sortie.len, 1, file);
+	fichier_bourrage(file, ftell(file));
+	fichier_synchronise(file);
+
+	// Les chunks, une fois le journal qui permet de les réécrire dans le fichier
+	for (j=0; j<nb_chunks; j++) {
+		fseek(file, (long)chunks[j].file_index*CHUNK_HOLDER_SIZE, SEEK_SET);
+		fwrite(chunks[j].chunk, CHUNK_HOLDER_SIZE, 1, file);
+	}
+	if (nb_chunks > 0) fichier_synchronise(file);
+	fclose(file);
+	free(chunks);
+
+	#ifdef DEBUG
+	debug_printf(0, (char*)"%s() %d enregistrements, %zu octets, journal de %ld octets\n", __func__, pages->nb_notes, sortie.len, pages->journal + (long)sortie.len);
+	#endif
+	pages->journal += sortie.len;
+	pages->nb_notes = 0;
+	tampon_free(&sortie);
+	changed &= ~(MPM_CHANGED_SECRET | MPM_CHANGED_PASSWORD);
+
+	if (pages->journal > MPM_JOURNAL_MAX) {
+		save();
+		return 2;
+	}
+	return 1;
+}
+
+/** \brief Taille du journal en octets, -1 si le fichier n'en a pas (base pas encore sauvegardée, ou ancien format) */
+long t_database::get_journal() {
+	return (pages != NULL) ? pages->journal : -1;
+}
+
+/** 
+ *  \brief Applique un enregistrement du journal à l'arborescence lue dans les pages
+ *  \note 
+ *  - les listes sont modifiées directement, sans passer par les méthodes qui notent les changements
+ *  - le groupe de pages d'un item remplacé ou supprimé est marqué modifié : la prochaine sauvegarde le réécrira
+ */
+void t_database::journal_applique(const unsigned char *clair, size_t len) {
+	t_journal_op op;
+	t_secret_folder *f, *p;
+	t_secret_item *s, *ancien;
+	tdllist *gl;
+
+	memcpy(&op, clair, sizeof(op));
+	clair += sizeof(op);
+	len -= sizeof(op);
+
+	switch (op.op) {
+	case MPM_JOURNAL_ITEM:
+		if ((f = cherche_dossier(get_root_folder(), op.parent)) == NULL) break;
+		s = item_depuis_binaire(clair, len, f);
+		if (s == NULL) break;
+		ancien = f->get_secret_by_id(op.id); // un item ne change pas de dossier : seul le sien est lu
+		if (ancien != NULL) {
+			for (gl = f->secrets; gl != NULL; gl = gl->next) if (gl->data == ancien) gl->data = s;
+			if (ancien->groupe) ancien->groupe->modifie = true;
+			s->groupe = ancien->groupe;
+			delete ancien;
+		} else {
+			f->secrets = tdll_append(f->secrets, s);
+		}
+		break;
+
+	case MPM_JOURNAL_DOSSIER: {
+		char *titre = (char*)malloc(len+1);
+		memcpy(titre, clair, len);
+		titre[len] = 0;
+		if ((f = cherche_dossier(get_root_folder(), op.id)) != NULL) {
+			free(f->title);
+			f->title = titre;
+			break;
+		}
+		if ((p = cherche_dossier(root_folder, op.parent)) != NULL) {
+			p->sub_folders = tdll_append(p->sub_folders, new t_secret_folder(p, titre, op.id, this));
+		}
+		free(titre);
+		break;
+	}
+
+	case MPM_JOURNAL_SUPPRIME_ITEM:
+	case MPM_JOURNAL_SUPPRIME_DOSSIER:
+		journal_applique_suppression(op.id, op.op);
+		break;
+
+	case MPM_JOURNAL_HOLDER:
+		journal_applique_holder(op.id, clair, len);
+		break;
+	}
+}
+
+/** \brief Supprime un item (MPM_JOURNAL_SUPPRIME_ITEM) ou un dossier (MPM_JOURNAL_SUPPRIME_DOSSIER) en rejouant le journal */
+void t_database::journal_applique_suppression(uint32_t id, uint32_t op) {
+	t_secret_folder *f;
+	t_secret_item *s;
+
+	if (op == MPM_JOURNAL_SUPPRIME_DOSSIER) {
+		if (((f = cherche_dossier(root_folder, id)) != NULL) && (f->parent != NULL)) {
+			f->parent->sub_folders = tdll_remove(f->parent->sub_folders, f);
+			f->delete_all();
+			delete f;
+		}
+	} else if ((s = cherche_item(root_folder, id, &f, true)) != NULL) {
+		if (s->groupe) s->groupe->modifie = true;
+		f->secrets = tdll_remove(f->secrets, s);
+		delete s;
+	}
+}
+
+/** 
+ *  \brief Applique à une holder un enregistrement MPM_JOURNAL_HOLDER
+ *  \param[in] clair  La suite de l'enregistrement : t_journal_holder, puis l'email
+ *  \note 
+ *  - les parts et l'email sont appliqués tout de suite. Le chunk est seulement retenu : seul le dernier du journal pour
+ *    cet emplacement compte, voir journal_chunks_rejoues()
+ */
+void t_database::journal_applique_holder(uint32_t id, const unsigned char *clair, size_t len) {
+	t_journal_holder jh;
+	t_holder *h;
+	int i;
+
+	if ((len < sizeof(jh)) || ((h = cherche_holder(holders, id)) == NULL)) return;
+	memcpy(&jh, clair, sizeof(jh));
+	if ((jh.file_index < 1) || (jh.file_index >= (uint32_t)common_index)) return;
+	h->file_index = (int)jh.file_index;
+	h->common_nb_parts = jh.common_nb_parts;
+	h->secret_nb_parts = jh.secret_nb_parts;
+	if (h->email) free(h->email);
+	h->email = NULL;
+	if (len > sizeof(jh)) {
+		h->email = (char*)malloc(len - sizeof(jh) + 1);
+		memcpy(h->email, clair + sizeof(jh), len - sizeof(jh));
+		h->email[len - sizeof(jh)] = 0;
+	}
+
+	for (i=0; (i<pages->nb_chunks_rejoues) && (pages->chunks_rejoues[i].file_index != jh.file_index); i++);
+	if (i == pages->nb_chunks_rejoues) {
+		pages->chunks_rejoues = (t_journal_holder*)realloc(pages->chunks_rejoues, (i+1) * sizeof(t_journal_holder));
+		pages->nb_chunks_rejoues++;
+	}
+	pages->chunks_rejoues[i] = jh;
+	memset(&jh, 0, sizeof(jh));
+}
+
+/** 
+ *  \brief Met dans le fichier et dans les holders le dernier chunk de chaque holder trouvé dans le journal
+ *  \note 
+ *  - invoqué par journal_rejoue() une fois tout le journal appliqué
+ *  - un chunk du fichier qui n'est pas celui du journal n'a pas été réécrit jusqu'au bout par journalise() : il l'est ici.
+ *    Une holder qui avait ouvert l'ancien chunk repasse en HOLDER_CHUNK_STATUS_CLOSED avec le nouveau. Ses parts ont
+ *    servi à l'ouverture, mais c'est son nouveau MdP qui ouvrira le chunk du fichier
+ */
+void t_database::journal_chunks_rejoues() {
+	t_vue_fichier *v = vue_fichier();
+	t_journal_holder *jh;
+	t_holder *h;
+	FILE *file = NULL;
+	long position;
+
+	for (int i=0; i<pages->nb_chunks_rejoues; i++) {
+		jh = &pages->chunks_rejoues[i];
+		position = (long)jh->file_index*CHUNK_HOLDER_SIZE;
+		h = NULL;
+		for (tdllist *gl = holders; gl != NULL; gl = gl->next) {
+			if (((t_holder*)gl->data)->file_index == (int)jh->file_index) h = (t_holder*)gl->data;
+		}
+		if (h == NULL) continue;
+		if ((v != NULL) && (v->taille >= position + CHUNK_HOLDER_SIZE) && (memcmp(v->data + position, jh->chunk, CHUNK_HOLDER_SIZE) == 0)) {
+			if (h->chunk_status == HOLDER_CHUNK_STATUS_CLOSED) memcpy(h->chunk, jh->chunk, CHUNK_HOLDER_SIZE);
+			continue;
+		}
+		#ifdef DEBUG
+		debug_printf(0, (char*)"%s() chunk de %s réécrit depuis le journal, file_index=%u\n", __func__, h->nickname, jh->file_index);
+		#endif
+		if ((file == NULL) && ((file = fopen(filename, "r+b")) == NULL)) break;
+		fseek(file, position, SEEK_SET);
+		fwrite(jh->chunk, CHUNK_HOLDER_SIZE, 1, file);
+		memcpy(h->chunk, jh->chunk, CHUNK_HOLDER_SIZE);
+		h->chunk_status = HOLDER_CHUNK_STATUS_CLOSED;
+	}
+	if (file != NULL) {
+		fichier_synchronise(file);
+		fclose(file);
+	}
+	if (pages->chunks_rejoues) memset(pages->chunks_rejoues, 0, pages->nb_chunks_rejoues*sizeof(t_journal_holder));
+	free(pages->chunks_rejoues);
+	pages->chunks_rejoues = NULL;
+	pages->nb_chunks_rejoues = 0;
+}
+
+/** 
+ *  \brief Rejoue le journal qui suit les pages, jusqu'au premier enregistrement incomplet ou non vérifié
+ *  \param[in] data  Début du journal, dans la projection du fichier
+ *  \note 
+ *  - invoqué par read_common_pages(), une fois l'arborescence lue dans les pages
+ *  - le journal suivant continuera après le dernier enregistrement vérifié
+ */
+void t_database::journal_rejoue(const unsigned char *data, long taille) {
+	t_journal_aad aad;
+	unsigned char tag[16];
+	unsigned char *clair;
+	uint32_t len;
+	long pos = 0;
+
+	while (pos + 32 <= taille) {
+		memcpy(&len, data + pos + 12, 4);
+		if ((len < sizeof(t_journal_op)) || ((long)len > taille - pos - 32)) break;
+		clair = (unsigned char*)malloc(len);
+		memcpy(clair, data + pos + 16, len); // la projection est en lecture seule
+		memcpy(tag, data + pos + 16 + len, 16);
+		journal_aad(&aad, pages, len);
+		if (!cw_aes_gcm(common_aes, clair, len, data + pos, (unsigned char*)&aad, sizeof(aad), tag, 0)) {
+			free(clair);
+			break;
+		}
+		journal_applique(clair, len);
+		memset(clair, 0, len);
+		free(clair);
+		memcpy(pages->chaine, tag, 16);
+		pages->sequence++;
+		pos += 32 + len;
+	}
+	pages->journal = pos;
+	journal_chunks_rejoues();
+
+	#ifdef DEBUG
+	debug_printf(0, (char*)"%s() %u enregistrements rejoués, %ld octets ignorés après le journal\n", __func__, pages->sequence, taille - pos);
+	#endif
+}
+
+
+/** 
+ *  \brief Calcul de recherche de chunks holders, pour un ou plusieurs couples nickname/MdP
+ *  \note 
+ *  - ne dépend pas de la base : les chaines sont des copies, les blocs aussi ou bien ils sont dans la projection du fichier
+ *    dont le calcul garde une référence. Le calcul peut donc se dérouler dans un thread pendant que la CLI continue à 
+ *    travailler avec la base (voir t_database::try_async())
+ */
+typedef struct t_scan_holder {
+	int nb_paires;                            ///< nombre de couples nickname/MdP essayés
+	char *nicknames[MPM_TRY_MAX_BATCH];       ///< nicknames essayés
+	char *passwords[MPM_TRY_MAX_BATCH];       ///< MdP essayés, effacés dès la fin du calcul
+	unsigned char *blocs;                     ///< blocs à tester, en lecture seule. NULL après scan_detache_vue()
+	long taille;                              ///< taille de ces blocs en octets
+	t_vue_fichier *vue;                       ///< projection contenant les blocs, NULL si les blocs sont malloc()és
+	bool fichier;                             ///< blocs lus dans le fichier depuis le début, l'index d'un bloc est son file_index. Sinon, chunk d'une holder déjà connue
+	int nb_blocs;                             ///< nombre de blocs complets de CHUNK_HOLDER_SIZE à tester
+	int prochain;                             ///< prochain travail à distribuer à un thread
+	int lanes;                                ///< nombre de blocs distribués à la fois, voir cw_kdf_passage()
+	int trouve[MPM_TRY_MAX_BATCH];            ///< plus petit index de bloc reconnu pour chaque couple, nb_blocs si aucun
+	int indice[MPM_TRY_MAX_BATCH];            ///< bloc désigné par l'emplacement préféré de chaque couple (voir t_slots_anchor), -1 si aucun
+	t_cw_kdf kdf;                             ///< KDF pour la recherche complète
+	t_cw_kdf kdf_indice;                      ///< KDF lue dans t_slots_anchor, pour tester les emplacements préférés
+	bool sondage;                             ///< table pleine d'une ancre à une autre KDF : recherche complète aussi avec kdf_indice, voir scan_passe()
+	t_cw_kdf kdf_passe;                       ///< KDF de la recherche complète en cours, kdf ou kdf_indice
+	bool saute_indice;                        ///< kdf_passe est kdf_indice : le bloc de l'emplacement préféré est déjà testé
+	t_cw_kdf kdf_trouve[MPM_TRY_MAX_BATCH];   ///< KDF avec laquelle chaque chunk a été reconnu, à utiliser pour sa clé
+	int restants[MPM_TRY_MAX_BATCH];          ///< couples non reconnus par leur emplacement préféré, à chercher dans tous les blocs
+	int nb_restants;
+	t_chunk_holder *chunks[MPM_TRY_MAX_BATCH];///< chunks reconnus, malloc()és et déchiffrés par pkey_holder_thread(), NULL si non trouvé
+	unsigned char pkeys[32*MPM_TRY_MAX_BATCH];///< clés de holder calculées par pkey_holder_thread(), 32 octets par couple
+	bool speculation;                         ///< indice_holder_thread() calcule aussi la clé du bloc désigné, voir cw_kdf_double_gratuit()
+	bool pkey_speculee[MPM_TRY_MAX_BATCH];    ///< la clé de pkeys est déjà calculée par indice_holder_thread()
+	bool memoire[MPM_TRY_MAX_BATCH];          ///< une KDF du couple n'a pas eu sa mémoire de travail : s'il n'est pas trouvé, ce n'est pas concluant
+	bool termine;                             ///< calcul terminé
+	bool thread_lance;                        ///< le calcul se déroule dans 'thread', à attendre par tw_thread_join()
+	bool annule;                              ///< abandon demandé par scan_annule(), vu par les threads entre deux lots
+	tw_thread thread;
+	tw_mutex mutex;                           ///< protège prochain, trouve, termine, annule et arenas
+	t_cw_kdf_ctx *arenas[TW_MAX_THREADS];     ///< mémoires de travail libres, prises et rendues par scan_arena_prend() et scan_arena_rend()
+	int nb_arenas;
+} t_scan_holder;
+
+/** \brief Indique si deux KDF donnent le même calcul. Les lanes ne comptent que pour Argon2id */
+static bool kdf_egales(const t_cw_kdf *a, const t_cw_kdf *b) {
+	return (a->algo == b->algo) && (a->cout == b->cout) && ((a->algo == MPM_KDF_SHA256) || (a->lanes == b->lanes));
+}
+
+/** 
+ *  \brief Prépare un calcul de recherche de chunks holders
+ *  \param[in]   blocs     Blocs à tester. malloc()és et libérés par scan_free(), ou dans la projection vue
+ *  \param[in]   vue       Projection contenant les blocs, dont le calcul prend une référence. NULL si les blocs sont malloc()és
+ *  \param[in]   kdf       KDF pour la recherche complète, voir t_database::kdf
+ *  \note 
+ *  - les nicknames et MdP sont recopiés
+ */
+static t_scan_holder *scan_new(int n, char **nicknames, char **passwords, unsigned char *blocs, long taille, t_vue_fichier *vue, bool fichier, const t_cw_kdf *kdf) {
+	t_scan_holder *sc = (t_scan_holder*)calloc(1, sizeof(t_scan_holder));
+
+	assert((n > 0) && (n <= MPM_TRY_MAX_BATCH));
+	sc->nb_paires = n;
+	for (int p=0; p<n; p++) {
+		sc->nicknames[p] = strdup(nicknames[p]);
+		sc->passwords[p] = strdup(passwords[p]);
+	}
+	sc->blocs = blocs;
+	sc->taille = taille;
+	sc->vue = vue ? vue_prend(vue) : NULL;
+	sc->fichier = fichier;
+	sc->kdf = *kdf;
+	sc->nb_blocs = taille / CHUNK_HOLDER_SIZE;
+	for (int p=0; p<n; p++) sc->trouve[p] = sc->nb_blocs;
+	for (int p=0; p<n; p++) sc->kdf_trouve[p] = *kdf;
+	for (int p=0; p<n; p++) sc->indice[p] = -1;
+	if (fichier && (sc->nb_blocs > 1)) {
+		// Emplacements préférés, si la table décrite par le premier bloc tient dans le fichier
+		t_slots_anchor *anchor = (t_slots_anchor*)blocs;
+		int log2_slots = anchor->log2_slots & 0x1f;
+		sc->kdf_indice.cout = anchor->kdf_cost & 0x1f;
+		sc->kdf_indice.algo = anchor->kdf_algo & 0x03;
+		sc->kdf_indice.lanes = anchor->kdf_lanes & 0x1f;
+		if ((log2_slots <= MPM_SLOTS_MAX_LOG2) && (1 + (1 << log2_slots) <= sc->nb_blocs)
+		 && (sc->kdf_indice.cout >= MPM_KDF_COST_MIN) && (sc->kdf_indice.cout <= MPM_KDF_COST_MAX)
+		 && cw_kdf_disponible(sc->kdf_indice.algo) && (sc->kdf_indice.lanes >= 1) && (sc->kdf_indice.lanes <= MPM_KDF_LANES_MAX)) {
+			for (int p=0; p<n; p++) sc->indice[p] = 1 + slot_prefere(anchor->salt, nicknames[p], log2_slots);
+			sc->sondage = (log2_slots == MPM_SLOTS_MAX_LOG2) && !kdf_egales(&sc->kdf_indice, kdf);
+		}
+	}
+	sc->lanes = cw_kdf_passage(kdf);  // borné par scan_calcul(), voir cw_kdf_repartition()
+	tw_mutex_init(&sc->mutex);
+	return sc;
+}
+
+/** 
+ *  \brief Arrête le calcul s'il est encore en cours, et attend la fin de son thread
+ *  \note 
+ *  - les threads s'arrêtent au lot suivant, sans finir la recherche complète : un essai abandonné ou un fichier réécrit 
+ *    n'a pas à attendre toutes les KDF
+ *  - les couples non reconnus avant l'arrêt rendent MPM_TRY_CANCELLED, voir t_database::try_finish()
+ */
+static void scan_annule(t_scan_holder *sc) {
+	if (!sc->thread_lance) return;
+	tw_mutex_lock(&sc->mutex);
+	if (!sc->termine) sc->annule = true;
+	tw_mutex_unlock(&sc->mutex);
+	tw_thread_join(sc->thread);
+	sc->thread_lance = false;
+}
+
+/** \brief Indique si scan_annule() a demandé l'arrêt du calcul */
+static bool scan_annule_demande(t_scan_holder *sc) {
+	tw_mutex_lock(&sc->mutex);
+	bool annule = sc->annule;
+	tw_mutex_unlock(&sc->mutex);
+	return annule;
+}
+
+/** 
+ *  \brief Libère un calcul, après l'avoir arrêté, et efface les données sensibles
+ */
+static void scan_free(t_scan_holder *sc) {
+	scan_annule(sc);
+	for (int p=0; p<sc->nb_paires; p++) {
+		free(sc->nicknames[p]);
+		if (sc->passwords[p]) {
+			memset(sc->passwords[p], 0, strlen(sc->passwords[p]));
+			free(sc->passwords[p]);
+		}
+		if (sc->chunks[p]) {
+			memset(sc->chunks[p], 0, CHUNK_HOLDER_SIZE);
+			free(sc->chunks[p]);
+		}
+	}
+	memset(sc->pkeys, 0, sizeof(sc->pkeys));
+	for (int a=0; a<sc->nb_arenas; a++) cw_kdf_ctx_free(sc->arenas[a]);
+	if (sc->vue != NULL) {
+		vue_rend(sc->vue);
+	} else if (sc->blocs != NULL) {
+		memset(sc->blocs, 0, sc->taille);
+		free(sc->blocs);
+	}
+	tw_mutex_destroy(&sc->mutex);
+	free(sc);
+}
+
+/** 
+ *  \brief Arrête le calcul, puis lui fait rendre sa référence sur la projection du fichier
+ *  \note 
+ *  - invoqué par t_database::clear_chunks_cache() avant la réécriture du fichier
+ *  - les résultats obtenus (trouve, chunks, pkeys) sont conservés pour try_finish(), seuls les blocs ne sont plus accessibles
+ */
+static void scan_detache_vue(t_scan_holder *sc) {
+	if (sc->vue == NULL) return;
+	scan_annule(sc);
+	vue_rend(sc->vue);
+	sc->vue = NULL;
+	sc->blocs = NULL;
+	sc->taille = 0;
+}
+
+/** 
+ *  \brief Prend une mémoire de travail pour les KDF d'un thread de scan_calcul()
+ *  \note 
+ *  - les mémoires rendues par les threads d'une étape servent aux threads des étapes suivantes, elles ne sont effacées 
+ *    qu'une fois par scan_free()
+ */
+static t_cw_kdf_ctx *scan_arena_prend(t_scan_holder *sc) {
+	t_cw_kdf_ctx *ctx = NULL;
+
+	tw_mutex_lock(&sc->mutex);
+	if (sc->nb_arenas > 0) ctx = sc->arenas[--sc->nb_arenas];
+	tw_mutex_unlock(&sc->mutex);
+	return ctx ? ctx : cw_kdf_ctx_new();
+}
+
+/** 
+ *  \brief Rend une mémoire de travail prise par scan_arena_prend()
+ */
+static void scan_arena_rend(t_scan_holder *sc, t_cw_kdf_ctx *ctx) {
+	tw_mutex_lock(&sc->mutex);
+	assert(sc->nb_arenas < TW_MAX_THREADS);
+	sc->arenas[sc->nb_arenas++] = ctx;
+	tw_mutex_unlock(&sc->mutex);
+}
+
+/** 
+ *  \brief Nombre de threads d'une étape de scan_calcul(), au plus un par coeur et dans la limite de MPM_KDF_MEMOIRE_MAX
+ *  \param[in] memoire  Mémoire de travail de chaque thread, voir cw_kdf_memoire()
+ *  \param[in] nb       Nombre de travaux de l'étape
+ */
+static int scan_threads(size_t memoire, int nb) {
+	int nb_threads = (nb < tw_nb_cpu()) ? nb : tw_nb_cpu();
+
+	while ((nb_threads > 1) && ((size_t)nb_threads * memoire > MPM_KDF_MEMOIRE_MAX)) nb_threads--;
+	return nb_threads;
+}
+
+/** 
+ *  \brief Note qu'une KDF d'un couple n'a pas pu être calculée, faute de mémoire (voir cw_kdf_ctx_arena() )
+ *  \note 
+ *  - le calcul continue pour les autres blocs et les autres couples. try_finish() rendra MPM_TRY_MEMORY si le couple n'est pas trouvé
+ */
+static void scan_memoire(t_scan_holder *sc, int p) {
+	tw_mutex_lock(&sc->mutex);
+	sc->memoire[p] = true;
+	tw_mutex_unlock(&sc->mutex);
+}
+
+/** 
+ *  \brief Travail d'un thread de scan_calcul() : test du bloc désigné par l'emplacement préféré de chaque couple
+ *  \note 
+ *  - chaque thread prend le couple suivant, comme pkey_holder_thread()
+ */
+static void indice_holder_thread(void *arg) {
+	t_scan_holder *sc = (t_scan_holder*)arg;
+	unsigned char calculs[64]; // hash puis pkey
+	t_chunk_holder *chunk;
+	t_cw_kdf_ctx *ctx = scan_arena_prend(sc);
+	int p, ok;
+
+	while (true) {
+		tw_mutex_lock(&sc->mutex);
+		do {
+			p = sc->prochain++;
+		} while ((p < sc->nb_paires) && (sc->indice[p] < 0));
+		if (sc->annule) p = sc->nb_paires;
+		tw_mutex_unlock(&sc->mutex);
+		if (p >= sc->nb_paires) break;
+
+		chunk = (t_chunk_holder*)(sc->blocs + (size_t)sc->indice[p]*CHUNK_HOLDER_SIZE);
+		if (sc->speculation) ok = cw_kdf_double(calculs, sc->nicknames[p], chunk->salt1, chunk->salt2, sc->passwords[p], &sc->kdf_indice, ctx);
+		else ok = cw_kdf(calculs, sc->nicknames[p], chunk->salt1, sc->passwords[p], &sc->kdf_indice, ctx);
+		if (!ok) {
+			scan_memoire(sc, p);
+		} else if (memcmp(chunk->hash, calculs, 32) ==0) {
+			tw_mutex_lock(&sc->mutex);
+			sc->trouve[p] = sc->indice[p];
+			sc->kdf_trouve[p] = sc->kdf_indice;
+			if (sc->speculation) {
+				memcpy(&sc->pkeys[32*p], calculs+32, 32);
+				sc->pkey_speculee[p] = true;
+			}
+			tw_mutex_unlock(&sc->mutex);
+		}
+	}
+	memset(calculs, 0, sizeof(calculs));
+	scan_arena_rend(sc, ctx);
+}
+
+/** 
+ *  \brief Travail d'un thread de scan_calcul() : recherche des chunks
+ *  \note 
+ *  - un travail est un lot de sc->lanes blocs pour un couple nickname/MdP, calculé en un seul passage par cw_kdf_multi()
+ *  - les lots sont distribués dans l'ordre croissant des blocs, en alternant les couples. Quand un bloc est reconnu pour un couple, 
+ *    ses lots suivants sont sautés, mais les lots précédents encore en cours sont terminés : on garde ainsi le même résultat que 
+ *    le parcours séquentiel
+ *  - seuls les couples de sc->restants sont concernés, et le bloc de leur emplacement préféré est sauté s'il a déjà été testé 
+ *    avec la même KDF
+ */
+static void scan_holder_thread(void *arg) {
+	t_scan_holder *sc = (t_scan_holder*)arg;
+	unsigned char hash_calcule[32*CW_SHA256_MAX_LANES];
+	unsigned char *salts[CW_SHA256_MAX_LANES];
+	int index[CW_SHA256_MAX_LANES];
+	t_chunk_holder *chunk;
+	t_cw_kdf_ctx *ctx = scan_arena_prend(sc);
+	int i, n, p, r, max_trouve;
+
+	while (true) {
+		tw_mutex_lock(&sc->mutex);
+		max_trouve = 0;
+		for (r=0; r<sc->nb_restants; r++) if (sc->trouve[sc->restants[r]] > max_trouve) max_trouve = sc->trouve[sc->restants[r]];
+		p = sc->restants[sc->prochain % sc->nb_restants];
+		i = (sc->prochain / sc->nb_restants) * sc->lanes;
+		bool fini = sc->annule || (i >= sc->nb_blocs) || (i > max_trouve);
+		bool inutile = (i > sc->trouve[p]);
+		n = sc->nb_blocs - i;
+		if (n > sc->lanes) n = sc->lanes;
+		if (!fini) sc->prochain++;
+		tw_mutex_unlock(&sc->mutex);
+		if (fini) break;
+		if (inutile) continue;
+
+		int nb = 0;
+		for (int l=0; l<n; l++) {
+			if ((i+l == sc->indice[p]) && sc->saute_indice) continue;
+			index[nb] = i+l;
+			salts[nb++] = ((t_chunk_holder*)(sc->blocs + (size_t)(i+l)*CHUNK_HOLDER_SIZE))->salt1;
+		}
+		if (nb == 0) continue;
+		if (!cw_kdf_multi(hash_calcule, nb, sc->nicknames[p], salts, sc->passwords[p], &sc->kdf_passe, ctx)) scan_memoire(sc, p);
+		for (int l=0; l<nb; l++) {
+			chunk = (t_chunk_holder*)(sc->blocs + (size_t)index[l]*CHUNK_HOLDER_SIZE);
+			if (memcmp(chunk->hash, &hash_calcule[32*l], 32) ==0) {
+				tw_mutex_lock(&sc->mutex);
+				if (index[l] < sc->trouve[p]) sc->trouve[p] = index[l];
+				tw_mutex_unlock(&sc->mutex);
+				break;
+			}
+		}
+	}
+	scan_arena_rend(sc, ctx);
+}
+
+/** 
+ *  \brief Travail d'un thread de scan_calcul() : calcul des clés et déchiffrement des chunks reconnus
+ *  \note 
+ *  - chaque thread prend le couple suivant, de sorte que les dérivations se font en même temps et non l'une après l'autre
+ */
+static void pkey_holder_thread(void *arg) {
+	t_scan_holder *sc = (t_scan_holder*)arg;
+	t_chunk_holder *chunk;
+	t_cw_kdf_ctx *ctx = scan_arena_prend(sc);
+	int p;
+
+	while (true) {
+		tw_mutex_lock(&sc->mutex);
+		do {
+			p = sc->prochain++;
+		} while ((p < sc->nb_paires) && (sc->chunks[p] == NULL));
+		tw_mutex_unlock(&sc->mutex);
+		if (p >= sc->nb_paires) break;
+
+		chunk = sc->chunks[p];
+		if (!sc->pkey_speculee[p] && !cw_kdf(&sc->pkeys[32*p], sc->nicknames[p], chunk->salt2, sc->passwords[p], &sc->kdf_trouve[p], ctx)) {
+			scan_memoire(sc, p);
+			memset(chunk, 0, CHUNK_HOLDER_SIZE); // sans sa clé, le chunk reconnu reste inutilisable
+			free(chunk);
+			sc->chunks[p] = NULL;
+			continue;
+		}
+		cw_aes_cbc((unsigned char*)chunk + CHUNK_HOLDER_AES_OFFSET, CHUNK_HOLDER_AES_SIZE, &sc->pkeys[32*p], chunk->salt1, 0);
+	}
+	scan_arena_rend(sc, ctx);
+}
+
+/** 
+ *  \brief Recherche complète des couples non encore reconnus, avec une KDF donnée
+ *  \note 
+ *  - invoqué par scan_calcul() avec la KDF de la base, puis avec celle de l'ancre quand la table a atteint MPM_SLOTS_MAX_LOG2 : 
+ *    save_chunks_holders() y range les collisions à l'emplacement libre suivant, que seule la recherche complète trouve
+ */
+static void scan_passe(t_scan_holder *sc, const t_cw_kdf *kdf) {
+	int p, nb_threads;
+
+	sc->nb_restants = 0;
+	for (p=0; p<sc->nb_paires; p++) if (sc->trouve[p] == sc->nb_blocs) sc->restants[sc->nb_restants++] = p;
+	if ((sc->nb_restants == 0) || scan_annule_demande(sc)) return;
+	sc->kdf_passe = *kdf;
+	sc->saute_indice = kdf_egales(kdf, &sc->kdf_indice);
+
+	// Pas plus de threads que de lots : sur une petite base, mieux vaut remplir les lanes SIMD
+	nb_threads = tw_nb_cpu();
+	sc->lanes = cw_kdf_repartition(kdf, &nb_threads);
+	if (nb_threads > sc->nb_restants * ((sc->nb_blocs + sc->lanes - 1) / sc->lanes)) nb_threads = sc->nb_restants * ((sc->nb_blocs + sc->lanes - 1) / sc->lanes);
+	#ifdef DEBUG 
+	debug_printf(0, (char*)"%s() %d blocs à tester pour %d holders sur %d threads\n", __func__, sc->nb_blocs, sc->nb_restants, nb_threads);
+	#endif
+	sc->prochain = 0;
+	if (nb_threads > 0) tw_parallel(nb_threads, scan_holder_thread, sc);
+	for (int r=0; r<sc->nb_restants; r++) {
+		if (sc->trouve[sc->restants[r]] < sc->nb_blocs) sc->kdf_trouve[sc->restants[r]] = *kdf;
+	}
+}
+
+/** 
+ *  \brief Effectue un calcul de recherche de chunks holders, directement ou dans un thread lancé par t_database::try_async()
+ *  \note 
+ *  - le bloc de l'emplacement préféré de chaque couple est testé d'abord (voir indice_holder_thread()) : avec le bon MdP sur un 
+ *    fichier CHUNK_HOLDER_VERSION 2, c'est la seule KDF calculée. S'il reste des coeurs, la clé du bloc est calculée en même 
+ *    temps, avant de savoir si le hash correspond
+ *  - pour les couples restants, les blocs sont répartis entre un thread par coeur (voir scan_holder_thread()), un bloc reconnu arrête la distribution pour ce couple.
+ *    Le bloc de l'emplacement préféré n'est sauté que s'il a été testé avec la même KDF : sur un fichier de version 1, le premier 
+ *    bloc n'est pas une ancre, et peut en avoir l'air
+ *  - chaque thread calcule plusieurs blocs à la fois avec le moteur SHA-256 multi-lanes quand le processeur le permet
+ *  - les threads et les lanes de chaque étape sont bornés par MPM_KDF_MEMOIRE_MAX : à coût élevé, chaque lane a sa propre 
+ *    mémoire de 32 octets par itération
+ *  - les chunks reconnus sont recopiés puis déchiffrés (voir pkey_holder_thread()), les blocs restent intacts
+ *  - scan_annule() arrête les threads entre deux lots, et le calcul entre deux étapes
+ */
+static void scan_calcul(void *arg) {
+	t_scan_holder *sc = (t_scan_holder*)arg;
+	int p, nb_trouves, nb_threads;
+
+	// Emplacements préférés
+	nb_threads = 0;
+	for (p=0; p<sc->nb_paires; p++) if (sc->indice[p] >= 0) nb_threads++;
+	if (nb_threads > 0) { // cw_kdf_double() : un passage de 2 sels, ou 2 calculs dans 2 threads
+		size_t memoire = cw_kdf_memoire(&sc->kdf_indice, 2);
+		if (memoire < 2 * cw_kdf_memoire(&sc->kdf_indice, 1)) memoire = 2 * cw_kdf_memoire(&sc->kdf_indice, 1);
+		nb_threads = scan_threads(memoire, nb_threads);
+	}
+	sc->prochain = 0;
+	sc->speculation = (nb_threads > 0) && cw_kdf_double_gratuit(&sc->kdf_indice, nb_threads);
+	if (nb_threads > 0) tw_parallel(nb_threads, indice_holder_thread, sc);
+
+	// Recherche complète, avec la KDF de la base puis, si la table a débordé, avec celle de l'ancre
+	scan_passe(sc, &sc->kdf);
+	if (sc->sondage) scan_passe(sc, &sc->kdf_indice);
+
+	// Après scan_annule(), les blocs vont disparaître : les chunks déjà reconnus ne sont pas recopiés
+	bool annule = scan_annule_demande(sc);
+	nb_trouves = 0;
+	for (p=0; p<sc->nb_paires; p++) {
+		if ((sc->trouve[p] < sc->nb_blocs) && !annule) { // chunk trouvé
+			#ifdef DEBUG 
+			debug_printf(0, (char*)"%s() f=%s l=%d chunk de %s trouvé en position %d\n",(char*)__func__,(char*) __FILE__, __LINE__, sc->nicknames[p], sc->trouve[p]);
+			#endif
+			sc->chunks[p] = (t_chunk_holder*)malloc(CHUNK_HOLDER_SIZE);
+			if (sc->chunks[p] == NULL) {
+				sc->memoire[p] = true; // try_finish() rendra MPM_TRY_MEMORY
+				continue;
+			}
+			memcpy((void*)sc->chunks[p], sc->blocs + (size_t)sc->trouve[p]*CHUNK_HOLDER_SIZE, CHUNK_HOLDER_SIZE);
+			nb_trouves++;
+		}
+	}
+	sc->prochain = 0;
+	size_t memoire = cw_kdf_memoire(&sc->kdf, 1);
+	if (memoire < cw_kdf_memoire(&sc->kdf_indice, 1)) memoire = cw_kdf_memoire(&sc->kdf_indice, 1); // voir kdf_trouve
+	nb_threads = scan_threads(memoire, nb_trouves);
+	tw_parallel(nb_threads, pkey_holder_thread, sc);
+
+	// Les MdP ne sont plus utiles
+	for (p=0; p<sc->nb_paires; p++) {
+		memset(sc->passwords[p], 0, strlen(sc->passwords[p]));
+		free(sc->passwords[p]);
+		sc->passwords[p] = NULL;
+	}
+
+	tw_mutex_lock(&sc->mutex);
+	sc->termine = true;
+	tw_mutex_unlock(&sc->mutex);
+}
+
+/** 
+ *  \brief Prépare un calcul de recherche dans le fichier
+ *  \return le calcul, NULL si le fichier n'a pas pu être lu
+ *  \note 
+ *  - les threads travaillent directement dans la projection du fichier (voir vue_fichier()), sans copie
+ *  - si common_index est déjà connu, seuls les chunks holders sont testés, la base common chiffrée est ignorée
+ */
+t_scan_holder *t_database::scan_fichier(int n, char **nicknames, char **passwords) {
+	t_vue_fichier *v = vue_fichier();
+	long taille;
+
+	if (v == NULL) return NULL;
+	taille = chunks_connus ? (long)common_index*CHUNK_HOLDER_SIZE : v->taille;
+	return scan_new(n, nicknames, passwords, v->data, taille, v, true, &kdf);
+}
+
+/** 
+ *  \brief Après un calcul de recherche dans le fichier, recherche le marqueur common pour connaître common_index
+ *  \note 
+ *  - la recherche du marqueur common, qui ne coûte que trois sha par bloc, reste séquentielle
+ *  - part de la position du premier holder trouvé
+ *  - le hash du marqueur donne aussi le format de la base common (common_format) : MPM_COMMON_PAGES_Z ou MPM_COMMON_PAGES,
+ *    ou MPM_COMMON_CBC pour un fichier écrit par une version précédente
+ *  - une fois le marqueur trouvé, common_index est connu (chunks_connus), et les essais suivants (MdP erroné, autre holder)
+ *    ne testent plus que les chunks holders
+ */
+void t_database::scan_marqueur_common(t_scan_holder *sc) {
+	t_common_marker *cm;
+	unsigned char hash_calcule[32];
+	int i, p, f, format, premier=-1;
+	static const struct { uint64_t domaine; int format; } formats[3] = {
+		{MPM_COMMON_PAGES_Z_DOMAINE, MPM_COMMON_PAGES_Z}, {MPM_COMMON_PAGES_DOMAINE, MPM_COMMON_PAGES}, {0, MPM_COMMON_CBC}
+	};
+
+	if (!sc->fichier || chunks_connus || (sc->blocs == NULL)) return;
+	for (p=0; p<sc->nb_paires; p++) {
+		if ((sc->chunks[p] != NULL) && ((premier < 0) || (sc->trouve[p] < sc->trouve[premier]))) premier = p;
+	}
+	if (premier < 0) return;
+
+	for (i=sc->trouve[premier]; (long)i*CHUNK_HOLDER_SIZE + (long)sizeof(t_common_marker) <= sc->taille; i++) {
+		cm = (t_common_marker*)(sc->blocs + (size_t)i*CHUNK_HOLDER_SIZE);
+		format = -1;
+		for (f=0; (f<3) && (format<0); f++) {
+			cw_sha256_mix2(hash_calcule, cm->salt, sc->chunks[premier]->common_magic ^ formats[f].domaine);
+			if (memcmp(cm->hash, hash_calcule, 32)==0) format = formats[f].format;
+		}
+		if (format >= 0) {
+			#ifdef DEBUG
+			debug_printf(0,(char*)"%s() Marqueur 'common' trouvé en position %d, format %d\n", (char*)__func__, i, format);
+			#endif
+			common_format = format;
+			common_magic = sc->chunks[premier]->common_magic; // celui du fichier : un chunk réécrit par journalise() doit le garder
+			if (common_index==0) {
+				common_index=i;
+			} else {
+				if (common_index != i) {
+					#ifdef DEBUG
+					debug_printf(0, (char*)"%s() incohérence common_index=%d i=%d\n",(char*)__func__,common_index, i);
+					#endif
+				}
+			}
+			if (common_index == i) { // les essais suivants se limiteront aux chunks holders
+				chunks_connus = true;
+			}
+			break;
+		}
+	}
+}
+
+/** 
+ *  \brief Recherche un chunk de holder dans le fichier étant donnée un nickname et MdP
+ *  \return pointeur sur un bloc nouvellement malloc()é pour contenir le chunk déchiffré, ou NULL si raté
+ *  \param[in]   nickname    Le nickname utilisé en entrée pour la crypto
+ *  \param[in]   password    Le password qu'on utilise avec dans le test crypto
  *  \param[out]  file_index  Renseigne le file_index, si le chunk a été trouvé
  *  \param[out]  pkey        Renseigne la clé de holder, si le chunk a été trouvé. Doit être conservé pour le save() (des fois que la holder ne change pas son MdP, on ne saurait pas la recalculer)
  *  \note 
- *  - invoqué par t_database::try_nickname() dans le cas ou la base n'est pas encore ouverte au niveau common
- *  - teste les blocs de CHUNK_HOLDER_SIZE à la suite, et teste le hash pour voir si ça correspond
- *  - max_holder indique le nombre max de chunks à tenter. passer 0 si on ne connait pas encore le nb de holders, ce qui est le cas pour le tout premier try
+ *  - cas particulier de find_chunk_holders() pour un seul holder
+ */
+t_chunk_holder * t_database::find_chunk_holder(char *nickname, char *password, int *file_index, unsigned char *pkey) {
+	t_chunk_holder *chunk;
+	int fi;
+	unsigned char pk[32];
+
+	if (find_chunk_holders(1, &nickname, &password, &chunk, &fi, pk) == 0) return NULL;
+	if (file_index) *file_index=fi;
+	if (pkey) memcpy(pkey, pk, 32); 
+	memset(pk, 0, 32);
+	return chunk;
+}
+
+/** 
+ *  \brief Recherche les chunks de plusieurs holders dans le fichier, en un seul passage
+ *  \return le nombre de chunks trouvés
+ *  \param[in]   n             Le nombre de couples nickname/MdP, au plus MPM_TRY_MAX_BATCH
+ *  \param[in]   nicknames     Les nicknames utilisés en entrée pour la crypto
+ *  \param[in]   passwords     Les passwords correspondants
+ *  \param[out]  chunks        Pour chaque couple, un bloc nouvellement malloc()é contenant le chunk déchiffré, ou NULL si raté
+ *  \param[out]  file_indexes  Renseigne le file_index de chaque chunk trouvé
+ *  \param[out]  pkeys         Renseigne la clé de chaque holder trouvé, 32 octets par couple. Doit être conservé pour le save()
+ *  \note 
+ *  - le fichier n'est lu qu'une fois, et chaque bloc est testé contre tous les couples : le temps total est celui de la 
+ *    recherche la plus longue, et non la somme des recherches
+ *  - version synchrone de ce que fait try_async() avant l'ouverture de la base common
+ */
+int t_database::find_chunk_holders(int n, char **nicknames, char **passwords, t_chunk_holder **chunks, int *file_indexes, unsigned char *pkeys) {
+	t_scan_holder *sc;
+	int p, nb_trouves=0;
+
+	for (p=0; p<n; p++) chunks[p]=NULL;
+	sc = scan_fichier(n, nicknames, passwords);
+	if (sc == NULL) return 0;
+	scan_calcul(sc);
+	scan_marqueur_common(sc);
+
+	for (p=0; p<n; p++) {
+		if (sc->chunks[p] == NULL) continue;
+		chunks[p] = sc->chunks[p];
+		sc->chunks[p] = NULL;
+		file_indexes[p] = sc->trouve[p];
+		memcpy(&pkeys[32*p], &sc->pkeys[32*p], 32);
+		nb_trouves++;
+	}
+	scan_free(sc);
+	return nb_trouves;
+}
+
+/** 
+ *  \brief Nombre de blocs qu'une recherche complète aurait à tester, pour kdf_projection()
+ *  \note 
+ *  - si la base a déjà été sauvée, c'est le fichier entier : au premier try, rien ne permet de s'arrêter avant le marqueur common
+ *  - sinon, estimation d'après le nombre de holders : premier bloc, table d'emplacements et marqueur common
+ */
+int t_database::nb_blocs_recherche() {
+	FILE *f;
+	long filesize = 0;
+	tdllist *gl;
+	int n, log2_slots;
+
+	if (filename != NULL) {
+		f = fopen(filename, "rb");
+		if (f != NULL) {
+			fseek(f, 0, SEEK_END);
+			filesize = ftell(f);
+			fclose(f);
+		}
+	}
+	if (filesize >= CHUNK_HOLDER_SIZE) return (int)(filesize / CHUNK_HOLDER_SIZE);
+
+	n = 0;
+	for (gl = holders; gl != NULL; gl = gl->next) n++;
+	if (n < nb_holders) n = nb_holders;
+	log2_slots = MPM_SLOTS_MIN_LOG2;
+	while ((1 << log2_slots) < n) log2_slots++;
+	return 1 + (1 << log2_slots) + 1;
+}
+
+/** \brief Paramètres de kdf_mesure_thread() */
+typedef struct t_kdf_mesure {
+	t_cw_kdf kdf;
+	int nb_sels;
+} t_kdf_mesure;
+
+/** 
+ *  \brief Une KDF sur m->nb_sels sels, comme un lot de scan_holder_thread()
+ */
+static void kdf_mesure_thread(void *arg) {
+	t_kdf_mesure *m = (t_kdf_mesure*)arg;
+	unsigned char salt[32], results[32*CW_SHA256_MAX_LANES];
+	unsigned char *salts[CW_SHA256_MAX_LANES];
+
+	random_bytes(salt, 32);
+	for (int i=0; i<CW_SHA256_MAX_LANES; i++) salts[i] = salt;
+	cw_kdf_multi(results, m->nb_sels, (char*)"calibrate", salts, (char*)"calibrate", &m->kdf, NULL);
+}
+
+/** 
+ *  \brief Mesure la durée d'une KDF sur la machine courante
+ *  \param[in] nb_sels     Nombre de sels calculés ensemble, voir cw_kdf_passage()
+ *  \param[in] nb_threads  Nombre de KDF simultanées
+ *  \return la durée en secondes, la meilleure de plusieurs mesures
+ *  \note 
+ *  - au moins 3 mesures et 0,1s de calcul, pour que les coûts faibles ne soient pas noyés dans la résolution de l'horloge
+ */
+static double kdf_mesure(const t_cw_kdf *kdf, int nb_sels, int nb_threads) {
+	t_kdf_mesure m;
+	double debut, duree, meilleure = -1, total = 0;
+
+	m.kdf = *kdf;
+	m.nb_sels = nb_sels;
+	for (int essai=0; (essai < 3) || (total < 0.1); essai++) {
+		debut = tw_horloge();
+		tw_parallel(nb_threads, kdf_mesure_thread, &m);
+		duree = tw_horloge() - debut;
+		total += duree;
+		if ((meilleure < 0) || (duree < meilleure)) meilleure = duree;
+	}
+	return meilleure;
+}
+
+/** 
+ *  \brief Projette la durée d'un try pour une KDF donnée, sur la machine courante
+ *  \param[in]  kdf       La KDF, de coût entre MPM_KDF_COST_MIN et MPM_KDF_COST_MAX
+ *  \param[in]  nb_blocs  Blocs testés par une recherche complète, voir t_database::nb_blocs_recherche()
+ *  \param[out] cal       Les durées mesurées et projetées
+ *  \note 
+ *  - la recherche complète est répartie comme dans scan_calcul() : lots de cw_kdf_passage() blocs, un thread par coeur, 
+ *    moins si la mémoire de travail dépasse MPM_KDF_MEMOIRE_MAX (voir cw_kdf_repartition()).
+ *    Un tour de lots est mesuré avec tous les threads, qui se partagent la bande passante mémoire
+ */
+void kdf_projection(const t_cw_kdf *kdf, int nb_blocs, t_kdf_calibration *cal) {
+	int nb_lots, nb_tours;
+	double duree_tour;
+
+	assert((kdf->cout >= MPM_KDF_COST_MIN) && (kdf->cout <= MPM_KDF_COST_MAX));
+	cal->kdf = *kdf;
+	cal->nb_blocs = nb_blocs;
+	cal->nb_threads = tw_nb_cpu();
+	cal->lanes = cw_kdf_repartition(kdf, &cal->nb_threads);
+	cal->duree_kdf = kdf_mesure(kdf, 1, 1);
+	cal->duree_try = 2 * cal->duree_kdf;
+
+	nb_lots = (nb_blocs + cal->lanes - 1) / cal->lanes;
+	if (cal->nb_threads > nb_lots) cal->nb_threads = nb_lots;
+	if (cal->nb_threads < 1) cal->nb_threads = 1;
+	nb_tours = (nb_lots + cal->nb_threads - 1) / cal->nb_threads;
+	duree_tour = kdf_mesure(kdf, cal->lanes, cal->nb_threads);
+	cal->duree_pire = cal->duree_kdf + nb_tours * duree_tour;
+
+	#ifdef DEBUG
+	debug_printf(0, (char*)"%s() kdf=%d coût=%d %.4fs %d blocs en %d tours de %.4fs sur %d threads\n", __func__, kdf->algo, kdf->cout, cal->duree_kdf, nb_blocs, nb_tours, duree_tour, cal->nb_threads);
+	#endif
+}
+
+/** 
+ *  \brief Choisit le coût de KDF le plus élevé pour lequel un try avec le bon MdP tient dans la durée cible
+ *  \param[in]  cible_ms  Durée cible d'un try, en millisecondes
+ *  \param[in]  nb_blocs  Voir kdf_projection()
+ *  \param[in]  modele    Algorithme et lanes de la KDF, le coût est ignoré
+ *  \param[out] cal       Le coût retenu et ses durées. MPM_KDF_COST_MIN si même ce coût dépasse la cible
+ *  \note 
+ *  - extrapolation depuis le coût minimum, le temps doublant à chaque incrément, puis vérification au coût retenu : 
+ *    au-delà des caches du processeur, le temps croît plus vite que la mémoire ou le nombre d'itérations
  */
-t_chunk_holder * t_database::find_chunk_holder(char *nickname, char *password, int *file_index, unsigned char *pkey) {
-	FILE *f;
-	t_chunk_holder *chunk, *find_chunk;
-	t_common_marker *cm;
-	int lus, i;
-	unsigned char hash_calcule[32];
-	bool trouve_holder;
-	bool trouve_common;
-
-	find_chunk=NULL;
-	chunk = (t_chunk_holder*)alloca(CHUNK_HOLDER_SIZE);
-	cm = (t_common_marker*)chunk;
-	f = fopen(filename,"r+b"); /* Note : sous Windows, ne pas oublier le '+b' */
-	i=0;
-	trouve_holder=trouve_common=false;
-	while (!feof(f)) {
-		lus=fread(chunk, 1, CHUNK_HOLDER_SIZE, f);
-		#ifdef DEBUG 
-		debug_printf(0, (char*)"Lu le bloc no %d de taille %d\n", i, lus);
-		#endif
-		if (!trouve_holder) if (lus == CHUNK_HOLDER_SIZE) {	
-			//cw_database_find_chunk_holder_hash(nickname, (unsigned char*)chunk->salt1, password, (unsigned char*)hash_calcule);
-			cw_sha256_iterated_mix1(hash_calcule, nickname, chunk->salt1, password);
-			
-			if (memcmp(chunk->hash,hash_calcule,32 ) ==0) { // chunk trouvé
-				#ifdef DEBUG 
-				debug_printf(0, (char*)"%s() f=%s l=%d chunk trouvé en position %d\n",(char*)__func__,(char*) __FILE__, __LINE__, i);
-				#endif
-				trouve_holder=true; 
-				if (file_index) *file_index=i;
-
-
-				find_chunk=(t_chunk_holder*)malloc(CHUNK_HOLDER_SIZE);
-				//memcpy((void*)find_chunk, (void*)chunk, CHUNK_HOLDER_SIZE); // nb : la partie chiffrée est recopiée pour rien
-				//cw_database_find_chunk_holder_pkey(nickname, (unsigned char*)chunk->salt2, password, (unsigned char*)hash_calcule);
-				cw_sha256_iterated_mix1(hash_calcule, nickname, chunk->salt2, password);
-				//cw_holder_dechiffre_chunk((unsigned char*)find_chunk, (unsigned char*)chunk, (unsigned char*)hash_calcule, chunk->salt1);
-				cw_aes_cbc((unsigned char*)chunk + CHUNK_HOLDER_AES_OFFSET, CHUNK_HOLDER_AES_SIZE, hash_calcule, chunk->salt1, 0);
-				memcpy((void*)find_chunk, (void*)chunk, CHUNK_HOLDER_SIZE);
-				if (pkey) memcpy(pkey, (unsigned char*)hash_calcule, 32); 
-			}
-		}
-		if (trouve_holder & !trouve_common) {
-			//cw_database_find_chunk_common((unsigned char*)cm->salt, find_chunk->common_magic, (unsigned char*)hash_calcule);
-			cw_sha256_mix2(hash_calcule, cm->salt, find_chunk->common_magic);
-			if (memcmp(cm->hash, hash_calcule, 32)==0) {
-				#ifdef DEBUG
-				debug_printf(0,(char*)"%s() Marqueur 'common' trouvé en position %d\n", (char*)__func__, i);
-				#endif
-				if (nb_holders==0) {
-					nb_holders=i;
-				} else {
-					if (nb_holders != i) {
-						#ifdef DEBUG
-						debug_printf(0, (char*)"%s() incohérence nb_holders=%d i=%d\n",(char*)__func__,nb_holders, i);
-						#endif
-					}
-				}
-				break;
-			}
-		}
-		i++;
+void kdf_calibrer(int cible_ms, int nb_blocs, const t_cw_kdf *modele, t_kdf_calibration *cal) {
+	double cible = cible_ms / 1000.0;
+	double duree;
+	t_cw_kdf kdf = *modele;
+
+	kdf.cout = MPM_KDF_COST_MIN;
+	duree = 2 * kdf_mesure(&kdf, 1, 1);
+	while ((kdf.cout < MPM_KDF_COST_MAX) && (2 * duree <= cible)) {
+		kdf.cout++;
+		duree *= 2;
 	}
-	fclose(f);	
-	return find_chunk;
+	while ((kdf.cout > MPM_KDF_COST_MIN) && (2 * kdf_mesure(&kdf, 1, 1) > cible)) kdf.cout--;
+	kdf_projection(&kdf, nb_blocs, cal);
 }
 
 /** 
@@ -648,72 +2781,157 @@ void t_database::compte_parts_necessaires(int *common_, int *secret_) {
 
 
 
+/** \brief Lecture déchiffrée d'une base common MPM_COMMON_CBC, tampon par tampon. Voir read_common_lit() */
+typedef struct t_read_common {
+	const unsigned char *source;              ///< prochain bloc chiffré, dans la projection du fichier
+	t_cw_aes *aes;                            ///< common_aes, flux CBC commencé par read_common()
+	unsigned char tampon[MPM_COMMON_TAMPON];  ///< clair déchiffré en place
+	long restant;                             ///< octets chiffrés encore à lire, multiple de 16
+	unsigned char *clair;                     ///< clair en cours de lecture, dans le tampon
+	size_t debut;                             ///< prochain octet de clair à rendre
+	size_t fin;                               ///< fin du clair disponible
+	bool fin_json;                            ///< le \0 qui termine le json a été rencontré
+	size_t longueur_json;                     ///< octets de json rendus
+} t_read_common;
+
+/** 
+ *  \brief Remplit le tampon avec les blocs suivants de la projection, déchiffrés
+ *  \return false à la fin du contenu chiffré
+ *  \note 
+ *  - la projection est en lecture seule : le chiffré est recopié dans le tampon, puis déchiffré en place
+ */
+static bool read_common_remplit(t_read_common *lc) {
+	size_t n = (lc->restant > MPM_COMMON_TAMPON) ? MPM_COMMON_TAMPON : (size_t)lc->restant;
+
+	if (n == 0) return false;
+	memcpy(lc->tampon, lc->source, n);
+	cw_aes_cbc_suite(lc->aes, lc->tampon, n);
+	lc->source += n;
+	lc->restant -= n;
+	lc->clair = lc->tampon;
+	lc->debut = 0;
+	lc->fin = n;
+	return true;
+}
+
+/** 
+ *  \brief Rend le json déchiffré, jusqu'au \0 qui le termine, par morceaux d'au plus len octets
+ *  \return le nombre d'octets rendus, 0 à la fin du json
+ *  \note 
+ *  - le json est passé au parseur au fur et à mesure du déchiffrement, sans être jamais entier en mémoire
+ */
+static size_t read_common_lit(t_read_common *lc, unsigned char *dest, size_t len) {
+	unsigned char *zero;
+	size_t n;
+
+	if (lc->fin_json) return 0;
+	if ((lc->debut == lc->fin) && !read_common_remplit(lc)) return 0;
+
+	n = lc->fin - lc->debut;
+	if (n > len) n = len;
+	zero = (unsigned char*)memchr(lc->clair + lc->debut, 0, n);
+	if (zero) n = zero - (lc->clair + lc->debut);
+	memcpy(dest, lc->clair + lc->debut, n);
+	lc->debut += n;
+	lc->longueur_json += n;
+	if (zero) {
+		lc->debut++; // le \0 n'est pas rendu
+		lc->fin_json = true;
+	}
+	return n;
+}
+
+/** 
+ *  \brief Contrôle d'intégrité, une fois le json lu jusqu'à son \0 : présence du MAGIC juste après le \0
+ */
+static bool read_common_integre(t_read_common *lc) {
+	char magic[8];
+	size_t n = 0;
+
+	while (n < 8) {
+		if ((lc->debut == lc->fin) && !read_common_remplit(lc)) return false;
+		magic[n++] = lc->clair[lc->debut++];
+	}
+	return (memcmp(magic, "MAGICCOM", 8) ==0);
+}
+
+#ifdef MPM_JANSSON
+/** \brief Callback de json_load_callback() */
+static size_t read_common_jansson(void *buffer, size_t buflen, void *data) {
+	return read_common_lit((t_read_common*)data, (unsigned char*)buffer, buflen);
+}
+#endif
+
 /** 
  *  \brief Lecture de la BDD common dans le fichier, après reconstitution de la clé
  *  \note 
  *  - invoqué par t_database::open_common()
  *  - traite la partie crypto avant d'invoquer t_database::read_json()
+ *  - la base common est lue dans la projection du fichier (voir vue_fichier()), déjà ouverte par les essais, et déchiffrée
+ *    par tampons de MPM_COMMON_TAMPON pour le format MPM_COMMON_CBC (voir t_read_common).
+ *    Avec Jansson, le json est parsé au fil du déchiffrement, et l'arbre n'est utilisé qu'une fois l'intégrité vérifiée
  *  - les structures glib-json sont allouées et libérées ici (principe ref/unref des g_object)
  */
 void t_database::read_common() {
-	long filesize;
-	long common_pos, lus, taille;
-	FILE *file;
-	unsigned char *buffer_chiffre;
-	unsigned char iv[16];
+	long common_pos, taille;
+	t_common_marker cm;
+	t_read_common *lc;
+	t_vue_fichier *v;
 
-	file = fopen(filename, "r+b");
-	if (file==NULL) {
-		fprintf(stderr, "Erreur à l'ouverture du fichier %s (%s)\n", filename, strerror(errno));
+	v = vue_fichier();
+	if (v == NULL) return;
+	common_pos = (long)common_index*CHUNK_HOLDER_SIZE;
+	if (v->taille < common_pos + (long)sizeof(t_common_marker)) {
+		fprintf(stderr, "Taille lue dans le fichier incohérente\n");
 		return;
 	}
+	if ((common_format == MPM_COMMON_PAGES) || (common_format == MPM_COMMON_PAGES_Z)) {
+		read_common_pages();
+		return;
+	}
+	vue_sequentielle(v, common_pos);
 
-	fseek(file, 0, SEEK_END);
-	filesize=ftell(file);
-
-	// Lis le marqueur de détection du chunk common, dont les 16 premiers octets servent d'IV
-	common_pos = nb_holders*CHUNK_HOLDER_SIZE;
-	fseek(file, common_pos, SEEK_SET);
-	fread (iv, 1, 16, file);
+	// Le marqueur de détection du chunk common : les 16 premiers octets servent d'IV en CBC
+	memcpy(&cm, v->data + common_pos, sizeof(t_common_marker));
 
-	// repositionne pour le contenu chiffré
+	// puis le contenu chiffré, multiple de 16 octets
 	common_pos += sizeof(t_common_marker);
-	taille=(filesize-common_pos)&(0xfffffffffffffff0);
-	fseek(file, common_pos, SEEK_SET); // nb : on a lu que 16 octets pour l'IV, donc il faut se positionner
+	taille = (v->taille-common_pos)&(0xfffffffffffffff0);
 
-	buffer_chiffre = (unsigned char*)malloc(taille+32);
+	lc = (t_read_common*)calloc(1, sizeof(t_read_common));
+	lc->source = v->data + common_pos;
+	lc->aes = common_aes;
+	lc->restant = taille;
+	cw_aes_cbc_debut(common_aes, cm.salt, 0);
 
 	#ifdef DEBUG
-	debug_printf(0,(char*)"%s() taille=%d common_pos=%d\n", __func__, taille, common_pos);
+	debug_printf(0,(char*)"%s() format=%d taille=%ld common_pos=%ld\n", __func__, common_format, taille, common_pos);
 	#endif	
 
-	lus = fread(buffer_chiffre, 1, taille, file);
-	#ifdef DEBUG
-	debug_printf(0,(char*)"%s() lus=%d\n", __func__, lus);
-	#endif
-
-	if (lus != taille) {
-		fprintf(stderr, "Taille lue dans le fichier incohérente\n");
+	// Interprete le json. Il doit se terminer par "\0MAGICCOM"
+	bool ok;
+
+	#ifdef MPM_GLIB_JSON
+	// json-glib ne parse qu'un buffer complet : le json est d'abord rassemblé
+	size_t taille_json = 0, alloue = MPM_COMMON_TAMPON;
+	unsigned char *json_clair = (unsigned char*)malloc(alloue);
+	size_t n;
+	while ((n = read_common_lit(lc, json_clair + taille_json, alloue - taille_json)) > 0) {
+		taille_json += n;
+		if (taille_json == alloue) {
+			unsigned char *plus = (unsigned char*)malloc(2*alloue);
+			memcpy(plus, json_clair, taille_json);
+			memset(json_clair, 0, alloue);
+			free(json_clair);
+			json_clair = plus;
+			alloue *= 2;
+		}
 	}
-
-	//cw_database_common_dechiffre(common_key, iv, buffer_clair, buffer_chiffre, taille );
-	cw_aes_cbc(buffer_chiffre, taille, common_key, iv, 0);
-	fclose(file);
-
-	// Vérifie la présence du MAGIC en fin du buffer json
-	// doit se terminer par "MAGICCOM\0"
-	bool ok=true;
-	ok = (strlen((char*)buffer_chiffre) > 20);
-	if (ok) ok = (memcmp(&buffer_chiffre[strlen((char*)buffer_chiffre)+1], "MAGICCOM", 8) ==0);
-
-	
-	// Interprete le json
+	ok = lc->fin_json && (lc->longueur_json > 20) && read_common_integre(lc);
 	if (ok) {
-	
-		#ifdef MPM_GLIB_JSON
 		JsonParser *parser = json_parser_new ();
 		GError *err = NULL;
-		if (!json_parser_load_from_data (parser, (const char*)buffer_chiffre, strlen((const char*)buffer_chiffre), &err)) {
+		if (!json_parser_load_from_data (parser, (const char*)json_clair, taille_json, &err)) {
 			#ifdef DEBUG
 			debug_printf(0, (char*)"%s() Erreur json_parser_load_from_data() GError=%s\n", __func__, err->message);
 			#endif		
@@ -725,27 +2943,417 @@ void t_database::read_common() {
 		}
 		read_json(json_parser_get_root (parser));
 		g_object_unref((gpointer)parser);
+	}
+	memset(json_clair, 0, alloue);
+	free(json_clair);
+	#endif
+
+	#ifdef  MPM_JANSSON
+	json_error_t err;
+	json_t * js = json_load_callback(read_common_jansson, lc, JSON_DISABLE_EOF_CHECK, &err);
+	if (js) {
+		// Le parseur peut s'arrêter avant le \0 : le reste du json est consommé pour trouver le MAGIC
+		unsigned char reste[256];
+		while (read_common_lit(lc, reste, sizeof(reste)) > 0) ;
+		memset(reste, 0, sizeof(reste));
+	} else {
+		#ifdef DEBUG
+		debug_printf(0, (char*)"%s() Erreur json_load_callback() json_err=%s\n", __func__, err.text);
+		#endif			
+	}
+	ok = lc->fin_json && (lc->longueur_json > 20) && read_common_integre(lc);
+	if (js) {
+		if (ok) read_json(js);
+		json_decref(js); // Supprime l'arbre json en mémoire
+	}
+	#endif
+
+	if (!ok) {
+		printf("Erreur d'intégrité de la base 'common'\n");
+		printf("La base est probablement inutilisable\n");
+	}
+	memset(lc, 0, sizeof(t_read_common));
+	free(lc);
+	
+}
+
+
+/**
+ *  \brief Note les pages référencées par le répertoire ou un groupe
+ *  \return false si une référence est hors du fichier, ou déjà vue : une page n'appartient qu'à un seul groupe
+ */
+static bool pages_note(t_lit_pages *lp, const t_page_ref *refs, int nb) {
+	for (int k=0; k<nb; k++) {
+		if ((refs[k].index >= lp->nb_dispo) || ((refs[k].index < lp->pg->capacite) && lp->pg->utilisee[refs[k].index])) return false;
+		pages_marque(lp->pg, refs[k].index);
+	}
+	return true;
+}
+
+/** \brief Ajoute au lot, pour les déchiffrer, des pages de la projection. Une référence hors du fichier donne une page non vérifiée */
+static void pages_charge(t_lit_pages *lp, const t_page_ref *refs, int nb) {
+	unsigned char *page;
+
+	for (int k=0; k<nb; k++) {
+		page = pages_lot_ajoute(&lp->lot, refs[k]);
+		if (refs[k].index < lp->nb_dispo) memcpy(page, lp->base + (size_t)refs[k].index*MPM_PAGE, MPM_PAGE); // la projection est en lecture seule
+		else lp->lot.ok[lp->lot.nb-1] = false;
+	}
+}
+
+/**
+ *  \brief Rassemble dans lp->clair des pages déchiffrées du lot, puis les décompresse en MPM_COMMON_PAGES_Z
+ *  \param[in] premier  Première page dans le lot
+ *  \param[in] taille   Longueur du clair, répartie sur les nb pages
+ *  \return false si une référence était hors du fichier, si un tag n'est pas vérifié, ou si le flux est invalide
+ */
+static bool pages_rassemble(t_lit_pages *lp, int premier, int nb, size_t taille) {
+	bool ok = true;
+	size_t n;
+
+	tampon_vide(&lp->clair);
+	if ((nb <= 0) || (taille > (size_t)nb*MPM_PAGE_CLAIR) || (taille <= (size_t)(nb-1)*MPM_PAGE_CLAIR)) return false;
+	for (int k=0; (k<nb) && ok; k++) {
+		ok = lp->lot.ok[premier+k];
+		if (ok) {
+			n = taille - (size_t)k*MPM_PAGE_CLAIR;
+			if (n > MPM_PAGE_CLAIR) n = MPM_PAGE_CLAIR;
+			tampon_ajoute(&lp->clair, lp->lot.data + (size_t)(premier+k)*MPM_PAGE + 12, n);
+		}
+	}
+	#ifdef MPM_ZLIB
+	if (ok && lp->comprime) ok = tampon_decomprime(&lp->clair, &lp->travail);
+	#endif
+	return ok;
+}
+
+/**
+ *  \brief Déchiffre des pages de la projection dans lp->clair, puis les décompresse en MPM_COMMON_PAGES_Z
+ *  \param[in] taille  Longueur du clair, répartie sur les nb pages
+ *  \return false si une référence est hors du fichier, si un tag n'est pas vérifié, ou si le flux est invalide
+ */
+static bool pages_lit(t_lit_pages *lp, const t_page_ref *refs, int nb, size_t taille) {
+	bool ok;
+
+	pages_lot_vide(&lp->lot);
+	pages_charge(lp, refs, nb);
+	pages_lot_traite(&lp->lot);
+	ok = pages_rassemble(lp, 0, nb, taille);
+	pages_lot_vide(&lp->lot);
+	return ok;
+}
+
+/**
+ *  \brief Lecture d'une base common MPM_COMMON_PAGES ou MPM_COMMON_PAGES_Z
+ *  \note
+ *  - invoqué par t_database::read_common()
+ *  - l'entête donne le répertoire, interprété par read_json() pour les holders, puis par read_pages_dossiers() qui
+ *    crée les dossiers. Les groupes de pages d'un dossier ne sont déchiffrés qu'au premier accès à ses items
+ *  - les pages référencées sont notées dans t_database::pages : la sauvegarde suivante pourra être incrémentale
+ *  - puis le journal qui suit la dernière page est rejoué, voir journal_rejoue()
+ */
+void t_database::read_common_pages() {
+	t_vue_fichier *v = vue_fichier();
+	long common_pos = (long)common_index*CHUNK_HOLDER_SIZE;
+	unsigned char clair[MPM_PAGE_CLAIR];
+	t_pages_entete *entete = (t_pages_entete*)clair;
+	t_page_ref ref_entete = {0, 0};
+	t_lit_pages lp;
+	bool ok = false;
+
+	memset(&lp, 0, sizeof(lp));
+	lp.pg = (t_pages*)calloc(1, sizeof(t_pages));
+	memcpy(&lp.pg->cm, v->data + common_pos, sizeof(t_common_marker));
+	lp.base = v->data + common_pos + sizeof(t_common_marker);
+	lp.nb_dispo = (uint32_t)((v->taille - common_pos - (long)sizeof(t_common_marker)) / MPM_PAGE);
+	lp.aes = common_aes;
+	lp.comprime = (common_format == MPM_COMMON_PAGES_Z);
+	pages_marque(lp.pg, 0);
+	#ifndef MPM_ZLIB
+	if (lp.comprime) {
+		printf("Base compressée : mpm doit être compilé avec MPM_ZLIB pour la lire\n");
+		free(lp.pg->utilisee);
+		free(lp.pg);
+		return;
+	}
+	#endif
+	pages_lot_init(&lp.lot, &lp.pg->cm, common_key, common_aes, 0);
+
+	if ((lp.nb_dispo > 0) && page_dechiffre(clair, lp.base, &lp.pg->cm, common_aes, ref_entete)
+	 && (memcmp(entete->magic, MPM_PAGES_MAGIC, 8) == 0)
+	 && (entete->nb_pages <= lp.nb_dispo)
+	 && (entete->nb_repertoire <= MPM_PAGES_REPERTOIRE_MAX)
+	 && ((lp.nb_dispo = entete->nb_pages) > 0) // le journal suit la dernière page
+	 && pages_note(&lp, entete->repertoire, (int)entete->nb_repertoire)
+	 && pages_lit(&lp, entete->repertoire, (int)entete->nb_repertoire, entete->taille_repertoire)) {
+		lp.pg->generation = entete->generation;
+		#ifdef DEBUG
+		debug_printf(0, (char*)"%s() sauvegarde n°%u, %u pages, répertoire de %u octets\n", __func__, entete->generation, entete->nb_pages, entete->taille_repertoire);
+		#endif
+
+		#ifdef MPM_GLIB_JSON
+		JsonParser *parser = json_parser_new ();
+		GError *err = NULL;
+		if (json_parser_load_from_data (parser, (const char*)lp.clair.data, lp.clair.len, &err)) {
+			read_json(json_parser_get_root (parser));
+			ok = read_pages_dossiers(json_parser_get_root (parser), &lp);
+		} else {
+			#ifdef DEBUG
+			debug_printf(0, (char*)"%s() Erreur json_parser_load_from_data() GError=%s\n", __func__, err->message);
+			#endif
+			g_clear_error (&err);
+		}
+		g_object_unref((gpointer)parser);
 		#endif
+
 		#ifdef  MPM_JANSSON
 		json_error_t err;
-		json_t * js = json_loads((const char*)buffer_chiffre, JSON_DISABLE_EOF_CHECK, &err);
+		json_t *js = json_loadb((const char*)lp.clair.data, lp.clair.len, 0, &err);
 		if (js) {
 			read_json(js);
+			ok = read_pages_dossiers(js, &lp);
 			json_decref(js); // Supprime l'arbre json en mémoire
 		} else {
 			#ifdef DEBUG
-			debug_printf(0, (char*)"%s() Erreur json_loads() json_err=%s\n", __func__, err.text);
-			#endif			
+			debug_printf(0, (char*)"%s() Erreur json_loadb() json_err=%s\n", __func__, err.text);
+			#endif
 		}
 		#endif
-				
-	} else {
+	}
+	memset(clair, 0, sizeof(clair));
+	pages_lot_free(&lp.lot);
+	tampon_free(&lp.clair);
+	tampon_free(&lp.travail);
+
+	pages_free();
+	if (!ok) {
 		printf("Erreur d'intégrité de la base 'common'\n");
 		printf("La base est probablement inutilisable\n");
+		free(lp.pg->utilisee);
+		free(lp.pg);
+		return;
 	}
-	free(buffer_chiffre);
-	
+	lp.pg->nb = lp.nb_dispo;
+	pages = lp.pg;
+
+	common_pos += sizeof(t_common_marker) + (long)pages->nb*MPM_PAGE;
+	journal_rejoue(v->data + common_pos, v->taille - common_pos);
+}
+
+/**
+ *  \brief Crée les items d'un groupe de pages, son clair étant dans lp->clair
+ *  \return false si un item est incomplet : aucun item du groupe n'est alors ajouté au dossier
+ *  \note
+ *  - les items sont lus en une passe dans leur encodage binaire
+ */
+bool t_database::read_pages_groupe(t_secret_folder *f, t_groupe_pages *g, t_lit_pages *lp) {
+	t_lit_binaire lb = {lp->clair.data, lp->clair.data + lp->clair.len, false};
+	tdllist *items = NULL, *gl;
+	t_secret_item *s;
+
+	while ((lb.p < lb.fin) && !lb.erreur) {
+		s = new t_secret_item(&lb, f);
+		s->groupe = g;
+		items = tdll_append(items, s);
+	}
+	for (gl = items; gl != NULL; gl = gl->next) {
+		if (lb.erreur) delete (t_secret_item*)gl->data;
+		else f->secrets = tdll_append(f->secrets, gl->data);
+	}
+	tdll_free(items);
+	return !lb.erreur;
+}
+
+/**
+ *  \brief Lit les items d'un dossier dans ses groupes de pages
+ *  \return false si une page n'a pas été vérifiée ou si un groupe est illisible : les items des autres groupes sont lus
+ *  \note
+ *  - invoqué par t_secret_folder::charge_items() au premier accès aux items du dossier
+ *  - les pages sont relues dans la projection du fichier, rouverte si une sauvegarde l'a fermée : les groupes d'un dossier
+ *    non lu sont gardés tels quels par les sauvegardes incrémentales, et toujours valides
+ */
+bool t_database::read_pages_items(t_secret_folder *f) {
+	t_vue_fichier *v = vue_fichier();
+	long debut = (long)common_index*CHUNK_HOLDER_SIZE + (long)sizeof(t_common_marker);
+	t_lit_pages lp;
+	tdllist *gl, *gl_lot;
+	t_groupe_pages *g;
+	int premier;
+	bool ok = true;
+
+	if ((pages == NULL) || (v == NULL) || (v->taille < debut)) return false;
+	memset(&lp, 0, sizeof(lp));
+	lp.base = v->data + debut;
+	lp.nb_dispo = (uint32_t)((v->taille - debut) / MPM_PAGE);
+	if (lp.nb_dispo > pages->nb) lp.nb_dispo = pages->nb;
+	lp.pg = pages;
+	lp.aes = common_aes;
+	lp.comprime = (common_format == MPM_COMMON_PAGES_Z);
+	pages_lot_init(&lp.lot, &pages->cm, common_key, common_aes, 0);
+	gl = f->groupes;
+	while (gl != NULL) {
+		// Les groupes suivants sont déchiffrés ensemble, tant qu'ils tiennent dans un lot
+		pages_lot_vide(&lp.lot);
+		for (gl_lot = gl; (gl != NULL) && ((gl == gl_lot) || (lp.lot.nb + ((t_groupe_pages*)gl->data)->nb_pages <= lp.lot.nb_max)); gl = gl->next) {
+			g = (t_groupe_pages*)gl->data;
+			pages_charge(&lp, g->pages, g->nb_pages);
+		}
+		pages_lot_traite(&lp.lot);
+		for (premier = 0; gl_lot != gl; gl_lot = gl_lot->next) {
+			g = (t_groupe_pages*)gl_lot->data;
+			if (!pages_rassemble(&lp, premier, g->nb_pages, g->taille) || !read_pages_groupe(f, g, &lp)) ok = false;
+			premier += g->nb_pages;
+		}
+	}
+	#ifdef DEBUG
+	debug_printf(0, (char*)"%s() dossier %u lu, ok=%d\n", __func__, f->get_id(), ok);
+	#endif
+	pages_lot_free(&lp.lot);
+	tampon_free(&lp.clair);
+	tampon_free(&lp.travail);
+	return ok;
+}
+
+#ifdef MPM_GLIB_JSON
+/**
+ *  \brief Crée les dossiers du répertoire, avec leurs groupes de pages
+ *  \return false si un dossier ou un groupe est incohérent
+ *  \note
+ *  - les dossiers sont dans l'ordre d'un parcours en profondeur : le parent d'un dossier est toujours déjà créé
+ *  - les pages des groupes sont notées, mais pas déchiffrées : les items seront lus au premier accès à leur dossier, 
+ *    voir t_secret_folder::charge_items()
+ */
+bool t_database::read_pages_dossiers(JsonNode *node, t_lit_pages *lp) {
+	JsonObject *root_object = json_node_get_object (node);
+	JsonArray *jsfa, *jsga, *jsg;
+	JsonObject *jsf;
+	t_secret_folder **dossiers, *f, *parent;
+	t_groupe_pages *g;
+	guint n, i, j, k, m;
+	bool ok = true;
+
+	if (!json_object_has_member(root_object, "folders")) return true;
+	jsfa = json_object_get_array_member(root_object, "folders");
+	n = json_array_get_length(jsfa);
+	dossiers = (t_secret_folder**)calloc(n+1, sizeof(t_secret_folder*));
+	for (i=0; (i<n) && ok; i++) {
+		jsf = json_array_get_object_element(jsfa, i);
+		parent = NULL;
+		if (json_object_has_member(jsf, "parent")) {
+			for (j=i; (j>0) && (parent==NULL); j--) {
+				if (dossiers[j-1]->get_id() == json_object_get_int_member(jsf, "parent")) parent = dossiers[j-1];
+			}
+			if (parent == NULL) {
+				ok = false;
+				break;
+			}
+		} else if (i != 0) {
+			ok = false; // seul le premier dossier est la racine
+			break;
+		}
+		const gchar *titre = json_object_has_member(jsf, "title") ? json_object_get_string_member(jsf, "title") : NULL;
+		f = new t_secret_folder(parent, titre ? titre : "(null-error)", json_object_get_int_member(jsf, "id"), this);
+		dossiers[i] = f;
+		if (parent) {
+			parent->sub_folders = tdll_append(parent->sub_folders, f);
+		} else {
+			root_folder = f;
+		}
+
+		jsga = json_object_get_array_member(jsf, "groups");
+		for (j=0; (j<json_array_get_length(jsga)) && ok; j++) {
+			jsg = json_array_get_array_element(jsga, j);
+			m = json_array_get_length(jsg);
+			if ((m < 3) || ((m & 1) == 0)) {
+				ok = false;
+				break;
+			}
+			g = (t_groupe_pages*)calloc(1, sizeof(t_groupe_pages));
+			g->taille = json_array_get_int_element(jsg, 0);
+			g->nb_pages = (m-1)/2;
+			g->pages = (t_page_ref*)malloc(g->nb_pages * sizeof(t_page_ref));
+			for (k=0; k<(guint)g->nb_pages; k++) {
+				g->pages[k].index = json_array_get_int_element(jsg, 1+2*k);
+				g->pages[k].generation = json_array_get_int_element(jsg, 2+2*k);
+			}
+			f->groupes = tdll_append(f->groupes, g);
+			ok = pages_note(lp, g->pages, g->nb_pages);
+		}
+		f->items_lus = (f->groupes == NULL);
+	}
+	free(dossiers);
+	return ok;
+}
+#endif
+
+#ifdef  MPM_JANSSON
+/**
+ *  \brief Crée les dossiers du répertoire, avec leurs groupes de pages
+ *  \return false si un dossier ou un groupe est incohérent
+ *  \note
+ *  - les dossiers sont dans l'ordre d'un parcours en profondeur : le parent d'un dossier est toujours déjà créé
+ *  - les pages des groupes sont notées, mais pas déchiffrées : les items seront lus au premier accès à leur dossier, 
+ *    voir t_secret_folder::charge_items()
+ */
+bool t_database::read_pages_dossiers(json_t *node, t_lit_pages *lp) {
+	json_t *jsfa = json_object_get(node, "folders");
+	json_t *jsf, *jsp, *jsga, *jsg;
+	t_secret_folder **dossiers, *f, *parent;
+	t_groupe_pages *g;
+	size_t n, i, j, k, m;
+	bool ok = true;
+
+	n = json_array_size(jsfa);
+	dossiers = (t_secret_folder**)calloc(n+1, sizeof(t_secret_folder*));
+	for (i=0; (i<n) && ok; i++) {
+		jsf = json_array_get(jsfa, i);
+		parent = NULL;
+		if ((jsp = json_object_get(jsf, "parent")) != NULL) {
+			for (j=i; (j>0) && (parent==NULL); j--) {
+				if (dossiers[j-1]->get_id() == json_integer_value(jsp)) parent = dossiers[j-1];
+			}
+			if (parent == NULL) {
+				ok = false;
+				break;
+			}
+		} else if (i != 0) {
+			ok = false; // seul le premier dossier est la racine
+			break;
+		}
+		const char *titre = json_string_value(json_object_get(jsf, "title"));
+		f = new t_secret_folder(parent, titre ? titre : "(null-error)", json_integer_value(json_object_get(jsf, "id")), this);
+		dossiers[i] = f;
+		if (parent) {
+			parent->sub_folders = tdll_append(parent->sub_folders, f);
+		} else {
+			root_folder = f;
+		}
+
+		jsga = json_object_get(jsf, "groups");
+		for (j=0; (j<json_array_size(jsga)) && ok; j++) {
+			jsg = json_array_get(jsga, j);
+			m = json_array_size(jsg);
+			if ((m < 3) || ((m & 1) == 0)) {
+				ok = false;
+				break;
+			}
+			g = (t_groupe_pages*)calloc(1, sizeof(t_groupe_pages));
+			g->taille = json_integer_value(json_array_get(jsg, 0));
+			g->nb_pages = (int)(m-1)/2;
+			g->pages = (t_page_ref*)malloc(g->nb_pages * sizeof(t_page_ref));
+			for (k=0; k<(size_t)g->nb_pages; k++) {
+				g->pages[k].index = json_integer_value(json_array_get(jsg, 1+2*k));
+				g->pages[k].generation = json_integer_value(json_array_get(jsg, 2+2*k));
+			}
+			f->groupes = tdll_append(f->groupes, g);
+			ok = pages_note(lp, g->pages, g->nb_pages);
+		}
+		f->items_lus = (f->groupes == NULL);
+	}
+	free(dossiers);
+	return ok;
 }
+#endif
 
 
 /** 
@@ -772,6 +3380,10 @@ void t_database::read_json(JsonNode *node) {
 		#endif	
 	}
 	next_id_holder = json_object_get_int_member (root_object, "next_id_holder");
+	// Paramètres de KDF absents des bases antérieures : sha256 itérés au coût par défaut
+	kdf.cout = json_object_has_member(root_object, "kdf_cost") ? json_object_get_int_member (root_object, "kdf_cost") : MPM_KDF_COST_DEFAULT;
+	kdf.algo = json_object_has_member(root_object, "kdf_algo") ? json_object_get_int_member (root_object, "kdf_algo") : MPM_KDF_SHA256;
+	kdf.lanes = json_object_has_member(root_object, "kdf_lanes") ? json_object_get_int_member (root_object, "kdf_lanes") : 1;
 	#ifdef DEBUG
 	debug_printf(0, (char*)"%s() next_id_holder=%d\n", __func__, next_id_holder);
 	#endif	
@@ -798,6 +3410,7 @@ void t_database::read_json(JsonNode *node) {
 		}
 		gl = gl->next;
 	}
+	nb_holders = json_array_get_length(holders_array); // le fichier ne le donne plus, à cause des emplacements libres
 	
 	assert(root_folder == NULL); // La base n'est pas censée être déjà chargée
 	if (json_object_has_member(root_object, "root_folder")) { 
@@ -823,6 +3436,13 @@ void t_database::read_json(json_t *node) {
 		#endif	
 	}
 	next_id_holder = json_integer_value(json_object_get(node, "next_id_holder"));
+	// Paramètres de KDF absents des bases antérieures : sha256 itérés au coût par défaut
+	json_t *jskc = json_object_get(node, "kdf_cost");
+	json_t *jska = json_object_get(node, "kdf_algo");
+	json_t *jskl = json_object_get(node, "kdf_lanes");
+	kdf.cout = jskc ? json_integer_value(jskc) : MPM_KDF_COST_DEFAULT;
+	kdf.algo = jska ? json_integer_value(jska) : MPM_KDF_SHA256;
+	kdf.lanes = jskl ? json_integer_value(jskl) : 1;
 	#ifdef DEBUG
 	debug_printf(0, (char*)"%s() next_id_holder=%d common=%d secret=%d\n", __func__, next_id_holder, common_treshold, secret_treshold);
 	#endif	
@@ -853,6 +3473,7 @@ void t_database::read_json(json_t *node) {
 			p->complete_ouverture(jsh);
 		}		
 	}
+	nb_holders = n; // le fichier ne le donne plus, à cause des emplacements libres
 
 	assert(root_folder == NULL); // La base n'est pas censée être déjà chargée
 	if (json_t *jsrf = json_object_get(node, "root_folder")) { 
@@ -922,6 +3543,8 @@ void t_database::open_common() {
 		fprintf(stderr, "Erreur à la recombinaison\n"); 
 	}
 	lsss_get_secret(sss_common, common_key);
+	cw_aes_free(common_aes);
+	common_aes = cw_aes_new(common_key);
 
 	#ifdef DEBUG
 	debug_printf(0,(char*)"%s() secret retrouvé=%lx\n", __func__, *(uint64_t*)common_key);
@@ -997,6 +3620,9 @@ void t_database::open_secret() {
 		fprintf(stderr, "Erreur à la recombinaison\n"); 
 	}
 	lsss_get_secret(sss_secret, secret_key);
+	oublie_clairs();
+	cw_aes_free(secret_aes);
+	secret_aes = cw_aes_new(secret_key);
 	
 	#ifdef DEBUG
 	debug_printf(0,(char*)"%s() secret retrouvé=%lx\n", __func__, *(uint64_t*)secret_key);
@@ -1065,94 +3691,252 @@ void t_database::check_level() {
  *  - MPM_TRY_ALREADY_OPENED
  *  - MPM_TRY_INCONSISTENT
  *  \note
- *  - Le fonctionnement est différent selon que le niveau common est déjà ouvert ou pas
- *  - si 'status' est à MPM_LEVEL_COMMON ou MPM_LEVEL_SECRET alors on invoque t_holder::try_tardif()
- *  - sinon, on utilise t_database::find_chunk_holder() puis on créé un nouveau t_holder (dont l'ouverture sera complétée ensuite par t_holder::complete_ouverture() )
- *  - invoque check_level(), sauf si on est déjà en MPM_LEVEL_SECRET
+ *  - cas particulier de try_nicknames() pour une seule holder
  */
 int t_database::try_nickname(char *nickname, char *password, int *apporte_common, int *apporte_secret) {
-	t_chunk_holder *chunk;
-	t_holder *p;
-	int file_index;
-	unsigned char pkey[32];
+	int r;
+	try_nicknames(1, &nickname, &password, &r, apporte_common, apporte_secret);
+	return r;
+}
+
+
+/** 
+ *  \brief Essaie d'ouvrir les parts de plusieurs holders à la fois
+ *  \param[in] n Le nombre de holders, au plus MPM_TRY_MAX_BATCH
+ *  \param[in] nicknames, passwords Les informations des porteurs qui sont utilisées en données d'entrée de la crypto
+ *  \param[out] resultats Code d'erreur pour chaque holder, comme try_nickname()
+ *  \param[out] apporte_common, apporte_secret Si non NULL, tableaux de n entiers renseignant l'appelant sur le nombre de parts découvertes
+ *  \return Le nombre de holders ouvertes (résultat MPM_TRY_OK)
+ *  \note
+ *  - version synchrone de try_async() + try_finish()
+ */
+int t_database::try_nicknames(int n, char **nicknames, char **passwords, int *resultats, int *apporte_common, int *apporte_secret) {
+	t_try_pending *tp;
+	int nb_ok=0;
+
+	tp = try_async(n, nicknames, passwords);
+	try_finish(tp, true);
+	for (int k=0; k<n; k++) {
+		resultats[k] = tp->resultats[k];
+		if (resultats[k] != MPM_TRY_OK) continue;
+		if (apporte_common) apporte_common[k] = tp->apporte_common[k];
+		if (apporte_secret) apporte_secret[k] = tp->apporte_secret[k];
+		nb_ok++;
+	}
+	try_pending_free(tp);
+	return nb_ok;
+}
 
-	p = find_holder(nickname);
+
+/** 
+ *  \brief Lance les calculs pour essayer d'ouvrir les parts de plusieurs holders, et rend la main tout de suite
+ *  \param[in] n Le nombre de holders, au plus MPM_TRY_MAX_BATCH
+ *  \param[in] nicknames, passwords Les informations des porteurs qui sont utilisées en données d'entrée de la crypto. Sont recopiés
+ *  \return L'essai en cours, également ajouté à pending_tries. Les résultats seront intégrés par try_finish() ou try_collect()
+ *  \note
+ *  - Le fonctionnement est différent selon que le niveau common est déjà ouvert ou pas
+ *  - si 'status' est à MPM_LEVEL_COMMON ou MPM_LEVEL_SECRET, chaque holder est essayée sur son propre chunk déjà en mémoire,
+ *    un calcul par holder, tous en même temps (équivalent de t_holder::try_tardif())
+ *  - sinon, un seul calcul sur la projection du fichier (limitée aux chunks holders si chunks_connus), chaque bloc étant 
+ *    testé contre toutes les holders
+ *  - les calculs travaillent sur des copies ou la projection, et ne touchent pas à la base : la CLI peut continuer, typiquement 
+ *    pour que le porteur suivant saisisse son MdP pendant que la KDF du précédent tourne
+ *  - si un thread ne peut pas être créé, le calcul est fait tout de suite
+ */
+t_try_pending *t_database::try_async(int n, char **nicknames, char **passwords) {
+	t_try_pending *tp = (t_try_pending*)calloc(1, sizeof(t_try_pending));
+	t_scan_holder *sc;
+	t_holder *p;
+	int k;
+
+	assert((n > 0) && (n <= MPM_TRY_MAX_BATCH));
+	tp->n = n;
+	for (k=0; k<n; k++) {
+		tp->nicknames[k] = strdup(nicknames[k]);
+		tp->scan_index[k] = -1;
+		tp->resultats[k] = MPM_TRY_NOT_FOUND;
+	}
 
 	if ((status == MPM_LEVEL_COMMON) || (status == MPM_LEVEL_SECRET)) {
 		#ifdef DEBUG
-		debug_printf(0,(char*)"%s() nn=%s status COMMON ou SECRET\n", __func__, nickname);
+		debug_printf(0,(char*)"%s() n=%d status COMMON ou SECRET\n", __func__, n);
 		#endif
 	
-		// ouverture alors qu'on a déjà lu la base common : travail en mémoire, tout le monde est déjà chargé
-		if (p == NULL) {
-			#ifdef DEBUG
-			debug_printf(0,(char*)"%s() %s non trouvé\n", __func__, nickname);
-			#endif	
-			return MPM_TRY_NOT_FOUND;
+		// ouverture alors qu'on a déjà lu la base common : tout le monde est déjà chargé, chacun son chunk
+		for (k=0; k<n; k++) {
+			p = find_holder(nicknames[k]);
+			if (p == NULL) {
+				#ifdef DEBUG
+				debug_printf(0,(char*)"%s() %s non trouvé\n", __func__, nicknames[k]);
+				#endif	
+				continue;
+			}
+			if (p->chunk_status != HOLDER_CHUNK_STATUS_CLOSED) {
+				#ifdef DEBUG
+				debug_printf(0,(char*)"%s() %s n'est pas en HOLDER_CHUNK_STATUS_CLOSED\n", __func__, nicknames[k]);
+				#endif	
+				tp->resultats[k] = MPM_TRY_ALREADY_OPENED;	
+				continue;
+			}
+			unsigned char *bloc = (unsigned char*)malloc(CHUNK_HOLDER_SIZE);
+			if (bloc == NULL) {
+				tp->resultats[k] = MPM_TRY_MEMORY;
+				continue;
+			}
+			memcpy(bloc, p->chunk, CHUNK_HOLDER_SIZE);
+			tp->scans[tp->nb_scans] = scan_new(1, &nicknames[k], &passwords[k], bloc, CHUNK_HOLDER_SIZE, NULL, false, &kdf);
+			tp->scan_index[k] = tp->nb_scans++;
+			tp->scan_paire[k] = 0;
 		}
-		if (p->chunk_status == HOLDER_CHUNK_STATUS_OPEN) {
-			#ifdef DEBUG
-			debug_printf(0,(char*)"%s() %s déjà en HOLDER_CHUNK_STATUS_OPEN\n", __func__, nickname);
-			#endif	
-			return MPM_TRY_ALREADY_OPENED;	
+	} else {
+		#ifdef DEBUG
+		debug_printf(0,(char*)"%s() n=%d status autre que COMMON ou SECRET\n", __func__, n);
+		#endif		
+	
+		// Ouverture depuis le fichier, dans le cas où on a pas encore ouvert la base common/json	
+		sc = scan_fichier(n, nicknames, passwords);
+		if (sc != NULL) {
+			tp->scans[tp->nb_scans++] = sc;
+			for (k=0; k<n; k++) {
+				tp->scan_index[k] = 0;
+				tp->scan_paire[k] = k;
+			}
 		}
+	}
 
-		if (p->chunk_status != HOLDER_CHUNK_STATUS_CLOSED) {
-			#ifdef DEBUG
-			debug_printf(0,(char*)"%s() Erreur ! %s pas en HOLDER_CHUNK_STATUS_CLOSED\n", __func__, nickname);
-			#endif	
-			return MPM_TRY_ALREADY_OPENED;	
+	for (int s=0; s<tp->nb_scans; s++) {
+		sc = tp->scans[s];
+		if (tw_thread_create(&sc->thread, scan_calcul, sc) == 0) {
+			sc->thread_lance = true;
+		} else {
+			scan_calcul(sc);
 		}
+	}
+	pending_tries = tdll_append(pending_tries, tp);
+	return tp;
+}
 
-		if (p->try_tardif(password)==MPM_TRY_OK) {
-			if (apporte_common) *apporte_common = p->common_nb_parts;
-			if (apporte_secret) *apporte_secret = p->secret_nb_parts;		
-		} else {
+
+/** 
+ *  \brief Intègre dans la base les résultats d'un essai lancé par try_async()
+ *  \param[in] tp        L'essai
+ *  \param[in] attendre  Si true, attend la fin des calculs. Sinon, ne fait rien si ils ne sont pas terminés
+ *  \return true si les résultats ont été intégrés : tp->resultats est renseigné, tp est retiré de pending_tries,
+ *          l'appelant doit ensuite le libérer par try_pending_free()
+ *  \note
+ *  - travail en mémoire seulement, dans le thread de la CLI
+ *  - une holder trouvée dans le fichier avant l'ouverture de la base common donne un nouveau t_holder (dont l'ouverture 
+ *    sera complétée ensuite par t_holder::complete_ouverture() )
+ *  - si la base common a été ouverte entre temps, ou pour les essais tardifs, la holder existe déjà en HOLDER_CHUNK_STATUS_CLOSED
+ *    et on termine par t_holder::ouverture_tardive()
+ *  - invoque check_level() si au moins une holder a été ouverte, sauf si on est déjà en MPM_LEVEL_SECRET
+ */
+bool t_database::try_finish(t_try_pending *tp, bool attendre) {
+	t_scan_holder *sc;
+	t_chunk_holder *chunk;
+	t_holder *p;
+	int k, nb_ok=0;
+
+	for (int s=0; s<tp->nb_scans; s++) {
+		sc = tp->scans[s];
+		tw_mutex_lock(&sc->mutex);
+		bool termine = sc->termine;
+		tw_mutex_unlock(&sc->mutex);
+		if (!termine && !attendre) return false;
+	}
+	for (int s=0; s<tp->nb_scans; s++) {
+		sc = tp->scans[s];
+		if (sc->thread_lance) tw_thread_join(sc->thread);
+		sc->thread_lance = false;
+		scan_marqueur_common(sc);
+	}
+
+	for (k=0; k<tp->n; k++) {
+		if (tp->scan_index[k] < 0) continue; // résultat connu d'avance
+		sc = tp->scans[tp->scan_index[k]];
+		chunk = sc->chunks[tp->scan_paire[k]];
+		unsigned char *pkey = &sc->pkeys[32*tp->scan_paire[k]];
+		if (chunk == NULL) {
+			if (sc->annule) tp->resultats[k] = MPM_TRY_CANCELLED;
+			else tp->resultats[k] = sc->memoire[tp->scan_paire[k]] ? MPM_TRY_MEMORY : MPM_TRY_NOT_FOUND;
+			continue;
+		}
+
+		p = find_holder(tp->nicknames[k]);
+		if (p == NULL) {
+			if (!sc->fichier) {
+				tp->resultats[k] = MPM_TRY_NOT_FOUND;
+				continue;
+			}
+			// Ajouter le chunk nouvellement ouvert
 			#ifdef DEBUG
-			debug_printf(0,(char*)"%s() %s try tardif échoué\n", __func__, nickname);
+			if (chunk->magic != CHUNK_HOLDER_MAGIC) {
+				debug_printf(0,(char*)"%s() chunk holder magic incorrect\n", __func__, tp->nicknames[k]);
+			}
 			#endif
-			return MPM_TRY_NOT_FOUND;
-		}
-	} else {
-		#ifdef DEBUG
-		debug_printf(0,(char*)"%s() nn=%s status autre que COMMON ou SECRET\n", __func__, nickname);
-		#endif		
-	
-		// Ouverture depuis le fichier, dans le cas où on a pas encore ouvert la base common/json	
-		chunk = find_chunk_holder(nickname, password, &file_index, pkey); // le déchiffrement de la partie chiffrée est fait ici
-		if (chunk) {
-			if (p == NULL) {
-				// Ajouter le chunk nouvellement ouvert
+			p = new t_holder(tp->nicknames[k], this, chunk, sc->trouve[tp->scan_paire[k]], pkey);
+			//holders = g_list_append(holders, p);
+			holders = tdll_append(holders, p);
+			p->chunk_status = HOLDER_CHUNK_STATUS_OPEN;
+			kdf = sc->kdf_trouve[tp->scan_paire[k]]; // les recherches suivantes se feront avec cette KDF, confirmée ensuite par la base common
+			tp->resultats[k] = MPM_TRY_OK;
+		} else if (p->chunk_status == HOLDER_CHUNK_STATUS_OPEN) {
+			if (memcmp(p->chunk, chunk, CHUNK_HOLDER_SIZE)) {
 				#ifdef DEBUG
-				if (chunk->magic != CHUNK_HOLDER_MAGIC) {
-					debug_printf(0,(char*)"%s() chunk holder magic incorrect\n", __func__, nickname);
-				}
+				debug_printf(0,(char*)"%s() dejà ouvert mais chunk incohérent\n", __func__);
 				#endif
-				p = new t_holder(nickname, this, chunk, file_index, pkey);
-				free(chunk); // nb a été créé avec malloc(), a été recopié, ne sera plus utilisé
-				//holders = g_list_append(holders, p);
-				holders = tdll_append(holders, p);
-				if (apporte_common) *apporte_common = p->common_nb_parts;
-				if (apporte_secret) *apporte_secret = p->secret_nb_parts;
-				p->chunk_status = HOLDER_CHUNK_STATUS_OPEN;
-			} else {	
-				if (memcmp(p->chunk, chunk, CHUNK_HOLDER_SIZE)) {
-					#ifdef DEBUG
-					debug_printf(0,(char*)"%s() dejà ouvert mais chunk incohérent\n", __func__);
-					#endif
-					return MPM_TRY_INCONSISTENT;
-				} else {
-					return MPM_TRY_ALREADY_OPENED;
-				}
+				tp->resultats[k] = MPM_TRY_INCONSISTENT;
+			} else {
+				tp->resultats[k] = MPM_TRY_ALREADY_OPENED;
 			}
-		} else { // chunk == NULL
-			return MPM_TRY_NOT_FOUND;
+		} else if (p->chunk_status == HOLDER_CHUNK_STATUS_CLOSED) {
+			// Base common ouverte entre temps, ou essai tardif
+			tp->resultats[k] = p->ouverture_tardive(chunk, pkey);
+		} else {
+			tp->resultats[k] = MPM_TRY_ALREADY_OPENED;
+		}
+
+		if (tp->resultats[k] == MPM_TRY_OK) {
+			tp->apporte_common[k] = p->common_nb_parts;
+			tp->apporte_secret[k] = p->secret_nb_parts;
+			nb_ok++;
 		}
 	}
 
+	for (int s=0; s<tp->nb_scans; s++) scan_free(tp->scans[s]);
+	tp->nb_scans = 0;
+	pending_tries = tdll_remove(pending_tries, tp);
+
 	// Essaie de passer au niveau d'ouverture suivant
-	if (status != MPM_LEVEL_SECRET) check_level();
-	return MPM_TRY_OK;
+	if ((nb_ok > 0) && (status != MPM_LEVEL_SECRET)) check_level();
+	return true;
+}
+
+
+/** 
+ *  \brief Intègre les résultats du plus ancien essai lancé par try_async()
+ *  \param[in] attendre  Si true, attend la fin de ses calculs
+ *  \return L'essai, à libérer par try_pending_free(), ou NULL si aucun essai n'est terminé
+ *  \note
+ *  - les essais sont intégrés dans l'ordre de lancement
+ *  - invoqué par la CLI, qui affiche les résultats : au début de chaque commande, et en attendant par 'wait' et 'save'
+ */
+t_try_pending *t_database::try_collect(bool attendre) {
+	if (pending_tries == NULL) return NULL;
+	t_try_pending *tp = (t_try_pending*)pending_tries->data;
+	if (try_finish(tp, attendre)) return tp;
+	return NULL;
+}
+
+
+/** 
+ *  \brief Libère un essai, en abandonnant ses calculs si ses résultats n'ont pas été intégrés
+ */
+void t_database::try_pending_free(t_try_pending *tp) {
+	for (int s=0; s<tp->nb_scans; s++) scan_free(tp->scans[s]);
+	for (int k=0; k<tp->n; k++) free(tp->nicknames[k]);
+	pending_tries = tdll_remove(pending_tries, tp);
+	free(tp);
 }
 
 
@@ -27,6 +27,7 @@
 //#include "mpm.h"
 
 #include <stdint.h>
+#include <stdio.h>
 
 #if defined(MPM_GLIB_JSON) 
 #include <json-glib/json-glib.h>
@@ -44,6 +45,7 @@
 #include "secret.h"
 #include "debug_file.h"
 #include "crypto_wrapper.h"
+#include "thread_wrapper.h"
 
 
 // Dépendance circulaire pénible...
@@ -63,7 +65,7 @@
 
 //!@{
 //! Définition des états de base changée (pour savoir si on doit sauvegarder 
-#define MPM_CHANGED_PASSWORD 1 /**< un utilisateur en état ouvert a changé son MdP */
+#define MPM_CHANGED_PASSWORD 1 /**< une holder déjà dans le fichier a changé de MdP, de parts ou d'email : son chunk est à journaliser, voir t_database::journalise() */
 #define MPM_CHANGED_SECRET 2 /**< un secret a été modifié */
 #define MPM_CHANGED_HOLDER 4 /**< un porteur a été ajouté ou supprimé, ou a changé un attribut mail/nb parts...  */
 #define MPM_CHANGED_NEW 8 /**< la base vient d'être créée, n'a jamais été écrite */
@@ -76,16 +78,76 @@
 #define MPM_TRY_NOT_FOUND 1 /**< nickname/MdP non trouvé dans la base, MdP incorrect */ 
 #define MPM_TRY_ALREADY_OPENED 2 /**< nickname déjà ouvert */ 
 #define MPM_TRY_INCONSISTENT 3 /**< Incohérence dans le fichier ou la base */ 
+#define MPM_TRY_MEMORY 4 /**< mémoire insuffisante pour une KDF : l'essai n'est pas concluant, il est à refaire */ 
+#define MPM_TRY_CANCELLED 5 /**< calcul arrêté avant la fin par la réécriture du fichier : l'essai est à refaire */ 
 //!@}
 
+#define MPM_TRY_MAX_BATCH 5 /**< Nombre maximum de holders essayés ensemble par try_nicknames(), voir la commande try de mpm.cli */
+
 
 
 // Chunk pour repérer la position de la base principale après les chunks holders
 typedef struct t_common_marker {
 	unsigned char salt[32]; // Sel utilisé pour la reconnaissance du marqueur, et comme vecteur d'init CBC de l'AES
-	unsigned char hash[32];  // = sha256(salt | common_magic)
+	unsigned char hash[32];  // = sha256(salt | common_magic), ou sha256(salt | common_magic^MPM_COMMON_xxx_DOMAINE) selon le format
 } t_common_marker;
 
+/** \name Formats de la base common, qui suit le marqueur. Reconnus par le hash du marqueur, voir t_database::scan_marqueur_common() */
+//!@{
+#define MPM_COMMON_CBC 0 /**< AES256-CBC d'un seul tenant, le json étant suivi de \0 et "MAGICCOM" pour le contrôle d'intégrité. Lu seulement */
+#define MPM_COMMON_PAGES 2 /**< pages AES256-GCM de taille fixe, réécrites à la demande par les sauvegardes incrémentales. Écrit par t_database::save() sans MPM_ZLIB */
+#define MPM_COMMON_PAGES_Z 3 /**< MPM_COMMON_PAGES, le répertoire et les groupes étant compressés par zlib avant chiffrement. Écrit par t_database::save() avec MPM_ZLIB */
+//!@}
+#define MPM_COMMON_PAGES_DOMAINE 0x50414745532d7631 /**< distingue le hash du marqueur d'une base common MPM_COMMON_PAGES */
+#define MPM_COMMON_PAGES_Z_DOMAINE 0x50414745532d7a31 /**< distingue le hash du marqueur d'une base common MPM_COMMON_PAGES_Z */
+#ifdef MPM_ZLIB
+#define MPM_COMMON_PAGES_ECRIT MPM_COMMON_PAGES_Z /**< format écrit par t_database::save() */
+#define MPM_COMMON_PAGES_ECRIT_DOMAINE MPM_COMMON_PAGES_Z_DOMAINE
+#else
+#define MPM_COMMON_PAGES_ECRIT MPM_COMMON_PAGES
+#define MPM_COMMON_PAGES_ECRIT_DOMAINE MPM_COMMON_PAGES_DOMAINE
+#endif
+#define MPM_PAGE 4096 /**< taille d'une page MPM_COMMON_PAGES dans le fichier : nonce de 12 octets, clair chiffré, tag de 16 octets */
+#define MPM_PAGE_CLAIR (MPM_PAGE-12-16) /**< clair d'une page MPM_COMMON_PAGES */
+#define MPM_PAGES_THREAD 64 /**< pages par thread d'un lot : en dessous, créer un thread coûte plus que le chiffrement */
+#define MPM_PAGES_THREADS_MAX 8 /**< threads au plus pour un lot de pages, ce qui borne la mémoire des lots à 2 Mo */
+#define MPM_JOURNAL_MAX 65536 /**< taille du journal au-delà de laquelle t_database::journalise() le compacte par une sauvegarde */
+
+/** \name Enregistrements du journal, notés avec l'ID concerné par t_database::journal_note(). Voir t_journal_op */
+//!@{
+#define MPM_JOURNAL_ITEM 1             /**< l'item id, dans le dossier parent, suivi de son encodage (celui des groupes). Remplace l'item s'il existe */
+#define MPM_JOURNAL_DOSSIER 2          /**< le dossier id, dans le dossier parent, suivi de son titre. Renomme le dossier s'il existe */
+#define MPM_JOURNAL_SUPPRIME_ITEM 3    /**< suppression de l'item id */
+#define MPM_JOURNAL_SUPPRIME_DOSSIER 4 /**< suppression du dossier id, avec ses items et sous-dossiers */
+#define MPM_JOURNAL_HOLDER 5           /**< la holder id (id_holder), suivie de t_journal_holder et de son email. Réécrit son chunk dans le fichier s'il diffère */
+//!@}
+
+
+#define MPM_SLOTS_MIN_LOG2 4 /**< taille minimum de la table d'emplacements des chunks holders : 16 emplacements, quel que soit le nombre de holders */
+#define MPM_SLOTS_MAX_LOG2 16 /**< taille maximum de la table d'emplacements des chunks holders : 2^16 emplacements */
+#define MPM_SLOTS_ESSAIS 1024 /**< nombre de sels essayés pour une taille de table donnée avant de la doubler, voir t_database::save_chunks_holders() */
+#define MPM_COMMON_TAMPON 16384 /**< taille des tampons de déchiffrement d'une base common MPM_COMMON_CBC, par t_database::read_common(), multiple de 16 */
+
+/** \brief Premier bloc du fichier, qui décrit la table d'emplacements des chunks holders (CHUNK_HOLDER_VERSION 2)
+ *  \note
+ *  - la KDF n'est lue ici que pour tester l'emplacement préféré. La recherche complète, seule possible sur un fichier
+ *    version 1, se fait en sha256 itérés au coût par défaut tant qu'aucune holder n'a été reconnue
+ *  - le chunk d'une holder est rangé dans le bloc 1+emplacement, avec emplacement = sha256(nickname | salt | "slot") modulo la taille de la table
+ *  - les emplacements libres sont remplis de blocs aléatoires : sans nickname, rien ne distingue un emplacement d'un autre
+ *  - la taille de la table, lisible ici comme dans la taille du fichier, borne le nombre de holders. Elle est d'au moins
+ *    2^MPM_SLOTS_MIN_LOG2 emplacements : une base de quelques holders ne dit pas combien elle en a
+ *  - ce bloc n'est pas plus reconnaissable que les autres. Sur un fichier version 1, son contenu est quelconque et l'emplacement
+ *    indiqué est simplement faux : la recherche complète prend le relai
+ */
+typedef struct t_slots_anchor {
+	unsigned char salt[32];  ///< sel de la base pour le calcul des emplacements, renouvelé à chaque sauvegarde
+	unsigned char log2_slots;///< les 5 bits de poids faible donnent le log2 du nombre d'emplacements, les autres sont aléatoires
+	unsigned char kdf_cost;  ///< les 5 bits de poids faible donnent le coût de la KDF des holders (voir MPM_KDF_COST_DEFAULT), les autres sont aléatoires
+	unsigned char kdf_algo;  ///< les 2 bits de poids faible donnent la KDF, MPM_KDF_SHA256 ou MPM_KDF_ARGON2ID, les autres sont aléatoires
+	unsigned char kdf_lanes; ///< les 5 bits de poids faible donnent le nombre de lanes d'Argon2id, les autres sont aléatoires
+	unsigned char random[476];
+} t_slots_anchor;
+
 
 
 #ifndef MPM_T_HOLDER_DECLARED /* forward declaration car holder/database se référencent l'un l'autre */
@@ -93,6 +155,35 @@ struct t_chunk_holder;
 class t_holder;
 #endif
 
+struct t_scan_holder; // calcul de recherche de chunks holders, interne à database.cpp
+
+/** \brief Essai d'une ou plusieurs holders, dont les calculs se déroulent en arrière-plan. Voir t_database::try_async() */
+typedef struct t_try_pending {
+	int n;                                          ///< nombre de holders essayées ensemble
+	char *nicknames[MPM_TRY_MAX_BATCH];             ///< copies des nicknames
+	int resultats[MPM_TRY_MAX_BATCH];               ///< constantes MPM_TRY_xxx, renseignées par t_database::try_finish()
+	int apporte_common[MPM_TRY_MAX_BATCH];          ///< parts apportées, si MPM_TRY_OK
+	int apporte_secret[MPM_TRY_MAX_BATCH];
+	int nb_scans;                                   ///< nombre de calculs lancés
+	struct t_scan_holder *scans[MPM_TRY_MAX_BATCH]; ///< un seul calcul pour une recherche dans le fichier, un par holder pour les essais tardifs
+	int scan_index[MPM_TRY_MAX_BATCH];              ///< pour chaque holder, le calcul qui la concerne, -1 si le résultat était connu d'avance
+	int scan_paire[MPM_TRY_MAX_BATCH];              ///< et son rang dans ce calcul
+} t_try_pending;
+
+/** \brief Résultat de la mesure de la KDF des holders sur la machine courante. Voir kdf_calibrer() et kdf_projection() */
+typedef struct t_kdf_calibration {
+	t_cw_kdf kdf;      ///< KDF retenue ou projetée, voir t_database::kdf
+	double duree_kdf;  ///< durée d'une KDF à ce coût, en secondes
+	double duree_try;  ///< durée d'un try avec le bon MdP sur un fichier CHUNK_HOLDER_VERSION 2 : emplacement préféré puis pkey
+	int nb_blocs;      ///< nombre de blocs testés par une recherche complète
+	int lanes;         ///< voir cw_kdf_passage()
+	int nb_threads;    ///< nombre de threads de la recherche complète
+	double duree_pire; ///< pire cas, un try avec un mauvais MdP : emplacement préféré puis recherche complète
+} t_kdf_calibration;
+
+void kdf_projection(const t_cw_kdf *kdf, int nb_blocs, t_kdf_calibration *cal);
+void kdf_calibrer(int cible_ms, int nb_blocs, const t_cw_kdf *modele, t_kdf_calibration *cal);
+
 // Classe principale pour gérer la base en mémoire
 #define MPM_T_DATABASE_DECLARED
 class t_database {
@@ -100,12 +191,32 @@ class t_database {
 
 	public:
 		t_database();
-		t_database(int common_treshold_, int secret_treshold, char *filename);
+		t_database(int common_treshold_, int secret_treshold, char *filename, int kdf_cost_, int kdf_algo_);
 		~t_database();
 		
 		char *prompt();
 		void save();
 		t_chunk_holder *find_chunk_holder(char *nickname, char *password, int *file_index, unsigned char *pkey); // Essaie de rechercher une holderne dans les chunks holder
+		int find_chunk_holders(int n, char **nicknames, char **passwords, t_chunk_holder **chunks, int *file_indexes, unsigned char *pkeys); // Idem pour plusieurs holders en un seul passage
+		struct t_scan_holder *scan_fichier(int n, char **nicknames, char **passwords); // Prépare la recherche de chunks dans le fichier
+		void scan_marqueur_common(struct t_scan_holder *sc); // Repère common_index après une recherche dans le fichier
+		void clear_chunks_cache(); // Oublie la projection du fichier et les chunks holders connus, quand le fichier change
+		struct t_vue_fichier *vue_fichier(); // Projection du fichier, ouverte à la première demande
+		void oublie_clairs(); // Efface les champs secrets déchiffrés par lot
+		void save_groupes(t_secret_folder *f, struct t_save_pages *sp); // Réécrit les groupes de pages modifiés d'un dossier
+		void save_repertoire(struct t_tampon_json *t); // Génère le répertoire d'une base MPM_COMMON_PAGES
+		void read_common_pages(); // Lecture d'une base common MPM_COMMON_PAGES ou MPM_COMMON_PAGES_Z
+		void pages_free(); // Oublie l'état des pages du fichier : la prochaine sauvegarde sera complète
+		bool journal_note(uint32_t id, uint32_t op); // Note un item, un dossier ou une holder modifié, pour le prochain enregistrement du journal
+		int journalise(); // Ajoute au journal les modifications notées depuis le dernier appel
+		long get_journal(); // Taille du journal, -1 si le fichier n'en a pas
+		void journal_rejoue(const unsigned char *data, long taille); // Rejoue le journal à la lecture
+		void journal_applique(const unsigned char *clair, size_t len); // Applique un enregistrement du journal
+		void journal_applique_suppression(uint32_t id, uint32_t op);
+		void journal_applique_holder(uint32_t id, const unsigned char *clair, size_t len);
+		void journal_chunks_rejoues();
+		int save_chunks_holders(FILE *file); // Ecrit la table d'emplacements des chunks holders
+		int nb_blocs_recherche(); // Nombre de blocs qu'une recherche complète aurait à tester
 		int get_stats(); // 
 		int get_next_id_holder(); 
 		void set_filename(char *fn);
@@ -128,8 +239,21 @@ class t_database {
 		#ifdef  MPM_JANSSON
 		void read_json(json_t *node);
 		#endif
+		#ifdef MPM_GLIB_JSON
+		bool read_pages_dossiers(JsonNode *node, struct t_lit_pages *lp);
+		#endif
+		#ifdef  MPM_JANSSON
+		bool read_pages_dossiers(json_t *node, struct t_lit_pages *lp);
+		#endif
+		bool read_pages_groupe(t_secret_folder *f, t_groupe_pages *g, struct t_lit_pages *lp); // Crée les items d'un groupe de pages
+		bool read_pages_items(t_secret_folder *f); // Lit les items d'un dossier dans ses groupes de pages, au premier accès
 		
 		int try_nickname(char *nickname, char *password, int *apporte_common, int *apporte_secret);
+		int try_nicknames(int n, char **nicknames, char **passwords, int *resultats, int *apporte_common, int *apporte_secret);
+		t_try_pending *try_async(int n, char **nicknames, char **passwords); // Lance les calculs d'un try en arrière-plan
+		bool try_finish(t_try_pending *tp, bool attendre); // Intègre les résultats d'un try lancé par try_async()
+		t_try_pending *try_collect(bool attendre); // Intègre le plus ancien try terminé
+		void try_pending_free(t_try_pending *tp);
 		t_secret_folder *get_root_folder();
 		t_secret_folder *get_current_folder();
 		
@@ -155,10 +279,21 @@ class t_database {
 		int secret_treshold; ///< treshold pour ouvrir le niveau secret
 		int next_id_holder; ///< prochain ID de holderne à attribué. Commence à 1 à la création d'une nouvelle base vide. Toujours incrémenté, jamais remis à 0. Sauvé dans la base common pour garantir l'unicité au delà des ouvertures/fermetures de la base
 		int nb_holders; ///< Nombre de holdernes
+		t_cw_kdf kdf; ///< KDF des holders, dont dépend la version des chunks. Fixée par 'init', conservée dans la base common et dans t_slots_anchor
+		int common_index; ///< Position du marqueur common dans le fichier, en blocs de CHUNK_HOLDER_SIZE. 0 tant qu'elle n'est pas connue
+		int common_format; ///< Format de la base common dans le fichier, MPM_COMMON_xxx, reconnu avec le marqueur
+		struct t_pages *pages; ///< Pages du fichier MPM_COMMON_PAGES connues à la lecture ou à la dernière sauvegarde. NULL si la prochaine sauvegarde doit être complète
+		tdllist *pending_tries; ///< Les t_try_pending dont les résultats n'ont pas encore été intégrés, dans l'ordre de lancement
+		struct t_vue_fichier *vue; ///< Projection du fichier en lecture seule, ouverte au premier essai et gardée jusqu'à sa réécriture. NULL si pas encore ouverte
+		bool chunks_connus; ///< common_index confirmé par le marqueur : les essais suivants ne testent plus que les common_index premiers blocs de la projection
 		int changed; ///< Indicateur de changement. 0=pas de changement, constantes MPM_CHANGED_xxxx
 		uint64_t common_magic; ///< Nonce déterminé aléatoirement à la création de la base, utilisé comme sel dans le hash de répérage du chunk common
 		unsigned char common_key[32]; ///< la clé de la base common/json
 		unsigned char secret_key[32]; ///< la clé des secrets
+		t_cw_aes *common_aes; ///< common_key préparée pour cw_aes_gcm() ou cw_aes_cbc_cle(), NULL tant qu'elle n'est pas connue
+		t_cw_aes *secret_aes; ///< secret_key préparée pour cw_aes_cbc_cle(), NULL tant qu'elle n'est pas connue
+		t_cw_kdf_ctx *clairs; ///< Arena des champs secrets déchiffrés par lot, voir t_secret_item::decrypt_secrets(). NULL avant le premier lot
+		uint32_t clairs_lot; ///< Numéro du lot présent dans clairs. Un champ déchiffré par un lot plus ancien l'est à nouveau à la demande
 };
 
 
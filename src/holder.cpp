@@ -332,8 +332,12 @@ char *t_holder::prompt() {
  */
 int t_holder::try_tardif(char *password) {
 	t_chunk_holder *c;
-	unsigned char hash_calcule[32];
-	unsigned char pkey_calculee[32];
+	unsigned char calculs[64]; // hash puis pkey
+	unsigned char *pkey_calculee = calculs+32;
+	unsigned char copie[CHUNK_HOLDER_SIZE];
+	bool speculation;
+	t_cw_kdf_ctx *ctx;
+	int r;
 	
 	if (chunk_status != HOLDER_CHUNK_STATUS_CLOSED) {
 		#ifdef DEBUG
@@ -347,48 +351,83 @@ int t_holder::try_tardif(char *password) {
 	#endif
 
 	c = (t_chunk_holder *)chunk;
-	//t_chunk_holder * c2=(t_chunk_holder *)alloca(CHUNK_HOLDER_SIZE);
 
 	//cw_database_find_chunk_holder_hash(nickname, (unsigned char*)c->salt1, password, (unsigned char*)hash_calcule);
-	cw_sha256_iterated_mix1(hash_calcule, nickname, c->salt1, password);
-	if (memcmp(c->hash,hash_calcule,32 ) ==0) {
+	// La pkey est calculée en même temps que le hash si cela ne prend pas plus de temps, sinon seulement si le hash correspond
+	ctx = cw_kdf_ctx_new();
+	speculation = cw_kdf_double_gratuit(&db->kdf, 1);
+	if (speculation) r = cw_kdf_double(calculs, nickname, c->salt1, c->salt2, password, &db->kdf, ctx);
+	else r = cw_kdf(calculs, nickname, c->salt1, password, &db->kdf, ctx);
+	if (!r) {
+		memset(calculs, 0, 64);
+		cw_kdf_ctx_free(ctx);
+		return MPM_TRY_MEMORY;
+	}
+	if (memcmp(c->hash,calculs,32 ) ==0) {
 
 		#ifdef DEBUG
 		debug_printf(0, (char*)"%s() %s password ok\n", __func__, nickname);
 		#endif
 		//cw_database_find_chunk_holder_pkey(nickname, (unsigned char*)c->salt2, password, (unsigned char*)pkey_calculee);
-		cw_sha256_iterated_mix1(pkey_calculee, nickname, c->salt2, password);
-		//cw_holder_dechiffre_chunk((unsigned char*)c2, (unsigned char*)c, (unsigned char*)pkey_calculee, c->salt1);
-		cw_aes_cbc((unsigned char*)c + CHUNK_HOLDER_AES_OFFSET, CHUNK_HOLDER_AES_SIZE, pkey_calculee, c->salt1, 0);
-		if (c->magic == CHUNK_HOLDER_MAGIC) {
-			//memcpy((unsigned char*)c + CHUNK_HOLDER_AES_OFFSET, (unsigned char*)c2 + CHUNK_HOLDER_AES_OFFSET, CHUNK_HOLDER_AES_SIZE);
-				// Rappel : la fonction cw_... ne traite pas les octets non chiffrés
-			memcpy(pkey,   pkey_calculee, 32);
-			memcpy(salt1,  c->salt1,      32);
-			memcpy(salt2,  c->salt2,      32);
-			memcpy(hash,   c->hash,       32);
-			memcpy(parts,  c->parts,      CHUNK_MAX_PARTS*32);
-			memcpy(xparts, c->xparts,     CHUNK_MAX_PARTS*sizeof(xparts[0]));
-			chunk_status = HOLDER_CHUNK_STATUS_OPEN;
-			#ifdef DEBUG
-			debug_printf(0, (char*)"%s() %s magic ok pkey=%lx\n", __func__, nickname, *(uint64_t*)pkey);
-			debug_printf(0, (char*)"%s() %s part[0]=%lx part[7]=%lx\n", __func__, nickname, *(uint64_t*)&parts[0], *(uint64_t*)&parts[7*32]);
-			#endif
-			return MPM_TRY_OK;
-		} else {
-			#ifdef DEBUG
-			debug_printf(0, (char*)"%s() %s %s magic invalide\n", __func__, nickname, password);
-			#endif
-			return MPM_TRY_NOT_FOUND;			
+		if (!speculation && !cw_kdf(pkey_calculee, nickname, c->salt2, password, &db->kdf, ctx)) {
+			memset(calculs, 0, 64);
+			cw_kdf_ctx_free(ctx);
+			return MPM_TRY_MEMORY;
 		}
+		cw_kdf_ctx_free(ctx);
+		memcpy(copie, chunk, CHUNK_HOLDER_SIZE);
+		cw_aes_cbc(copie + CHUNK_HOLDER_AES_OFFSET, CHUNK_HOLDER_AES_SIZE, pkey_calculee, c->salt1, 0);
+		r = ouverture_tardive((t_chunk_holder*)copie, pkey_calculee);
+		memset(copie, 0, CHUNK_HOLDER_SIZE);
+		memset(calculs, 0, 64);
+		return r;
 	} else {
 		#ifdef DEBUG
 		debug_printf(0, (char*)"%s() %s password erroné\n", __func__, nickname);
 		#endif	
+		memset(calculs, 0, 64);
+		cw_kdf_ctx_free(ctx);
 		return MPM_TRY_NOT_FOUND;
 	}
 }
 
+/** 
+ *  \brief Termine l'ouverture tardive à partir du chunk déjà déchiffré
+ *  \param[in]   c               Le chunk de cette holder, partie chiffrée déjà déchiffrée avec pkey_calculee
+ *  \param[in]   pkey_calculee   La clé de holder correspondant au MdP essayé
+ *  \note
+ *  - invoqué par try_tardif(), ou par t_database::try_finish() quand les calculs ont été faits en arrière-plan
+ *  - rien n'est modifié si le magic ne correspond pas
+ *  \return MPM_TRY_OK, ou MPM_TRY_NOT_FOUND si le déchiffrement n'a pas donné un chunk valide
+ */
+int t_holder::ouverture_tardive(t_chunk_holder *c, unsigned char *pkey_calculee) {
+	if (chunk_status != HOLDER_CHUNK_STATUS_CLOSED) {
+		return MPM_TRY_ALREADY_OPENED;
+	}
+
+	if (c->magic == CHUNK_HOLDER_MAGIC) {
+		// Rappel : la fonction cw_... ne traite pas les octets non chiffrés
+		memcpy(chunk,  c,             CHUNK_HOLDER_SIZE);
+		memcpy(pkey,   pkey_calculee, 32);
+		memcpy(salt1,  c->salt1,      32);
+		memcpy(salt2,  c->salt2,      32);
+		memcpy(hash,   c->hash,       32);
+		memcpy(parts,  c->parts,      CHUNK_MAX_PARTS*32);
+		memcpy(xparts, c->xparts,     CHUNK_MAX_PARTS*sizeof(xparts[0]));
+		chunk_status = HOLDER_CHUNK_STATUS_OPEN;
+		#ifdef DEBUG
+		debug_printf(0, (char*)"%s() %s magic ok pkey=%lx\n", __func__, nickname, *(uint64_t*)pkey);
+		debug_printf(0, (char*)"%s() %s part[0]=%lx part[7]=%lx\n", __func__, nickname, *(uint64_t*)&parts[0], *(uint64_t*)&parts[7*32]);
+		#endif
+		return MPM_TRY_OK;
+	} else {
+		#ifdef DEBUG
+		debug_printf(0, (char*)"%s() %s magic invalide\n", __func__, nickname);
+		#endif
+		return MPM_TRY_NOT_FOUND;			
+	}
+}
+
 
 
 /** destructeur */
@@ -435,16 +474,15 @@ void t_holder::set_email(char *em) {
 	int l;
 	if (email) free(email);
 
+	email=NULL;
 	if (em) {
 		l=strlen(em);
 		if (l>0) {
 			email=(char*)malloc(l+1);
 			strcpy(email, em);
-			return;
 		}
 	}
-	db->set_changed(MPM_CHANGED_HOLDER);
-	email=NULL;
+	chunk_change();
 }
 
 /** 
@@ -557,7 +595,6 @@ void t_holder::emet_parts() {
 		// Emission des parts 'common'
 	for (int i=0; i< common_nb_parts; i++) {
 		uint64_t x;
-		random_bytes(&x, sizeof(x));
 		x=0;
 		x &= 0xfffffffffff80000;
 		x |= id_holder;
@@ -576,7 +613,6 @@ void t_holder::emet_parts() {
 	// Emission des parts 'secret'
 	for (int i=7; i>= (CHUNK_MAX_PARTS-secret_nb_parts); i--) {
 		uint64_t x;
-		random_bytes(&x, sizeof(x));
 		x=0;
 		x &= 0xfffffffffff80000;
 		x |= id_holder;
@@ -595,7 +631,21 @@ void t_holder::emet_parts() {
 	// bits 19..64 = aléatoire
 	// Ainsi, on est sûr de ne pas distribuer 2 fois la même part
 
-	db->set_changed(MPM_CHANGED_HOLDER);
+	chunk_change();
+}
+
+/** 
+ *  \brief Note le changement du chunk, des parts ou de l'email
+ *  \note 
+ *  - une holder qui a déjà son emplacement dans le fichier est journalisée (MPM_CHANGED_PASSWORD, voir 
+ *    t_database::journalise()). Sinon, ou si le fichier n'a pas de journal, une sauvegarde complète est nécessaire
+ */
+void t_holder::chunk_change() {
+	if ((file_index > 0) && db->journal_note(id_holder, MPM_JOURNAL_HOLDER)) {
+		db->set_changed(MPM_CHANGED_PASSWORD);
+	} else {
+		db->set_changed(MPM_CHANGED_HOLDER);
+	}
 }
 
 
@@ -603,7 +653,7 @@ void t_holder::emet_parts() {
 /** 
  *  \brief Change le mot de passe
  *  \note 
- *  - Cela revient à recalculer la pkey et le hash
+ *  - Cela revient à recalculer la pkey et le hash, les deux en même temps (voir cw_kdf_double())
  */
 void t_holder::set_password(char *mdp) {
 	if ((chunk_status != HOLDER_CHUNK_STATUS_OPEN) && (chunk_status != HOLDER_CHUNK_STATUS_NONE)) {
@@ -612,11 +662,18 @@ void t_holder::set_password(char *mdp) {
 		debug_printf(0, (char*)"%s() Erreur le chunk holder n'est pas en état de changer le MdP\n",(char*)__func__);
 		#endif
 	} else {
-		cw_sha256_iterated_mix1(pkey, nickname, salt2, mdp);
-		cw_sha256_iterated_mix1(hash, nickname, salt1, mdp);
+		unsigned char resultats[64];
+		if (!cw_kdf_double(resultats, nickname, salt2, salt1, mdp, &db->kdf, NULL)) {
+			fprintf(stderr, "Mémoire insuffisante pour la KDF de %s : mot de passe inchangé\n", nickname);
+			memset(resultats, 0, 64);
+			return;
+		}
+		memcpy(pkey, resultats, 32);
+		memcpy(hash, resultats+32, 32);
+		memset(resultats, 0, 64);
 	}
 	password_set = true;
-	db->set_changed(MPM_CHANGED_HOLDER);
+	chunk_change();
 }
 
 /** 
@@ -636,7 +693,7 @@ bool t_holder::test_password(char *mdp) {
 		#endif
 		return false;
 	} else {
-		cw_sha256_iterated_mix1(hash_calcule, nickname, salt1, mdp);
+		if (!cw_kdf(hash_calcule, nickname, salt1, mdp, &db->kdf, NULL)) return false;
 	}
 	return (memcmp(hash_calcule,hash,32) ==0); 
 }
@@ -644,22 +701,21 @@ bool t_holder::test_password(char *mdp) {
 
 
 /** 
- *  \brief Ecrit le chunk dans le fichier
- *  \param[in] fichier Le fichier dans lequel on écrit
+ *  \brief Prépare le chunk tel qu'il doit être écrit dans le fichier
+ *  \param[out] bloc  Les CHUNK_HOLDER_SIZE octets du chunk
  *  \note 
- *  - invoqué par t_database::save()
+ *  - invoqué par save_chunk(), et par t_database::journalise() pour une holder qui garde son emplacement
  *  - Fait le chiffrement
- *  - Le "file_index" a été fixé par le t_database::save()
  */
-void t_holder::save_chunk(FILE *fichier) {
+void t_holder::chunk_fichier(unsigned char *bloc) {
 	t_chunk_holder *p;
 	if (chunk_status == HOLDER_CHUNK_STATUS_CLOSED) { // Cas d'une holder pas 'ouverte'. Le chunk n'a pas été déchiffré, il est réécrit tel quel
 		#ifdef DEBUG
-		debug_printf(0,(char*)"%s() écriture chunk '%s' état closed\n", (char*)__func__, nickname);
+		debug_printf(0,(char*)"%s() chunk '%s' état closed\n", (char*)__func__, nickname);
 		debug_printf(0,(char*)"%s() chunk=%lx partie chiffrée=%lx\n", (char*)__func__, *(uint64_t*) chunk, *(uint64_t*) (chunk+CHUNK_HOLDER_AES_OFFSET));
 		#endif	
 	
-		fwrite(chunk, CHUNK_HOLDER_SIZE, 1, fichier);
+		memcpy(bloc, chunk, CHUNK_HOLDER_SIZE);
 	} else if (chunk_status == HOLDER_CHUNK_STATUS_NONE || chunk_status == HOLDER_CHUNK_STATUS_OPEN) { 
 		p=(t_chunk_holder *)chunk;
 
@@ -679,29 +735,39 @@ void t_holder::save_chunk(FILE *fichier) {
 		p->common_magic=db->common_magic;
 		p->id_holder = id_holder;
 		//p->padding[56] a  déjà initialisé à une valeur aléatoire par le constructeur
-		p->version=CHUNK_HOLDER_VERSION; 
+		p->version=(db->kdf.algo == MPM_KDF_ARGON2ID) ? CHUNK_HOLDER_VERSION_ARGON2 : CHUNK_HOLDER_VERSION; 
 		p->magic=CHUNK_HOLDER_MAGIC;	
 
-		// On chiffre dans un buffer provisoire car le chunk, dans l'objet t_person, est censé rester en clair		
-		unsigned char* partie_aes = (unsigned char*) alloca(CHUNK_HOLDER_AES_SIZE);
-		memcpy(partie_aes, (unsigned char*)p+CHUNK_HOLDER_AES_OFFSET, CHUNK_HOLDER_AES_SIZE);
-		cw_aes_cbc(partie_aes, CHUNK_HOLDER_AES_SIZE, pkey, p->salt1, 1);
+		// On chiffre dans le bloc car le chunk, dans l'objet t_person, est censé rester en clair		
+		memcpy(bloc, chunk, CHUNK_HOLDER_SIZE);
+		cw_aes_cbc(bloc+CHUNK_HOLDER_AES_OFFSET, CHUNK_HOLDER_AES_SIZE, pkey, p->salt1, 1);
+		assert((CHUNK_HOLDER_AES_SIZE+CHUNK_HOLDER_AES_OFFSET) == CHUNK_HOLDER_SIZE);
 
 		#ifdef DEBUG
 		debug_printf(0,(char*)"%s() %s part[0]=%lx part[7]=%lx\n", __func__, nickname, *(uint64_t*)&parts[0], *(uint64_t*)&parts[7*32]);
-		debug_printf(0,(char*)"%s() écriture chunk '%s' état open pkey=%lx\n", (char*)__func__, nickname, *(uint64_t*)pkey);
+		debug_printf(0,(char*)"%s() chunk '%s' état open pkey=%lx\n", (char*)__func__, nickname, *(uint64_t*)pkey);
 		debug_printf(0,(char*)"%s() chunk=%lx partie chiffrée=%lx\n", (char*)__func__, *(uint64_t*) chunk, *(uint64_t*) (chunk+CHUNK_HOLDER_AES_OFFSET));
 		#endif
-
-		fwrite(chunk, CHUNK_HOLDER_AES_OFFSET, 1, fichier); // Enregistre
-		fwrite(partie_aes, CHUNK_HOLDER_AES_SIZE, 1, fichier); // Enregistre
-		assert((CHUNK_HOLDER_AES_SIZE+CHUNK_HOLDER_AES_OFFSET) == CHUNK_HOLDER_SIZE);
 	} else {
 		fprintf(stderr, "%s Runtime line %d file %s\n", __func__,  __LINE__, __FILE__);
 		abort();
 	}
 }
 
+/** 
+ *  \brief Ecrit le chunk dans le fichier
+ *  \param[in] fichier Le fichier dans lequel on écrit
+ *  \note 
+ *  - invoqué par t_database::save()
+ *  - Le "file_index" a été fixé par le t_database::save()
+ */
+void t_holder::save_chunk(FILE *fichier) {
+	unsigned char bloc[CHUNK_HOLDER_SIZE];
+	chunk_fichier(bloc);
+	fwrite(bloc, CHUNK_HOLDER_SIZE, 1, fichier);
+	memset(bloc, 0, CHUNK_HOLDER_SIZE);
+}
+
 /** 
  *  \brief Génère le json pour cette holder
  *  \return Le node json (créé par json_node_alloc(), à libérer par un unref() 
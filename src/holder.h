@@ -51,7 +51,8 @@ class t_database;
 #define CHUNK_MAX_PARTS 8  /**< place disponible dans le chunk pour les parts, common+secret */
 
 #define CHUNK_HOLDER_MAGIC 0x4425827a2cb0794b /**< nombre aléatoire fixe pour vérifier qu'un chunk holder est bien déchiffré */
-#define CHUNK_HOLDER_VERSION 0x0000000000000001 /**< version encodée dans les chunks holder */
+#define CHUNK_HOLDER_VERSION 0x0000000000000002 /**< version encodée dans les chunks holder. 2 : chunks rangés dans une table d'emplacements, voir t_slots_anchor */
+#define CHUNK_HOLDER_VERSION_ARGON2 0x0000000000000003 /**< idem, avec une KDF Argon2id (MPM_KDF_ARGON2ID) au lieu des sha256 itérés */
 
 // Person chunk file structure
 typedef struct t_chunk_holder {
@@ -96,6 +97,7 @@ class t_holder {
 		
 		void load_chunk();		// Charge un holder depuis le fichier .upm
 		void save_chunk(FILE *fichier);		// sauve une holderne dans le fichier .upm
+		void chunk_fichier(unsigned char *bloc);	// prépare le chunk tel qu'il est écrit dans le fichier
 		void load_common();		// Charge un holder d'après le container json common
 
 		#ifdef MPM_GLIB_JSON		
@@ -118,6 +120,7 @@ class t_holder {
 		int get_id_holder();
 		void set_password(char *mdp);
 		int try_tardif(char *password);
+		int ouverture_tardive(t_chunk_holder *c, unsigned char *pkey_calculee);
 		//char *prompt();
 		bool test_password(char *mdp);
 		//void compte_parts(int *common_total_, int *secret_total_, int *common_treshold_, int *secret_treshold_);
@@ -149,6 +152,7 @@ class t_holder {
 		
 	private:	
 		void emet_parts();
+		void chunk_change();
 		
 };
 
@@ -34,6 +34,62 @@
 
 
 
+/***************************************************************************
+ * Encodage binaire des items
+ *
+ * Remplace le json dans les groupes de pages et le journal d'une base MPM_COMMON_PAGES : écrit et relu en une passe,
+ * sans arbre intermédiaire. Entiers de 32 bits petit-boutistes, chaînes précédées de leur longueur et sans \0.
+ *  - item : id, titre, aes_iv (16 octets), nombre de champs, puis les champs
+ *  - champ : un octet d'indicateurs MPM_BINAIRE_xxx, le nom, puis la valeur et la session_key si présentes
+ ***************************************************************************/
+
+static void ecrit_u32(t_ecrit_binaire ecrit, void *contexte, uint32_t v) {
+	unsigned char b[4] = {(unsigned char)v, (unsigned char)(v >> 8), (unsigned char)(v >> 16), (unsigned char)(v >> 24)};
+	ecrit(b, 4, contexte);
+}
+
+static void ecrit_chaine(t_ecrit_binaire ecrit, void *contexte, const char *chaine) {
+	size_t len = strlen(chaine);
+	ecrit_u32(ecrit, contexte, (uint32_t)len);
+	ecrit(chaine, len, contexte);
+}
+
+/** \brief Lit des octets, ou note l'erreur s'il n'en reste pas assez */
+static bool lit_octets(t_lit_binaire *lb, void *dest, size_t len) {
+	if (lb->erreur || ((size_t)(lb->fin - lb->p) < len)) {
+		lb->erreur = true;
+		memset(dest, 0, len);
+		return false;
+	}
+	memcpy(dest, lb->p, len);
+	lb->p += len;
+	return true;
+}
+
+static uint32_t lit_u32(t_lit_binaire *lb) {
+	unsigned char b[4];
+	lit_octets(lb, b, 4);
+	return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+/** \brief Lit une chaîne, malloc()ée et terminée par \0. NULL en cas d'erreur */
+static char *lit_chaine(t_lit_binaire *lb) {
+	uint32_t len = lit_u32(lb);
+	char *chaine;
+
+	if (lb->erreur || ((size_t)(lb->fin - lb->p) < len)) {
+		lb->erreur = true;
+		return NULL;
+	}
+	chaine = (char*)malloc((size_t)len + 1);
+	memcpy(chaine, lb->p, len);
+	chaine[len] = 0;
+	lb->p += len;
+	return chaine;
+}
+
+
+
 /***************************************************************************
  * Classe t_secret_field::
  ***************************************************************************/
@@ -49,6 +105,7 @@ t_secret_field::t_secret_field(char *field_name_, char *value_, t_secret_item *p
 	piggy_banked = false;
 	secret=false;
 	value_plain=NULL;
+	clair_lot=0;
 	session_key=NULL;	
 }
 
@@ -56,6 +113,7 @@ t_secret_field::t_secret_field(char *field_name_, char *value_, t_secret_item *p
 t_secret_field::t_secret_field(JsonObject *jso, t_secret_item *parent_secret_ ) {
 	parent_secret = parent_secret_;
 	value_plain=NULL;
+	clair_lot=0;
 
 	// Récupère le nom de champ
 	char *nn = (char*)json_object_get_string_member (jso, "field_name");
@@ -101,6 +159,7 @@ t_secret_field::t_secret_field(JsonObject *jso, t_secret_item *parent_secret_ )
 t_secret_field::t_secret_field(json_t *jso, t_secret_item *parent_secret_ ) {
 	parent_secret = parent_secret_;
 	value_plain=NULL;
+	clair_lot=0;
 
 	// Récupère le nom de champ
 	json_t *jsfn = json_object_get(jso, "field_name");
@@ -151,8 +210,23 @@ t_secret_field::t_secret_field(json_t *jso, t_secret_item *parent_secret_ ) {
 }
 #endif
 
+/** \brief Constructeur depuis l'encodage binaire. En cas d'erreur, lb->erreur est levé et le champ est à supprimer */
+t_secret_field::t_secret_field(t_lit_binaire *lb, t_secret_item *parent_secret_ ) {
+	unsigned char indicateurs;
+
+	parent_secret = parent_secret_;
+	value_plain=NULL;
+	clair_lot=0;
+	lit_octets(lb, &indicateurs, 1);
+	field_name = lit_chaine(lb);
+	secret = ((indicateurs & MPM_BINAIRE_SECRET) != 0);
+	piggy_banked = ((indicateurs & MPM_BINAIRE_TIRELIRE) != 0);
+	value = (indicateurs & MPM_BINAIRE_VALEUR) ? lit_chaine(lb) : NULL;
+	session_key = (indicateurs & MPM_BINAIRE_SESSION) ? (unsigned char*)lit_chaine(lb) : NULL;
+}
 
 t_secret_field::~t_secret_field() {
+	oublie_clair();
 	if (value) {
 		memset(value, 0, strlen(value));
 		free(value);
@@ -165,10 +239,18 @@ t_secret_field::~t_secret_field() {
 		memset(session_key, 0, 32);
 		free(session_key);
 	}	
-	if (value_plain) {
-		memset(value, 0, strlen(value_plain));
+}
+
+void t_secret_field::oublie_clair() {
+	if (value_plain == NULL) return;
+	if (clair_lot == 0) {
+		memset(value_plain, 0, strlen(value_plain));
 		free(value_plain);
-	}
+	} else if (clair_lot == parent_secret->parent->get_db()->clairs_lot) {
+		memset(value_plain, 0, strlen(value_plain));
+	} // sinon, l'arena a déjà été effacée par un lot plus récent
+	value_plain = NULL;
+	clair_lot = 0;
 }
 
 
@@ -181,6 +263,7 @@ t_secret_field::~t_secret_field() {
  * - L'encode base64
  */
 void t_secret_field::update(char *value_) {
+	oublie_clair();
 	if (value) {
 		#ifdef DEBUG
 		debug_printf(0,(char*)"%s() suppression de la valeur précedente\n", __func__, __FILE__, __LINE__);
@@ -210,7 +293,7 @@ void t_secret_field::update(char *value_) {
 			#endif
 		#endif
 
-		cw_aes_cbc(aes_buffer, aes_len, parent_secret->get_aes_secret(), parent_secret->get_aes_iv(), 0);
+		cw_aes_cbc_cle(parent_secret->get_aes_secret(), aes_buffer, aes_len, parent_secret->get_aes_iv(), 0);
 	
 		value = lb64_bin2string(NULL, aes_buffer, aes_len, &err); // laisse lb64 faire le malloc()
 		#ifdef DEBUG
@@ -235,7 +318,7 @@ void t_secret_field::update(char *value_) {
 		#endif
 		value=strdup(value_);
 	}
-	parent_secret->parent->get_db()->set_changed(MPM_CHANGED_SECRET);
+	parent_secret->set_changed();
 }
 
 bool t_secret_field::is_field_name(char *field_name_) {
@@ -254,22 +337,21 @@ char *t_secret_field::get_value() {
 		#ifdef DEBUG
 		debug_printf(0,(char*)"%s() sur un champ secret\n", __func__, __FILE__, __LINE__);
 		#endif
+		if ((value_plain) && (clair_lot != 0) && (clair_lot == parent_secret->parent->get_db()->clairs_lot)) {
+			return value_plain; // déjà déchiffré par un lot, voir t_secret_item::decrypt_secrets()
+		}
 		size_t b64_len = strlen(value);
 		int err;
 		size_t len;
 
-		if (value_plain) {
-			memset(value_plain, 0, strlen(value_plain));
-			free(value_plain);
-			value_plain=NULL;
-		}
+		oublie_clair();
 		
 		// Ce buffer va contenir la valeur decodé b64, puis l'AES va travailler dedans par blocs de 16
 		// Donc longueur malloc()ée en conséquence
 		value_plain = (char*) malloc(48+(b64_len*4/3));	 
 
 		#ifdef DEBUG
-		debug_printf(0,(char*)"%s() b64=%s secret key=%lx iv=%lx\n", __func__, value, *(uint64_t*) parent_secret->get_aes_secret(), *(uint64_t*) parent_secret->get_aes_iv());
+		debug_printf(0,(char*)"%s() b64=%s secret key=%lx iv=%lx\n", __func__, value, *(uint64_t*) parent_secret->parent->get_db()->secret_key, *(uint64_t*) parent_secret->get_aes_iv());
 			#ifdef __linux__
 			mcheck_check_all();
 			#endif
@@ -293,7 +375,7 @@ char *t_secret_field::get_value() {
 				#endif
 			#endif
 		}
-		cw_aes_cbc((unsigned char*)value_plain, len, parent_secret->get_aes_secret(), parent_secret->get_aes_iv(), 1);
+		cw_aes_cbc_cle(parent_secret->get_aes_secret(), (unsigned char*)value_plain, len, parent_secret->get_aes_iv(), 1);
 		#if defined(__linux__) && defined(DEBUG)
 		mcheck_check_all();
 		#endif
@@ -355,7 +437,16 @@ json_t *t_secret_field::save() {
 }
 #endif
 
+/** \brief Encodage binaire du champ, voir t_secret_item::save_binaire() */
+void t_secret_field::save_binaire(t_ecrit_binaire ecrit, void *contexte) {
+	unsigned char indicateurs = (secret ? MPM_BINAIRE_SECRET : 0) | (piggy_banked ? MPM_BINAIRE_TIRELIRE : 0)
+	                          | (value ? MPM_BINAIRE_VALEUR : 0) | (session_key ? MPM_BINAIRE_SESSION : 0);
 
+	ecrit(&indicateurs, 1, contexte);
+	ecrit_chaine(ecrit, contexte, field_name);
+	if (value) ecrit_chaine(ecrit, contexte, value);
+	if (session_key) ecrit_chaine(ecrit, contexte, (const char*)session_key);
+}
 
 
 
@@ -420,6 +511,7 @@ t_secret_item::t_secret_item(t_secret_folder* parent_, char* title_, uint32_t id
 	title=strdup(title_);
 	parent=parent_;	
 	fields=NULL;
+	groupe=NULL;
 	
 	update_field((char*)"user", (char*)"duchnok");
 	update_field((char*)"url", (char*)"http://bidule.truc.tld");
@@ -431,6 +523,7 @@ t_secret_item::t_secret_item(t_secret_folder* parent_, char* title_, uint32_t id
 #ifdef MPM_GLIB_JSON
 t_secret_item::t_secret_item(JsonObject *jso, t_secret_folder* parent_) {
 	parent = parent_;
+	groupe = NULL;
 
 	// Récupération du titre
 	char *s = (char*)json_object_get_string_member (jso, "title");
@@ -487,6 +580,7 @@ t_secret_item::t_secret_item(JsonObject *jso, t_secret_folder* parent_) {
 #ifdef  MPM_JANSSON
 t_secret_item::t_secret_item(json_t *jso, t_secret_folder* parent_) {
 	parent = parent_;
+	groupe = NULL;
 
 	// Récupération du titre
 	json_t *jst = json_object_get(jso, "title");
@@ -547,6 +641,25 @@ t_secret_item::t_secret_item(json_t *jso, t_secret_folder* parent_) {
 }
 #endif
 
+/** 
+ * \brief Constructeur depuis l'encodage binaire, voir save_binaire()
+ * \note en cas d'erreur, lb->erreur est levé et l'item est à supprimer
+ */
+t_secret_item::t_secret_item(t_lit_binaire *lb, t_secret_folder* parent_) {
+	uint32_t nb_fields;
+
+	parent = parent_;
+	groupe = NULL;
+	fields = NULL;
+	id = lit_u32(lb);
+	title = lit_chaine(lb);
+	lit_octets(lb, aes_iv, 16);
+	nb_fields = lit_u32(lb);
+	for (uint32_t i=0; (i<nb_fields) && !lb->erreur; i++) {
+		fields = tdll_append(fields, new t_secret_field(lb, this));
+	}
+}
+
 
 
 uint32_t t_secret_item::get_id() {
@@ -562,12 +675,37 @@ void t_secret_item::set_title(char *title_) {
 		free(title);
 	}
 	title = strdup(title_);
-	parent->get_db()->set_changed(MPM_CHANGED_SECRET);
+	set_changed();
 }
 
 unsigned char *t_secret_item::get_aes_iv() {
 	return aes_iv;
 }
+
+/** 
+ * \brief Encodage binaire de l'item, sans arbre intermédiaire : chaque morceau est passé à ecrit() au fil de l'eau
+ * \note invoqué par t_database::save() pour les groupes de pages, et par t_database::journalise()
+ */
+void t_secret_item::save_binaire(t_ecrit_binaire ecrit, void *contexte) {
+	uint32_t nb_fields = 0;
+	tdllist *gl;
+
+	for (gl = fields; gl != NULL; gl = gl->next) nb_fields++;
+	ecrit_u32(ecrit, contexte, id);
+	ecrit_chaine(ecrit, contexte, title);
+	ecrit(aes_iv, 16, contexte);
+	ecrit_u32(ecrit, contexte, nb_fields);
+	for (gl = fields; gl != NULL; gl = gl->next) ((t_secret_field*)gl->data)->save_binaire(ecrit, contexte);
+}
+
+/**
+ * \brief Note le changement de l'item : la base est à sauvegarder, l'item à journaliser, et son groupe de pages à réécrire
+ */
+void t_secret_item::set_changed() {
+	if (groupe) groupe->modifie = true;
+	parent->get_db()->journal_note(id, MPM_JOURNAL_ITEM);
+	parent->get_db()->set_changed(MPM_CHANGED_SECRET);
+}
 /**
  * \brief libération des ressources du secret item
  * \todo Ecrire le destructeur de t_secret_item. LIbérer les fields, mais aussi la GList elle-même
@@ -598,7 +736,7 @@ void t_secret_item::update_field(char *field_name_, char *value_) {
 	}
 	//fields = g_list_append(fields, new t_secret_field(field_name_, value_, this));
 	fields = tdll_append(fields, new t_secret_field(field_name_, value_, this));
-	parent->get_db()->set_changed(MPM_CHANGED_SECRET);
+	set_changed();
 }
 
 /*GList*/ tdllist *t_secret_item::get_fields() {
@@ -635,7 +773,7 @@ void t_secret_item::delete_field(char *field_name) {
 			return;
 		}
 	}
-	parent->get_db()->set_changed(MPM_CHANGED_SECRET);
+	set_changed();
 }
 
 
@@ -698,9 +836,10 @@ json_t *t_secret_item::save() {
 #endif
 
 
-unsigned char *t_secret_item::get_aes_secret() {
+t_cw_aes *t_secret_item::get_aes_secret() {
 	//t_secret_folder* parent;
-	return parent->db->secret_key;
+	if (parent->db->secret_aes == NULL) parent->db->secret_aes = cw_aes_new(parent->db->secret_key); // niveau secret pas encore ouvert, comme avant
+	return parent->db->secret_aes;
 }
 
 
@@ -714,7 +853,7 @@ void t_secret_item::set_field_secret(char *field_name_) {
 			((t_secret_field*)gl->data)->set_secret();
 		}
 	}
-	parent->get_db()->set_changed(MPM_CHANGED_SECRET);
+	set_changed();
 }
 
 /**
@@ -727,7 +866,7 @@ void t_secret_item::set_field_common(char *field_name_) {
 			((t_secret_field*)gl->data)->set_common();
 		}
 	}
-	parent->get_db()->set_changed(MPM_CHANGED_SECRET);
+	set_changed();
 }
 
 	
@@ -742,6 +881,9 @@ t_secret_folder::t_secret_folder(t_secret_folder* parent_, const char* title_, u
 	title=strdup(title_);
 	sub_folders=NULL;
 	secrets=NULL;
+	groupes=NULL;
+	items_lus=true;
+	groupes_illisibles=false;
 	id=id_;
 	db=db_;
 }
@@ -750,6 +892,9 @@ t_secret_folder::t_secret_folder(t_secret_folder* parent_, const char* title_, u
 t_secret_folder::t_secret_folder(JsonObject *jso, t_secret_folder* parent_, t_database *db_) {
 	parent = parent_;
 	db=db_;
+	groupes=NULL;
+	items_lus=true;
+	groupes_illisibles=false;
 
 	// Récupération du titre
 	char *s = (char*)json_object_get_string_member (jso, "title");
@@ -789,6 +934,9 @@ t_secret_folder::t_secret_folder(JsonObject *jso, t_secret_folder* parent_, t_da
 t_secret_folder::t_secret_folder(json_t *jso, t_secret_folder* parent_, t_database *db_) {
 	parent = parent_;
 	db=db_;
+	groupes=NULL;
+	items_lus=true;
+	groupes_illisibles=false;
 
 	// Récupération du titre
 	json_t *jst = json_object_get(jso, "title");
@@ -850,6 +998,7 @@ t_secret_folder::~t_secret_folder() {
 			abort();
 		}	
 	}
+	libere_groupes();
 
 	// Libère le titre
 	if (title != NULL) {
@@ -925,9 +1074,60 @@ json_t *t_secret_folder::save() {
 }
 
 /*GList*/ tdllist *t_secret_folder::get_secrets() {
+	charge_items();
 	return secrets;
 }
 
+tdllist *t_secret_folder::get_groupes() {
+	return groupes;
+}
+
+/**
+ * \brief Lit les items du dossier dans ses groupes de pages, s'ils ne l'ont pas encore été
+ * \note 
+ * - à la lecture d'une base MPM_COMMON_PAGES, seuls les dossiers et leurs groupes sont connus : les items d'un dossier 
+ *   ne sont déchiffrés qu'au premier accès (ls, show, get, modification...), le temps d'accès ne dépend donc pas de la
+ *   taille de la base
+ * - invoqué par les méthodes qui parcourent les items, voir t_database::read_pages_items()
+ * - si un groupe est illisible, les items des autres groupes sont lus : le groupe illisible est gardé par les sauvegardes
+ *   incrémentales (voir t_database::save_groupes() ), et une sauvegarde complète est refusée
+ */
+void t_secret_folder::charge_items() {
+	if (items_lus) return;
+	items_lus = true;
+	if (!db->read_pages_items(this)) {
+		groupes_illisibles = true;
+		printf("Erreur d'intégrité de la base 'common' dans le dossier %s\n", title);
+	}
+}
+
+/**
+ * \brief Lit les items du dossier et de ses sous-dossiers
+ * \note invoqué avant une sauvegarde complète ou un changement de fichier, qui ne pourront plus relire les pages
+ */
+void t_secret_folder::charge_tout() {
+	charge_items();
+	for (tdllist *gl=sub_folders; gl!=NULL; gl=gl->next) ((t_secret_folder*)gl->data)->charge_tout();
+}
+
+bool t_secret_folder::get_items_lus() {
+	return items_lus;
+}
+
+/**
+ * \brief Cherche un dossier dont un groupe de pages est illisible, voir charge_items()
+ * \note ses items ne sont pas connus : une sauvegarde complète, qui ne réécrit que les items lus, les perdrait
+ */
+t_secret_folder *t_secret_folder::get_illisible() {
+	t_secret_folder *f;
+
+	if (groupes_illisibles) return this;
+	for (tdllist *gl=sub_folders; gl!=NULL; gl=gl->next) {
+		if ((f = ((t_secret_folder*)gl->data)->get_illisible()) != NULL) return f;
+	}
+	return NULL;
+}
+
 uint32_t t_secret_folder::get_id() {
 	return id;
 }
@@ -942,6 +1142,7 @@ void t_secret_folder::set_title(char* title_){
 		free(title);	
 	}
 	title=strdup(title_);
+	db->journal_note(id, MPM_JOURNAL_DOSSIER);
 	db->set_changed(MPM_CHANGED_SECRET);
 }
 
@@ -974,6 +1175,7 @@ t_secret_folder *t_secret_folder::get_sub_folder_by_id(int id) {
 
 t_secret_item* t_secret_folder::get_secret_by_id(int id) {
 	/*GList*/ tdllist* gl;
+	charge_items();
 	for (gl=secrets; gl!=NULL; gl=gl->next) {
 		if (gl->data != NULL) {
 			if ( ((t_secret_item*)gl->data)->get_id() == id ) return (t_secret_item*)gl->data;
@@ -991,6 +1193,7 @@ t_secret_item* t_secret_folder::get_secret_by_id(int id) {
 void t_secret_folder::add_sub_folder(t_secret_folder* nf) {
 	//sub_folders = g_list_append(sub_folders, nf);
 	sub_folders = tdll_append(sub_folders, nf);
+	db->journal_note(nf->id, MPM_JOURNAL_DOSSIER);
 	db->set_changed(MPM_CHANGED_SECRET);
 }
 
@@ -1000,7 +1203,9 @@ void t_secret_folder::add_sub_folder(t_secret_folder* nf) {
  */
 void t_secret_folder::add_secret_item(t_secret_item *secret){
 	//secrets=g_list_append(secrets, secret);
+	charge_items(); // le nouvel item suit ceux des groupes
 	secrets=tdll_append(secrets, secret);
+	db->journal_note(secret->id, MPM_JOURNAL_ITEM);
 	db->set_changed(MPM_CHANGED_SECRET);
 }
 
@@ -1011,9 +1216,12 @@ void t_secret_folder::delete_secret_item(int id){
 	//printf("%s() ligne %d du fichier %s : fonction pas implémentée\n", __func__, __LINE__, __FILE__);
 	
 	/*GList*/ tdllist* gl;
+	charge_items();
 	for (gl=secrets; gl!=NULL; gl=gl->next) {
 		if (gl->data != NULL) {
 			if ( ((t_secret_item*)gl->data)->get_id() == id ) {
+				((t_secret_item*)gl->data)->set_changed(); // son groupe de pages est à réécrire sans lui
+				db->journal_note(id, MPM_JOURNAL_SUPPRIME_ITEM);
 				delete (t_secret_item*)gl->data;
 				gl->data=NULL;
 				//secrets = g_list_delete_link (secrets, gl);
@@ -1080,10 +1288,34 @@ void t_secret_folder::delete_sub_folder(int id) {
 		sf->delete_all();
 		delete sf;
 	}
+	db->journal_note(id, MPM_JOURNAL_SUPPRIME_DOSSIER);
 	db->set_changed(MPM_CHANGED_SECRET);
 }
 
 
+/**
+ * \brief Oublie les groupes de pages du dossier et de ses sous-dossiers
+ * \note 
+ * - invoqué avant une sauvegarde complète, qui réécrit tous les secrets
+ * - les pages elles-mêmes ne sont pas touchées : elles ne sont plus référencées
+ */
+void t_secret_folder::oublie_pages() {
+	for (tdllist *gl=secrets; gl!=NULL; gl=gl->next) ((t_secret_item*)gl->data)->groupe = NULL;
+	libere_groupes();
+	for (tdllist *gl=sub_folders; gl!=NULL; gl=gl->next) ((t_secret_folder*)gl->data)->oublie_pages();
+}
+
+void t_secret_folder::libere_groupes() {
+	for (tdllist *gl=groupes; gl!=NULL; gl=gl->next) {
+		t_groupe_pages *g = (t_groupe_pages*)gl->data;
+		free(g->pages);
+		free(g);
+	}
+	tdll_free(groupes);
+	groupes=NULL;
+}
+
+
 /**
  * \brief Indique si un ID de dossier/secret est disponible
  * \note Les ID des dossiers et des secrets sont pris dans le même espace, et sont uniques, mais recyclés. A chaque nouvel objet, on cherche l'ID le plus petit
@@ -1104,6 +1336,7 @@ bool t_secret_folder::is_id_free(uint32_t id_) {
 	}
 
 	// parcours les secret items
+	charge_items();
 	for (gl=secrets; gl!=NULL; gl=gl->next) {
 		if (gl->data != NULL) {
 			if ( ((t_secret_item*)gl->data)->get_id()== id_ ) return false;
@@ -1153,6 +1386,7 @@ char *t_secret_folder::prompt() {
 }
 
 bool t_secret_folder::is_empty() {
+	charge_items();
 	if (secrets) return false;
 	if (sub_folders) return false;
 	return true;
@@ -1161,3 +1395,134 @@ bool t_secret_folder::is_empty() {
 t_database *t_secret_folder::get_db() {
 	return db;
 }
+
+
+
+/***************************************************************************
+ * Déchiffrement des champs secrets par lot
+ ***************************************************************************/
+
+/** \brief Champs secrets collectés sous un item ou un dossier, pour être déchiffrés en une seule passe
+ *  \note 
+ *  - tous les champs secrets partagent la clé secret_key, déjà préparée dans la base : seuls les IV diffèrent, un par item
+ *  - les valeurs en clair sont écrites dans une seule arena, celle de la base, verrouillée en mémoire si possible
+ *  - l'arena ne contient qu'un lot à la fois : les champs du lot précédent seront redéchiffrés un par un à la demande
+ */
+struct t_secret_lot {
+	t_secret_field **champs;
+	int n;
+	int max;
+	size_t taille; ///< place nécessaire dans l'arena
+
+	t_secret_lot() { champs=NULL; n=max=0; taille=0; }
+	~t_secret_lot() { free(champs); }
+
+	/** \brief Place d'un champ dans l'arena : base64 décodé, plus le \0 final, arrondi au bloc de 16 */
+	static size_t place(t_secret_field *f) {
+		return ((strlen(f->value)+3)/4*3 + 1 + 15) & (~0xf);
+	}
+
+	void ajoute_item(t_secret_item *s) {
+		for (tdllist *gl=s->get_fields(); gl; gl=gl->next) {
+			t_secret_field *f = (t_secret_field*)gl->data;
+			if ((!f->secret) || (f->value == NULL)) continue;
+			f->oublie_clair();
+			if (n == max) {
+				max = max ? 2*max : 16;
+				champs = (t_secret_field**)realloc(champs, max*sizeof(t_secret_field*));
+			}
+			champs[n++] = f;
+			taille += place(f);
+		}
+	}
+
+	void ajoute_dossier(t_secret_folder *d) {
+		for (tdllist *gl=d->get_secrets(); gl; gl=gl->next) ajoute_item((t_secret_item*)gl->data);
+		for (tdllist *gl=d->get_sub_folders(); gl; gl=gl->next) ajoute_dossier((t_secret_folder*)gl->data);
+	}
+
+	/** \brief Décode et déchiffre tous les champs collectés
+	 *  \return le nombre de champs déchiffrés. Un champ mal décodé est laissé à t_secret_field::get_value()
+	 */
+	int dechiffre(t_database *db) {
+		if (n == 0) return 0;
+		if (db->clairs == NULL) db->clairs = cw_kdf_ctx_new();
+		db->oublie_clairs();
+		unsigned char *arena = cw_kdf_ctx_arena(db->clairs, taille);
+		if (arena == NULL) return 0; // faute de mémoire, chaque champ sera déchiffré seul par get_value()
+
+		unsigned char **buffers = (unsigned char**)malloc(n*sizeof(unsigned char*));
+		unsigned char **ivs = (unsigned char**)malloc(n*sizeof(unsigned char*));
+		size_t *lens = (size_t*)malloc(n*sizeof(size_t));
+		size_t o = 0;
+		int nb = 0;
+
+		if ((buffers == NULL) || (ivs == NULL) || (lens == NULL)) { // comme pour l'arena : get_value() champ par champ
+			free(buffers);
+			free(ivs);
+			free(lens);
+			return 0;
+		}
+
+		for (int i=0; i<n; i++) {
+			t_secret_field *f = champs[i];
+			size_t p = place(f);
+			int err;
+			size_t len;
+
+			buffers[i] = arena + o;
+			ivs[i] = f->parent_secret->get_aes_iv();
+			lb64_string2bin(buffers[i], &len, p-1, f->value, &err);
+			if ((err != LB64_OK) || ((len & 0xf) != 0)) {
+				#ifdef DEBUG
+				debug_printf(0,(char*)"%s() f=%s l=%d champ %s mal décodé, err=%d len=%lu\n", __func__, __FILE__, __LINE__, f->field_name, err, (unsigned long)len);
+				#endif
+				len = 0;
+			}
+			lens[i] = len;
+			o += p;
+		}
+
+		cw_aes_cbc_multi(champs[0]->parent_secret->get_aes_secret(), n, buffers, lens, ivs, 1);
+
+		for (int i=0; i<n; i++) {
+			if (lens[i] == 0) continue;
+			buffers[i][lens[i]] = 0;
+			champs[i]->value_plain = (char*)buffers[i];
+			champs[i]->clair_lot = db->clairs_lot;
+			nb++;
+		}
+		#ifdef DEBUG
+		debug_printf(0,(char*)"%s() lot %u : %d champs sur %d, %lu octets\n", __func__, db->clairs_lot, nb, n, (unsigned long)taille);
+		#endif
+
+		free(buffers);
+		free(ivs);
+		free(lens);
+		return nb;
+	}
+};
+
+/**
+ * \brief Déchiffre en une passe tous les champs secrets de l'item
+ * \return le nombre de champs déchiffrés
+ * \note 
+ * - get_value() renvoie ensuite directement la valeur en clair, jusqu'au lot suivant (voir t_secret_lot)
+ * - à n'appeler qu'au niveau MPM_LEVEL_SECRET
+ */
+int t_secret_item::decrypt_secrets() {
+	t_secret_lot lot;
+	lot.ajoute_item(this);
+	return lot.dechiffre(parent->get_db());
+}
+
+/**
+ * \brief Déchiffre en une passe tous les champs secrets des items du dossier et de ses sous-dossiers
+ * \return le nombre de champs déchiffrés
+ * \note voir t_secret_item::decrypt_secrets()
+ */
+int t_secret_folder::decrypt_secrets() {
+	t_secret_lot lot;
+	lot.ajoute_dossier(this);
+	return lot.dechiffre(db);
+}
@@ -23,6 +23,7 @@
 
 #include <stdint.h>
 #include <tdll.h>
+#include "crypto_wrapper.h"
 
 
 
@@ -43,8 +44,43 @@ class t_database;
 class t_secret_folder;
 class t_secret_item;
 
+/** \brief Page d'une base common MPM_COMMON_PAGES : son numéro, et la sauvegarde qui l'a écrite, authentifiée avec elle */
+typedef struct t_page_ref {
+	uint32_t index;
+	uint32_t generation;
+} t_page_ref;
+
+/** \brief Items consécutifs d'un dossier, écrits ensemble dans les mêmes pages d'une base MPM_COMMON_PAGES. Voir t_database::save() */
+typedef struct t_groupe_pages {
+	int nb_pages;
+	t_page_ref *pages;
+	size_t taille;   ///< longueur du clair du groupe, compressé ou non
+	bool modifie;    ///< un item du groupe a changé ou a été supprimé : le groupe est à réécrire dans de nouvelles pages
+	bool reference;  ///< un item lu appartient au groupe, voir t_database::save_groupes()
+} t_groupe_pages;
+
+/** \brief Reçoit les octets de l'encodage binaire d'un item, dans l'ordre. Voir t_secret_item::save_binaire() */
+typedef void (*t_ecrit_binaire)(const void *data, size_t len, void *contexte);
+
+/** \brief Lecture d'un encodage binaire, voir t_secret_item::t_secret_item(t_lit_binaire*, t_secret_folder*) */
+typedef struct t_lit_binaire {
+	const unsigned char *p;    ///< prochain octet à lire
+	const unsigned char *fin;
+	bool erreur;               ///< lecture au-delà de fin : l'objet construit est à supprimer
+} t_lit_binaire;
+
+/** \name Indicateurs d'un champ dans son encodage binaire, voir t_secret_field::save_binaire() */
+//!@{
+#define MPM_BINAIRE_SECRET 0x01
+#define MPM_BINAIRE_TIRELIRE 0x02
+#define MPM_BINAIRE_VALEUR 0x04
+#define MPM_BINAIRE_SESSION 0x08
+//!@}
+
 
 class t_secret_field {
+	friend struct t_secret_lot;
+
 	public:
 	t_secret_field(char *field_name_, char *value_, t_secret_item *parent_secret_ );
 	
@@ -56,6 +92,8 @@ class t_secret_field {
 	t_secret_field(json_t *jso, t_secret_item *parent_secret_ );
 	json_t *save();
 	#endif
+	t_secret_field(t_lit_binaire *lb, t_secret_item *parent_secret_ );
+	void save_binaire(t_ecrit_binaire ecrit, void *contexte);
 
 	
 	~t_secret_field();
@@ -76,6 +114,8 @@ class t_secret_field {
 
 
 	private:
+	void oublie_clair(); ///< Efface la valeur en clair, qu'elle soit malloc()ée ou dans l'arena d'un lot
+
 	char *field_name;
 	char *value;
 	bool secret;
@@ -83,6 +123,7 @@ class t_secret_field {
 	unsigned char *session_key; // Seulement si valeur en tirelire
 	t_secret_item *parent_secret;
 	char *value_plain; ///< pour contenir le champ en clair, si celui-ci est 'secret'
+	uint32_t clair_lot; ///< 0 si value_plain est malloc()é, sinon le lot qui l'a déchiffré dans l'arena de la base (voir t_secret_item::decrypt_secrets() )
 	
 	/** \todo Gérer le versionning */
 };
@@ -91,6 +132,8 @@ class t_secret_field {
 
 class t_secret_item {
 	friend class t_secret_field;
+	friend class t_secret_folder; // pour les groupes de pages
+	friend class t_database;
 
 	public:
 		t_secret_item(t_secret_folder* parent_, char* title_, uint32_t id_);
@@ -105,6 +148,8 @@ class t_secret_item {
 		t_secret_item(json_t *jso, t_secret_folder* parent_);
 		json_t *save();	// Ajouter le secret dans le container json common
 		#endif		
+		t_secret_item(t_lit_binaire *lb, t_secret_folder* parent_);
+		void save_binaire(t_ecrit_binaire ecrit, void *contexte); ///< encodage binaire des groupes de pages et du journal
 		~t_secret_item();
 		void load();	// Charge le secret depuis le container json common
 
@@ -120,7 +165,9 @@ class t_secret_item {
 		char *field_value(char *field_name);
 		/*GList*/ tdllist *get_fields();
 		unsigned char *get_aes_iv();
-		unsigned char *get_aes_secret(); ///< va chercher la clé du niveau secret dans la DB parent
+		t_cw_aes *get_aes_secret(); ///< va chercher la clé du niveau secret, déjà préparée, dans la DB parent
+		int decrypt_secrets(); ///< déchiffre en une passe tous les champs secrets de l'item
+		void set_changed(); ///< note le changement de l'item, pour la sauvegarde
 
 	private: 
 		uint32_t id;
@@ -128,12 +175,14 @@ class t_secret_item {
 		t_secret_folder* parent;
 		/*GList*/tdllist *fields;
 		unsigned char aes_iv[16]; ///< pour servir de vecteur d'initialisation à tous les champs de ce secret
+		t_groupe_pages *groupe; ///< groupe de pages qui contient l'item, NULL tant qu'il n'a pas été écrit
 
 };
 
 
 class t_secret_folder {
 	friend class t_secret_item;
+	friend class t_database; // pour les groupes de pages
 
 	public:
 		t_secret_folder(t_secret_folder* parent_, const char* title_, uint32_t id_, t_database *db_); // Constructeur pour création interactive par l'utilisateur
@@ -173,10 +222,18 @@ class t_secret_folder {
 		char *prompt(); ///< renvoie la chaine utilisée comme prompt dans le submode 
 		bool is_empty(); ///< indique si le dossier contient quelque chose (utilisé pour la suppression)
 		t_database *get_db(); ///< renvoie la DB principale
+		int decrypt_secrets(); ///< déchiffre en une passe tous les champs secrets du dossier et de ses sous-dossiers
+		void oublie_pages(); ///< oublie les groupes de pages du dossier et de ses sous-dossiers, avant une sauvegarde complète
+		tdllist *get_groupes(); ///< les groupes de pages des secrets, pour le répertoire d'une base MPM_COMMON_PAGES
+		void charge_items(); ///< lit les items des groupes de pages, au premier accès
+		void charge_tout(); ///< lit les items du dossier et de ses sous-dossiers qui ne l'ont pas encore été
+		bool get_items_lus();
+		t_secret_folder *get_illisible(); ///< ce dossier ou un sous-dossier dont un groupe de pages n'a pas pu être lu, NULL sinon
 
 	private:
 		//void load();	// Charge le secret depuis le container json common
 		void delete_all(); ///< suppression récursive de tout le contenu
+		void libere_groupes(); ///< libère les groupes de pages de ce seul dossier
 
 		t_secret_folder *parent; // NULL pour le dossier racine
 		char* title;
@@ -184,6 +241,9 @@ class t_secret_folder {
 
 		/*GList*/ tdllist* sub_folders; // Les sous-dossiers
 		/*GList*/ tdllist* secrets; // les secrets contenus dans ce dossier
+		tdllist *groupes; ///< les t_groupe_pages des secrets, dans l'ordre des secrets
+		bool items_lus; ///< false tant que les items des groupes n'ont pas été lus dans le fichier, voir charge_items()
+		bool groupes_illisibles; ///< un groupe n'a pas pu être lu par charge_items() : il est gardé tel quel, sans ses items
 		t_database *db; ///< lien avec la base principale
 };
 
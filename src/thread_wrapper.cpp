@@ -0,0 +1,189 @@
+/*
+    MPM 'Master Password Manager' 
+	Cryptographically secure Secret Sharing to store residual secret.
+    Copyright (C) 2018-2019 Bertrand MAUJEAN
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    A copy of the GNU GPLv3 License is included in the LICENSE.txt file
+    You can also see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+/**
+ * \file thread_wrapper.cpp
+ * \brief Wrapper pour les threads et mutex
+ * \note
+ * - Utilise les pthreads sous Linux, et l'API Win32 sous Windows
+ * - le seul endroit où on doit invoquer pthread_* / CreateThread()
+ * - Sert à répartir les calculs de KDF sur tous les coeurs disponibles
+ */
+#include <stdio.h> /* pour stderr */
+#include <stdlib.h>
+#include "thread_wrapper.h"
+
+#ifdef __linux__
+#include <unistd.h> /* pour sysconf() */
+#include <time.h> /* pour clock_gettime() */
+#endif
+
+
+/** \brief Paramètres transmis à la fonction de lancement d'un thread */
+typedef struct t_tw_lancement {
+	tw_fonction fonction;
+	void *arg;
+} t_tw_lancement;
+
+
+#ifdef _WIN32
+static DWORD WINAPI tw_lancement(LPVOID p) {
+#else
+static void *tw_lancement(void *p) {
+#endif
+	t_tw_lancement l = *(t_tw_lancement*)p;
+	free(p);
+	l.fonction(l.arg);
+	return 0;
+}
+
+
+/** \brief Renvoie le nombre de coeurs disponibles, au moins 1
+ */
+int tw_nb_cpu() {
+	int n=1;
+	#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	n = (int)si.dwNumberOfProcessors;
+	#else
+	#ifdef _SC_NPROCESSORS_ONLN
+	n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	#endif
+	#endif
+	if (n<1) n=1;
+	if (n>TW_MAX_THREADS) n=TW_MAX_THREADS;
+	return n;
+}
+
+
+/** \brief Lance un thread
+ *  \param[out] thread    Le handle du thread, à passer ensuite à tw_thread_join()
+ *  \param[in]  fonction  La fonction exécutée par le thread
+ *  \param[in]  arg       L'argument transmis à la fonction
+ *  \return 0 si Ok, -1 si le thread n'a pas pu être créé
+ */
+int tw_thread_create(tw_thread *thread, tw_fonction fonction, void *arg) {
+	t_tw_lancement *l = (t_tw_lancement*)malloc(sizeof(t_tw_lancement));
+	if (l == NULL) return -1;
+	l->fonction = fonction;
+	l->arg = arg;
+
+	#ifdef _WIN32
+	*thread = CreateThread(NULL, 0, tw_lancement, l, 0, NULL);
+	if (*thread == NULL) {
+		free(l);
+		return -1;
+	}
+	#else
+	if (pthread_create(thread, NULL, tw_lancement, l) != 0) {
+		free(l);
+		return -1;
+	}
+	#endif
+	return 0;
+}
+
+/** \brief Attend la fin d'un thread lancé par tw_thread_create() et libère ses ressources
+ */
+void tw_thread_join(tw_thread thread) {
+	#ifdef _WIN32
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+	#else
+	pthread_join(thread, NULL);
+	#endif
+}
+
+
+void tw_mutex_init(tw_mutex *mutex) {
+	#ifdef _WIN32
+	InitializeCriticalSection(mutex);
+	#else
+	pthread_mutex_init(mutex, NULL);
+	#endif
+}
+
+void tw_mutex_lock(tw_mutex *mutex) {
+	#ifdef _WIN32
+	EnterCriticalSection(mutex);
+	#else
+	pthread_mutex_lock(mutex);
+	#endif
+}
+
+void tw_mutex_unlock(tw_mutex *mutex) {
+	#ifdef _WIN32
+	LeaveCriticalSection(mutex);
+	#else
+	pthread_mutex_unlock(mutex);
+	#endif
+}
+
+void tw_mutex_destroy(tw_mutex *mutex) {
+	#ifdef _WIN32
+	DeleteCriticalSection(mutex);
+	#else
+	pthread_mutex_destroy(mutex);
+	#endif
+}
+
+
+/** \brief Exécute la même fonction sur plusieurs threads, et attend qu'ils aient tous terminé
+ *  \param[in]  nb_threads Le nombre d'exécutions simultanées, thread appelant compris
+ *  \param[in]  fonction   La fonction, qui va typiquement chercher son travail dans une file partagée protégée par un tw_mutex
+ *  \param[in]  arg        L'argument commun transmis à toutes les exécutions
+ *  \note
+ *  - le thread appelant exécute lui-même une des instances, donc nb_threads=1 ne crée aucun thread
+ *  - si un thread ne peut pas être créé, le travail est simplement réparti sur ceux qui existent
+ */
+void tw_parallel(int nb_threads, tw_fonction fonction, void *arg) {
+	tw_thread threads[TW_MAX_THREADS];
+	int n=0;
+
+	if (nb_threads > TW_MAX_THREADS) nb_threads = TW_MAX_THREADS;
+	for (int i=1; i<nb_threads; i++) {
+		if (tw_thread_create(&threads[n], fonction, arg) == 0) n++;
+	}
+	fonction(arg);
+	for (int i=0; i<n; i++) {
+		tw_thread_join(threads[i]);
+	}
+}
+
+
+/** \brief Horloge monotone, pour mesurer la durée des calculs
+ *  \return un temps en secondes, dont seules les différences ont un sens
+ *  \note
+ *  - invoqué par kdf_calibrer() pour la commande calibrate
+ */
+double tw_horloge() {
+	#ifdef _WIN32
+	LARGE_INTEGER f, c;
+	QueryPerformanceFrequency(&f);
+	QueryPerformanceCounter(&c);
+	return (double)c.QuadPart / (double)f.QuadPart;
+	#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+	#endif
+}
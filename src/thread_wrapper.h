@@ -0,0 +1,63 @@
+/*
+    MPM 'Master Password Manager' 
+	Cryptographically secure Secret Sharing to store residual secret.
+    Copyright (C) 2018-2019 Bertrand MAUJEAN
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    A copy of the GNU GPLv3 License is included in the LICENSE.txt file
+    You can also see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef HAVE_THREAD_WRAPPER_H
+#define HAVE_THREAD_WRAPPER_H
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+
+#define TW_MAX_THREADS 64 /* nombre maximum de threads lancés par tw_parallel() */
+
+#ifdef _WIN32
+typedef HANDLE tw_thread;
+typedef CRITICAL_SECTION tw_mutex;
+#else
+typedef pthread_t tw_thread;
+typedef pthread_mutex_t tw_mutex;
+#endif
+
+typedef void (*tw_fonction)(void *arg); ///< fonction exécutée par un thread
+
+int tw_nb_cpu();
+int tw_thread_create(tw_thread *thread, tw_fonction fonction, void *arg);
+void tw_thread_join(tw_thread thread);
+void tw_mutex_init(tw_mutex *mutex);
+void tw_mutex_lock(tw_mutex *mutex);
+void tw_mutex_unlock(tw_mutex *mutex);
+void tw_mutex_destroy(tw_mutex *mutex);
+void tw_parallel(int nb_threads, tw_fonction fonction, void *arg);
+double tw_horloge();
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HAVE_THREAD_WRAPPER_H */